@@ -0,0 +1,1318 @@
+//-------------------------------------------------------------------
+//
+// File:      delta-bench.cc
+//
+// @copyright 2018 The IPFN Developers
+//
+// This file is provided to you under the Apache License,
+// Version 2.0 (the "License"); you may not use this file
+// except in compliance with the License.  You may obtain
+// a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+//
+// @doc
+//   Benchmarks for the datatypes in delta-crdts.cc
+//
+//   ./delta-bench [--filter=regex] [--max-size=n] [--min-time=s]
+//                 [--format=console|json]
+//
+//   Sizes run from 1e3 up to --max-size (default 1e5, up to 1e7).
+//   Times are per iteration, items_per_second counts operations.
+// @end
+//
+//
+//-------------------------------------------------------------------
+
+#include <set>
+#include <map>
+#include <regex>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <random>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <algorithm>
+#include <assert.h>
+#include "delta-crdts.cc"
+
+namespace bench
+{
+
+class state
+{
+  typedef std::chrono::steady_clock clock;
+
+  long done;
+  bool running;
+  clock::time_point start;
+  double elapsed; // seconds, excluding paused time
+
+public:
+  std::vector<long> args;
+  long iterations;
+  double items; // operations per iteration, for items_per_second
+  std::map<std::string, double> counters;
+
+  state(const std::vector<long> &a, long n)
+      : done(0), running(false), elapsed(0), args(a), iterations(n), items(0) {}
+
+  long range(size_t i) const { return args.at(i); }
+
+  // Drives the timed loop, while (st.keeprunning()) { ... }
+  bool keeprunning()
+  {
+    if (done == 0)
+      resume();
+    if (done++ < iterations)
+      return true;
+    pause();
+    return false;
+  }
+
+  // Exclude setup work inside the loop from the timing
+  void pause()
+  {
+    if (running)
+      elapsed += std::chrono::duration<double>(clock::now() - start).count();
+    running = false;
+  }
+
+  void resume()
+  {
+    start = clock::now();
+    running = true;
+  }
+
+  double seconds() const { return elapsed; }
+};
+
+// Results stored here are not optimized away
+volatile long sink;
+
+// Calls to the global operator new, for allocation counts. Benchmarks
+// may allocate on many threads, so it is bumped atomically.
+std::atomic<long> allocations(0);
+
+typedef void (*function)(state &);
+
+struct entry
+{
+  std::string name;
+  function fn;
+  std::vector<std::vector<long>> argsets;
+};
+
+std::vector<entry> &registry()
+{
+  static std::vector<entry> r;
+  return r;
+}
+
+bool add(const std::string &name, function fn, const std::vector<std::vector<long>> &argsets)
+{
+  entry e;
+  e.name = name;
+  e.fn = fn;
+  e.argsets = argsets;
+  registry().push_back(e);
+  return true;
+}
+
+// Argument sets
+
+long maxsize = 100000;
+
+std::vector<std::vector<long>> sizes(long hi = 10000000)
+{
+  std::vector<std::vector<long>> res;
+  for (long n = 1000; n <= hi; n *= 10)
+    res.push_back(std::vector<long>(1, n));
+  return res;
+}
+
+std::vector<std::vector<long>> product(const std::vector<std::vector<long>> &a, const std::vector<long> &b)
+{
+  std::vector<std::vector<long>> res;
+  for (const auto &x : a)
+    for (long y : b)
+    {
+      res.push_back(x);
+      res.back().push_back(y);
+    }
+  return res;
+}
+
+std::string label(const entry &e, const std::vector<long> &args)
+{
+  std::string res = e.name;
+  for (long a : args)
+    res += "/" + std::to_string(a);
+  return res;
+}
+
+struct result
+{
+  std::string name;
+  long iterations;
+  double ns; // per iteration
+  double items;
+  std::map<std::string, double> counters;
+};
+
+result run(const entry &e, const std::vector<long> &args, double mintime)
+{
+  typedef std::chrono::steady_clock clock;
+  clock::time_point began = clock::now();
+  long n = 1;
+  for (;;)
+  {
+    state st(args, n);
+    e.fn(st);
+    double t = st.seconds();
+    // Untimed setup can dominate, so also bound the wall clock time
+    double wall = std::chrono::duration<double>(clock::now() - began).count();
+    if (t >= mintime || wall >= 10 * mintime + 1 || n >= 1000000000)
+    {
+      result r;
+      r.name = label(e, args);
+      r.iterations = n;
+      r.ns = t * 1e9 / n;
+      r.items = st.items;
+      r.counters = st.counters;
+      return r;
+    }
+    // grow like google benchmark, aiming a bit over the minimum time
+    double mult = t > 0 ? 1.4 * mintime / t : 10;
+    n = std::max(n + 1, long(n * std::min(mult, 10.0)));
+  }
+}
+
+void printconsole(const result &r)
+{
+  std::printf("%-44s %14.0f ns %10ld", r.name.c_str(), r.ns, r.iterations);
+  if (r.items > 0)
+    std::printf(" %12.4g items/s", r.items * 1e9 / r.ns);
+  for (const auto &kv : r.counters)
+    std::printf(" %s=%g", kv.first.c_str(), kv.second);
+  std::printf("\n");
+  std::fflush(stdout);
+}
+
+void printjson(const std::vector<result> &rs)
+{
+  std::printf("{\n  \"context\": {\n");
+  std::printf("    \"library\": \"delta-crdts\",\n");
+  std::printf("    \"max_size\": %ld\n", maxsize);
+  std::printf("  },\n  \"benchmarks\": [\n");
+  for (size_t i = 0; i < rs.size(); i++)
+  {
+    const result &r = rs[i];
+    std::printf("    {\n");
+    std::printf("      \"name\": \"%s\",\n", r.name.c_str());
+    std::printf("      \"iterations\": %ld,\n", r.iterations);
+    std::printf("      \"real_time\": %.3f,\n", r.ns);
+    if (r.items > 0)
+      std::printf("      \"items_per_second\": %.6g,\n", r.items * 1e9 / r.ns);
+    for (const auto &kv : r.counters)
+      std::printf("      \"%s\": %.6g,\n", kv.first.c_str(), kv.second);
+    std::printf("      \"time_unit\": \"ns\"\n");
+    std::printf("    }%s\n", i + 1 < rs.size() ? "," : "");
+  }
+  std::printf("  ]\n}\n");
+}
+
+int main(int argc, char *argv[])
+{
+  std::string filter = ".*", format = "console";
+  double mintime = 0.2;
+  auto usage = [&]() {
+    std::cerr << "usage: " << argv[0]
+              << " [--filter=regex] [--max-size=n] [--min-time=s] [--format=console|json]"
+              << std::endl;
+    return 1;
+  };
+  for (int i = 1; i < argc; i++)
+  {
+    std::string a = argv[i];
+    if (a.compare(0, 9, "--filter=") == 0)
+      filter = a.substr(9);
+    else if (a.compare(0, 11, "--max-size=") == 0)
+      maxsize = std::atol(a.substr(11).c_str());
+    else if (a.compare(0, 11, "--min-time=") == 0)
+      mintime = std::atof(a.substr(11).c_str());
+    else if (a.compare(0, 9, "--format=") == 0)
+      format = a.substr(9);
+    else
+      return usage();
+  }
+  std::regex re;
+  try
+  {
+    re.assign(filter);
+  }
+  catch (const std::regex_error &)
+  {
+    std::cerr << "bad filter regex: " << filter << std::endl;
+    return usage();
+  }
+  std::vector<result> rs;
+  for (const auto &e : registry())
+    for (const auto &args : e.argsets)
+    {
+      if (!args.empty() && args[0] > maxsize)
+        continue; // first argument is always the size
+      if (!std::regex_search(label(e, args), re))
+        continue;
+      rs.push_back(run(e, args, mintime));
+      if (format == "console")
+        printconsole(rs.back());
+    }
+  if (format == "json")
+    printjson(rs);
+  return 0;
+}
+
+} // namespace bench
+
+void *operator new(std::size_t n)
+{
+  bench::allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void *p = std::malloc(n ? n : 1))
+    return p;
+  throw std::bad_alloc();
+}
+
+// Not inlined, so that the compiler does not pair free with new
+__attribute__((noinline)) void operator delete(void *p) noexcept
+{
+  std::free(p);
+}
+
+#define BENCHMARK(fn, argsets) \
+  static bool fn##_registered = bench::add(#fn, fn, argsets)
+
+// ---- Mutators
+
+void aworset_add(bench::state &st)
+{
+  long n = st.range(0);
+  while (st.keeprunning())
+  {
+    dtcrdt::aworset<long, int> s(0);
+    for (long i = 0; i < n; i++)
+      s.add(i);
+  }
+  st.items = n;
+}
+BENCHMARK(aworset_add, bench::sizes());
+
+void aworset_add_flat(bench::state &st)
+{
+  long n = st.range(0);
+  while (st.keeprunning())
+  {
+    dtcrdt::aworset<long, int, dtcrdt::flatstore> s(0);
+    for (long i = 0; i < n; i++)
+      s.add(i);
+  }
+  st.items = n;
+}
+BENCHMARK(aworset_add_flat, bench::sizes());
+
+void aworset_rmv(bench::state &st)
+{
+  long n = st.range(0);
+  dtcrdt::aworset<long, int> base(0);
+  for (long i = 0; i < n; i++)
+    base.add(i);
+  while (st.keeprunning())
+  {
+    st.pause();
+    dtcrdt::aworset<long, int> s = base;
+    st.resume();
+    for (long i = 0; i < n; i += 10)
+      s.rmv(i);
+  }
+  st.items = n / 10;
+}
+BENCHMARK(aworset_rmv, bench::sizes());
+
+// Deltas shipped from one replica to another over a hot set of 100
+// elements, in batches of 100 operations built in an arena if scoped
+template <typename S>
+void aworset_deltas(bench::state &st, bool scoped)
+{
+  typedef dtcrdt::aworset<long, int, S, dtcrdt::cached> set;
+  long n = st.range(0);
+  long allocs = 0;
+  dtcrdt::arena ar;
+  std::vector<set> batch;
+  batch.reserve(200);
+  while (st.keeprunning())
+  {
+    st.pause();
+    set a(0), b(1);
+    st.resume();
+    long before = bench::allocations.load(std::memory_order_relaxed);
+    for (long i = 0; i < n; i += 100)
+    {
+      {
+        std::unique_ptr<dtcrdt::arenascope> sc(scoped ? new dtcrdt::arenascope(ar) : nullptr);
+        for (long j = i; j < i + 100 && j < n; j++)
+        {
+          batch.push_back(a.add(j % 100));
+          if (j % 2)
+            batch.push_back(a.rmv((j + 50) % 100));
+        }
+      }
+      for (auto &d : batch)
+        b.join(std::move(d));
+      batch.clear();
+      ar.release();
+    }
+    allocs += bench::allocations.load(std::memory_order_relaxed) - before;
+    st.pause();
+  }
+  st.items = n;
+  st.counters["allocs"] = double(allocs) / st.iterations / n;
+}
+void aworset_deltas_map(bench::state &st) { aworset_deltas<dtcrdt::mapstore>(st, false); }
+void aworset_deltas_pool(bench::state &st) { aworset_deltas<dtcrdt::poolstore>(st, false); }
+void aworset_deltas_arena(bench::state &st) { aworset_deltas<dtcrdt::arenastore>(st, true); }
+BENCHMARK(aworset_deltas_map, bench::sizes());
+BENCHMARK(aworset_deltas_pool, bench::sizes());
+BENCHMARK(aworset_deltas_arena, bench::sizes());
+
+// Increments spread over a number of known replicas
+void gcounter_inc(bench::state &st)
+{
+  long n = st.range(0), r = st.range(1);
+  dtcrdt::gcounter<long, int> base(0);
+  for (int k = 1; k < r; k++)
+  {
+    dtcrdt::gcounter<long, int> o(k);
+    o.inc(k);
+    base.join(o);
+  }
+  while (st.keeprunning())
+  {
+    dtcrdt::gcounter<long, int> c = base;
+    for (long i = 0; i < n; i++)
+      c.inc();
+  }
+  st.items = n;
+}
+BENCHMARK(gcounter_inc, bench::product(bench::sizes(), {1, 16, 256}));
+
+void ccounter_inc(bench::state &st)
+{
+  long n = st.range(0);
+  while (st.keeprunning())
+  {
+    dtcrdt::ccounter<long, int> c(0);
+    for (long i = 0; i < n; i++)
+      c.inc();
+  }
+  st.items = n;
+}
+BENCHMARK(ccounter_inc, bench::sizes());
+
+// Local updates of counters that hold the dots of many replicas
+template <typename C>
+void counter_inc_replicas(bench::state &st)
+{
+  long n = st.range(0), r = st.range(1);
+  C base(0);
+  for (long k = 1; k <= r; k++)
+  {
+    C o = C(int(k));
+    base.join(o.inc(k));
+  }
+  while (st.keeprunning())
+  {
+    st.pause();
+    C c = base;
+    st.resume();
+    for (long i = 0; i < n; i++)
+      c.inc();
+  }
+  st.items = n;
+}
+
+void ccounter_inc_replicas(bench::state &st) { counter_inc_replicas<dtcrdt::ccounter<long, int>>(st); }
+void rwcounter_inc_replicas(bench::state &st) { counter_inc_replicas<dtcrdt::rwcounter<long, int>>(st); }
+BENCHMARK(ccounter_inc_replicas, bench::product(bench::sizes(10000), {1, 100, 10000}));
+BENCHMARK(rwcounter_inc_replicas, bench::product(bench::sizes(10000), {1, 100, 10000}));
+
+void ormap_add(bench::state &st)
+{
+  long n = st.range(0);
+  while (st.keeprunning())
+  {
+    dtcrdt::ormap<long, dtcrdt::aworset<long, int>, int> m(0);
+    for (long i = 0; i < n; i++)
+      m[i % 1000].add(i);
+  }
+  st.items = n;
+}
+BENCHMARK(ormap_add, bench::sizes());
+
+void orseq_push_back(bench::state &st)
+{
+  long n = st.range(0);
+  while (st.keeprunning())
+  {
+    dtcrdt::orseq<char, int> s(0);
+    for (long i = 0; i < n; i++)
+      s.push_back('a');
+  }
+  st.items = n;
+}
+// Appends grow bisected identifiers by a bit each, so larger sizes are slow
+BENCHMARK(orseq_push_back, bench::sizes(10000));
+
+// Edits and reads at random indexes, on list and tree backed sequences
+template <typename S>
+void orseq_insert_at(bench::state &st)
+{
+  long n = st.range(0);
+  std::minstd_rand rnd(1);
+  while (st.keeprunning())
+  {
+    dtcrdt::orseq<char, int, S> s(0);
+    for (long i = 0; i < n; i++)
+      s.insert_at(rnd() % (s.size() + 1), 'a');
+  }
+  st.items = n;
+}
+
+template <typename S>
+void orseq_at(bench::state &st)
+{
+  long n = st.range(0);
+  std::minstd_rand rnd(1);
+  dtcrdt::orseq<char, int, S> s(0);
+  for (long i = 0; i < n; i++)
+    s.insert_at(rnd() % (s.size() + 1), 'a');
+  long sum = 0;
+  while (st.keeprunning())
+    for (int i = 0; i < 100; i++)
+      sum += s.at(rnd() % n);
+  bench::sink = sum;
+  st.items = 100;
+}
+
+void orseq_insert_at_list(bench::state &st) { orseq_insert_at<dtcrdt::listseq>(st); }
+void orseq_insert_at_tree(bench::state &st) { orseq_insert_at<dtcrdt::treeseq>(st); }
+void orseq_at_list(bench::state &st) { orseq_at<dtcrdt::listseq>(st); }
+void orseq_at_tree(bench::state &st) { orseq_at<dtcrdt::treeseq>(st); }
+BENCHMARK(orseq_insert_at_list, bench::sizes(100000));
+BENCHMARK(orseq_insert_at_tree, bench::sizes(100000));
+BENCHMARK(orseq_at_list, bench::sizes(100000));
+BENCHMARK(orseq_at_tree, bench::sizes(100000));
+
+// Text typed in runs of 20 characters at random places, positional inserts
+// walk the sequence so sizes stop at 1e4
+template <typename S>
+void type(dtcrdt::orseq<char, int, S> &s, long n, std::minstd_rand &rnd)
+{
+  for (long i = 0; i < n; i += 20)
+  {
+    size_t k = rnd() % (s.size() + 1);
+    for (long j = 0; j < 20 && i + j < n; j++)
+      s.insert_at(k + j, char('a' + j));
+  }
+}
+
+template <typename S>
+void orseq_type(bench::state &st)
+{
+  long n = st.range(0);
+  while (st.keeprunning())
+  {
+    std::minstd_rand rnd(1);
+    dtcrdt::orseq<char, int, S> s(0);
+    type(s, n, rnd);
+  }
+  st.items = n;
+}
+
+// Merge of typed text into a replica that has most of it
+template <typename S>
+void orseq_type_join(bench::state &st)
+{
+  long n = st.range(0);
+  std::minstd_rand rnd(1);
+  dtcrdt::orseq<char, int, S> a(0), b(1);
+  type(a, n, rnd);
+  b.join(a);
+  type(a, n / 10, rnd);
+  while (st.keeprunning())
+  {
+    st.pause();
+    dtcrdt::orseq<char, int, S> x = b;
+    st.resume();
+    x.join(a);
+  }
+  st.items = n;
+}
+
+void orseq_type_list(bench::state &st) { orseq_type<dtcrdt::listseq>(st); }
+void orseq_type_block(bench::state &st) { orseq_type<dtcrdt::blockseq>(st); }
+void orseq_type_join_list(bench::state &st) { orseq_type_join<dtcrdt::listseq>(st); }
+void orseq_type_join_block(bench::state &st) { orseq_type_join<dtcrdt::blockseq>(st); }
+BENCHMARK(orseq_type_list, bench::sizes(10000));
+BENCHMARK(orseq_type_block, bench::sizes(10000));
+BENCHMARK(orseq_type_join_list, bench::sizes(10000));
+BENCHMARK(orseq_type_join_block, bench::sizes(10000));
+
+// Average identifier length in bits, per allocation and workload
+enum class workload { append, prepend, random };
+
+template <dtcrdt::alloc A, workload W>
+void orseq_idlen(bench::state &st)
+{
+  long n = st.range(0);
+  double bits = 0;
+  while (st.keeprunning())
+  {
+    std::minstd_rand rnd(1);
+    dtcrdt::orseq<char, int, dtcrdt::treeseq> s(0);
+    s.allocation(A);
+    for (long i = 0; i < n; i++)
+      if (W == workload::append)
+        s.push_back('a');
+      else if (W == workload::prepend)
+        s.push_front('a');
+      else
+        s.insert_at(rnd() % (s.size() + 1), 'a');
+    bits = 0;
+    for (const auto &t : s)
+      bits += std::get<0>(t).size();
+  }
+  st.items = n;
+  st.counters["bits"] = bits / n;
+}
+
+void orseq_idlen_append_bisect(bench::state &st) { orseq_idlen<dtcrdt::alloc::bisect, workload::append>(st); }
+void orseq_idlen_append_lseq(bench::state &st) { orseq_idlen<dtcrdt::alloc::lseq, workload::append>(st); }
+void orseq_idlen_prepend_bisect(bench::state &st) { orseq_idlen<dtcrdt::alloc::bisect, workload::prepend>(st); }
+void orseq_idlen_prepend_lseq(bench::state &st) { orseq_idlen<dtcrdt::alloc::lseq, workload::prepend>(st); }
+void orseq_idlen_random_bisect(bench::state &st) { orseq_idlen<dtcrdt::alloc::bisect, workload::random>(st); }
+void orseq_idlen_random_lseq(bench::state &st) { orseq_idlen<dtcrdt::alloc::lseq, workload::random>(st); }
+// Bisect ids grow linearly on appends and prepends
+BENCHMARK(orseq_idlen_append_bisect, bench::sizes(1000));
+BENCHMARK(orseq_idlen_append_lseq, bench::sizes(100000));
+BENCHMARK(orseq_idlen_prepend_bisect, bench::sizes(1000));
+BENCHMARK(orseq_idlen_prepend_lseq, bench::sizes(100000));
+BENCHMARK(orseq_idlen_random_bisect, bench::sizes(100000));
+BENCHMARK(orseq_idlen_random_lseq, bench::sizes(100000));
+
+// Resolve of a register written concurrently by n replicas
+template <typename V, typename F>
+void mvreg_resolve(bench::state &st, F value)
+{
+  long n = st.range(0);
+  std::minstd_rand rnd(1);
+  std::vector<dtcrdt::mvreg<V, int>> rs;
+  for (long i = 0; i < n; i++)
+  {
+    rs.push_back(dtcrdt::mvreg<V, int>(int(i)));
+    rs.back().write(value(rnd));
+  }
+  for (size_t w = 1; w < rs.size(); w *= 2) // Pairwise, to keep joins small
+    for (size_t i = 0; i + w < rs.size(); i += 2 * w)
+      rs[i].join(rs[i + w]);
+  while (st.keeprunning())
+  {
+    st.pause();
+    dtcrdt::mvreg<V, int> x = rs[0];
+    st.resume();
+    x.resolve();
+  }
+  st.items = n;
+}
+
+void mvreg_resolve_total(bench::state &st)
+{
+  mvreg_resolve<long>(st, [](std::minstd_rand &rnd) { return long(rnd()); });
+}
+void mvreg_resolve_partial(bench::state &st)
+{
+  mvreg_resolve<std::pair<long, long>>(st, [](std::minstd_rand &rnd) {
+    return std::pair<long, long>(rnd() % 1000, rnd() % 1000);
+  });
+}
+BENCHMARK(mvreg_resolve_total, bench::sizes(100000));
+BENCHMARK(mvreg_resolve_partial, bench::sizes(100000));
+
+// ---- Reads
+
+void aworset_read(bench::state &st)
+{
+  long n = st.range(0);
+  dtcrdt::aworset<long, int> s(0);
+  for (long i = 0; i < n; i++)
+    s.add(i);
+  while (st.keeprunning())
+  {
+    std::set<long> r = s.read();
+    assert(long(r.size()) == n);
+  }
+  st.items = n;
+}
+BENCHMARK(aworset_read, bench::sizes());
+
+void aworset_in(bench::state &st)
+{
+  long n = st.range(0);
+  dtcrdt::aworset<long, int> s(0);
+  for (long i = 0; i < n; i++)
+    s.add(i);
+  long found = 0;
+  while (st.keeprunning())
+    for (long i = 0; i < 100; i++)
+      found += s.in(i * (n / 100));
+  bench::sink = found;
+  st.items = 100;
+}
+BENCHMARK(aworset_in, bench::sizes());
+
+void rworset_in(bench::state &st)
+{
+  long n = st.range(0);
+  dtcrdt::rworset<long, int> s(0);
+  for (long i = 0; i < n; i++)
+    s.add(i);
+  for (long i = 0; i < n; i += 2)
+    s.rmv(i);
+  long found = 0;
+  while (st.keeprunning())
+    for (long i = 0; i < 100; i++)
+      found += s.in(i * (n / 100) + 1);
+  bench::sink = found;
+  st.items = 100;
+}
+BENCHMARK(rworset_in, bench::sizes());
+
+template <typename G>
+void counter_read(bench::state &st)
+{
+  long r = st.range(0);
+  G c(0);
+  for (int k = 1; k < r; k++)
+  {
+    G o(k);
+    o.inc(k);
+    c.join(o);
+  }
+  long sum = 0;
+  while (st.keeprunning())
+    sum += c.read();
+  bench::sink = sum;
+  st.items = r;
+}
+
+void gcounter_read(bench::state &st) { counter_read<dtcrdt::gcounter<long, int>>(st); }
+void gcounter_read_cached(bench::state &st) { counter_read<dtcrdt::gcounter<long, int, dtcrdt::cached>>(st); }
+void densecounter_read(bench::state &st) { counter_read<dtcrdt::densecounter<long, int>>(st); }
+BENCHMARK(gcounter_read, bench::sizes());
+BENCHMARK(gcounter_read_cached, bench::sizes());
+BENCHMARK(densecounter_read, bench::sizes());
+
+// Cached sets pay on every update so that reads are free
+void aworset_add_cached(bench::state &st)
+{
+  long n = st.range(0);
+  while (st.keeprunning())
+  {
+    dtcrdt::aworset<long, int, dtcrdt::mapstore, dtcrdt::cached> s(0);
+    for (long i = 0; i < n; i++)
+      s.add(i);
+  }
+  st.items = n;
+}
+BENCHMARK(aworset_add_cached, bench::sizes());
+
+void aworset_view_cached(bench::state &st)
+{
+  long n = st.range(0);
+  dtcrdt::aworset<long, int, dtcrdt::mapstore, dtcrdt::cached> s(0);
+  for (long i = 0; i < n; i++)
+    s.add(i);
+  long found = 0;
+  while (st.keeprunning())
+    found += s.view().size();
+  bench::sink = found;
+  st.items = n;
+}
+BENCHMARK(aworset_view_cached, bench::sizes());
+
+// ---- Joins, full states versus deltas
+//
+// Two replicas share n elements, then each touches a percentage of them
+// concurrently (the conflict ratio) and the other replica is joined in,
+// either as full state or as the delta of its operations.
+
+template <typename S>
+void makereplicas(long n, long conflict, S &a, S &b, S &delta)
+{
+  for (long i = 0; i < n; i++)
+    a.add(i);
+  b.join(a);
+  long k = n * conflict / 100;
+  for (long i = 0; i < k; i++)
+  {
+    a.add(n + i);
+    delta.join(b.rmv(i));
+    delta.join(b.add(2 * n + i));
+  }
+}
+
+template <typename St>
+void aworset_join(bench::state &st)
+{
+  long n = st.range(0), conflict = st.range(1);
+  dtcrdt::aworset<long, int, St> a(0), b(1), d;
+  makereplicas(n, conflict, a, b, d);
+  while (st.keeprunning())
+  {
+    st.pause();
+    dtcrdt::aworset<long, int, St> x = a;
+    st.resume();
+    x.join(b);
+  }
+  st.items = n;
+}
+
+template <typename St>
+void aworset_join_delta(bench::state &st)
+{
+  long n = st.range(0), conflict = st.range(1);
+  dtcrdt::aworset<long, int, St> a(0), b(1), d;
+  makereplicas(n, conflict, a, b, d);
+  while (st.keeprunning())
+  {
+    st.pause();
+    dtcrdt::aworset<long, int, St> x = a;
+    st.resume();
+    x.join(d);
+  }
+  st.items = n;
+}
+
+void aworset_join_map(bench::state &st) { aworset_join<dtcrdt::mapstore>(st); }
+void aworset_join_flat(bench::state &st) { aworset_join<dtcrdt::flatstore>(st); }
+void aworset_join_delta_map(bench::state &st) { aworset_join_delta<dtcrdt::mapstore>(st); }
+void aworset_join_delta_flat(bench::state &st) { aworset_join_delta<dtcrdt::flatstore>(st); }
+BENCHMARK(aworset_join_map, bench::product(bench::sizes(), {1, 10, 50}));
+BENCHMARK(aworset_join_flat, bench::product(bench::sizes(), {1, 10, 50}));
+BENCHMARK(aworset_join_delta_map, bench::product(bench::sizes(), {1, 10, 50}));
+BENCHMARK(aworset_join_delta_flat, bench::product(bench::sizes(), {1, 10, 50}));
+
+// n elements added over r replicas, then all joined into one
+void aworset_join_replicas(bench::state &st)
+{
+  long n = st.range(0), r = st.range(1);
+  std::vector<dtcrdt::aworset<long, int>> rs;
+  for (int k = 0; k < r; k++)
+    rs.push_back(dtcrdt::aworset<long, int>(k));
+  for (long i = 0; i < n; i++)
+    rs[i % r].add(i);
+  while (st.keeprunning())
+  {
+    dtcrdt::aworset<long, int> x = dtcrdt::aworset<long, int>(r);
+    for (const auto &o : rs)
+      x.join(o);
+  }
+  st.items = n;
+}
+BENCHMARK(aworset_join_replicas, bench::product(bench::sizes(), {2, 16, 64}));
+
+// Same, with named replicas as strings and as interned ids
+template <typename K>
+void aworset_join_ids(bench::state &st)
+{
+  long n = st.range(0), r = st.range(1);
+  std::vector<dtcrdt::aworset<long, K>> rs;
+  for (int k = 0; k < r; k++)
+    rs.push_back(dtcrdt::aworset<long, K>(K("replica-" + std::to_string(k))));
+  for (long i = 0; i < n; i++)
+    rs[i % r].add(i);
+  while (st.keeprunning())
+  {
+    dtcrdt::aworset<long, K> x = dtcrdt::aworset<long, K>(K("joiner"));
+    for (const auto &o : rs)
+      x.join(o);
+  }
+  st.items = n;
+}
+
+void aworset_join_ids_string(bench::state &st) { aworset_join_ids<std::string>(st); }
+void aworset_join_ids_interned(bench::state &st) { aworset_join_ids<dtcrdt::replicaid>(st); }
+BENCHMARK(aworset_join_ids_string, bench::product(bench::sizes(), {16}));
+BENCHMARK(aworset_join_ids_interned, bench::product(bench::sizes(), {16}));
+
+template <typename G>
+void counter_join(bench::state &st)
+{
+  long r = st.range(0);
+  G a(0), b(1);
+  for (int k = 0; k < r; k++)
+  {
+    G o(k);
+    o.inc(k + 1);
+    if (k % 2)
+      a.join(o);
+    b.join(o);
+  }
+  while (st.keeprunning())
+  {
+    st.pause();
+    G x = a;
+    st.resume();
+    x.join(b);
+  }
+  st.items = r;
+}
+void gcounter_join(bench::state &st) { counter_join<dtcrdt::gcounter<long, int>>(st); }
+void densecounter_join(bench::state &st) { counter_join<dtcrdt::densecounter<long, int>>(st); }
+BENCHMARK(gcounter_join, bench::sizes());
+BENCHMARK(densecounter_join, bench::sizes());
+
+// Joins of two states holding every other key and all keys, a third of
+// them removed
+void twopset_join(bench::state &st)
+{
+  long n = st.range(0);
+  dtcrdt::twopset<long> a, b;
+  for (long k = 0; k < n; k++)
+  {
+    if (k % 2)
+      a.add(k);
+    b.add(k);
+    if (k % 3 == 0)
+      b.rmv(k);
+  }
+  while (st.keeprunning())
+  {
+    st.pause();
+    dtcrdt::twopset<long> x = a;
+    st.resume();
+    x.join(b);
+  }
+  st.items = n;
+}
+BENCHMARK(twopset_join, bench::sizes());
+
+void rwlwwset_join(bench::state &st)
+{
+  long n = st.range(0);
+  dtcrdt::rwlwwset<long, long> a, b;
+  for (long k = 0; k < n; k++)
+  {
+    if (k % 2)
+      a.add(k, k);
+    if (k % 3)
+      b.add(k + 1, k);
+    else
+      b.rmv(k, k);
+  }
+  while (st.keeprunning())
+  {
+    st.pause();
+    dtcrdt::rwlwwset<long, long> x = a;
+    st.resume();
+    x.join(b);
+  }
+  st.items = n;
+}
+BENCHMARK(rwlwwset_join, bench::sizes());
+
+// Bootstrapping an empty replica from a received full state
+template <bool move>
+void aworset_join_fresh(bench::state &st)
+{
+  long n = st.range(0);
+  dtcrdt::aworset<long, int> a(1);
+  for (long i = 0; i < n; i++)
+    a.add(i);
+  while (st.keeprunning())
+  {
+    st.pause();
+    dtcrdt::aworset<long, int> x(0), m = a;
+    st.resume();
+    if (move)
+      x.join(std::move(m));
+    else
+      x.join(m);
+  }
+  st.items = n;
+}
+void aworset_join_fresh_copy(bench::state &st) { aworset_join_fresh<false>(st); }
+void aworset_join_fresh_move(bench::state &st) { aworset_join_fresh<true>(st); }
+BENCHMARK(aworset_join_fresh_copy, bench::sizes());
+BENCHMARK(aworset_join_fresh_move, bench::sizes());
+
+void ormap_join(bench::state &st)
+{
+  long n = st.range(0), conflict = st.range(1);
+  dtcrdt::ormap<long, dtcrdt::aworset<long, int>, int> a(0), b(1);
+  for (long i = 0; i < n; i++)
+    a[i].add(i);
+  b.join(a);
+  for (long i = 0; i < n * conflict / 100; i++)
+    b[i].add(n + i);
+  while (st.keeprunning())
+  {
+    st.pause();
+    dtcrdt::ormap<long, dtcrdt::aworset<long, int>, int> x(0);
+    x.join(a);
+    st.resume();
+    x.join(b);
+  }
+  st.items = n;
+}
+BENCHMARK(ormap_join, bench::product(bench::sizes(), {1, 10, 50}));
+
+// Full states of n keys, a tenth conflicting, joined on up to t threads
+void ormap_join_parallel(bench::state &st)
+{
+  long n = st.range(0), threads = st.range(1);
+  typedef dtcrdt::ormap<long, dtcrdt::aworset<long, int>, int> map;
+  map a(0), b(1);
+  for (long i = 0; i < n; i++)
+    a[i].add(i);
+  b.join(a);
+  for (long i = 0; i < n; i += 10)
+    b[i].add(n + i);
+  for (long i = n; i < 2 * n; i++)
+    b[i].add(i);
+  map x(0);
+  while (st.keeprunning())
+  {
+    st.pause();
+    x = a;
+    st.resume();
+    x.join(b, unsigned(threads));
+  }
+  st.items = 2 * n;
+}
+BENCHMARK(ormap_join_parallel, bench::product(bench::sizes(), {1, 2, 4, 8}));
+
+void gmap_join_parallel(bench::state &st)
+{
+  long n = st.range(0), threads = st.range(1);
+  typedef dtcrdt::gmap<long, dtcrdt::gcounter<long, int>> map;
+  map a, b;
+  for (long i = 0; i < n; i++)
+  {
+    dtcrdt::gcounter<long, int> c(int(i % 16));
+    c.inc(i);
+    a[i].join(c);
+    b[i + n / 2].join(c);
+  }
+  map x;
+  while (st.keeprunning())
+  {
+    st.pause();
+    x = a;
+    st.resume();
+    x.join(b, unsigned(threads));
+  }
+  st.items = 2 * n;
+}
+BENCHMARK(gmap_join_parallel, bench::product(bench::sizes(), {1, 2, 4, 8}));
+
+// Remote single key deltas joined into a map of n keys
+void ormap_join_deltas(bench::state &st)
+{
+  long n = st.range(0);
+  typedef dtcrdt::ormap<long, dtcrdt::aworset<long, int>, int> map;
+  map a(0), b(1);
+  for (long i = 0; i < n; i++)
+    b.join(a.apply(i, [&](dtcrdt::aworset<long, int> &s) { return s.add(i); }));
+  std::vector<map> ds;
+  for (long i = 0; i < 1000; i++)
+    ds.push_back(a.apply(i * 7919 % n, [&](dtcrdt::aworset<long, int> &s) { return s.add(n + i); }));
+  map x(1);
+  while (st.keeprunning())
+  {
+    st.pause();
+    x = b; // the old copy is freed untimed
+    st.resume();
+    for (const auto &d : ds)
+      x.join(d);
+  }
+  st.items = ds.size();
+}
+BENCHMARK(ormap_join_deltas, bench::sizes(100000));
+
+// Merge walk over two sequences that share most elements
+void orseq_join(bench::state &st)
+{
+  long n = st.range(0);
+  std::minstd_rand rnd(1);
+  dtcrdt::orseq<char, int, dtcrdt::treeseq> a(0), b(1);
+  for (long i = 0; i < n; i++)
+    a.insert_at(rnd() % (a.size() + 1), 'a');
+  b.join(a);
+  for (long i = 0; i < n / 10; i++)
+    b.insert_at(rnd() % (b.size() + 1), 'b');
+  while (st.keeprunning())
+  {
+    st.pause();
+    dtcrdt::orseq<char, int, dtcrdt::treeseq> x = a;
+    st.resume();
+    x.join(b);
+  }
+  st.items = n;
+}
+BENCHMARK(orseq_join, bench::sizes(100000));
+
+// ---- Causal context compaction
+
+// n dots from r replicas arriving in random order, compacted at the end
+void dotcontext_compact(bench::state &st)
+{
+  long n = st.range(0), r = st.range(1);
+  std::vector<std::pair<int, int>> dots;
+  for (long i = 0; i < n; i++)
+    dots.push_back(std::pair<int, int>(int(i % r), int(i / r + 1)));
+  std::shuffle(dots.begin(), dots.end(), std::minstd_rand(1));
+  while (st.keeprunning())
+  {
+    dtcrdt::dotcontext<int> c;
+    for (const auto &d : dots)
+      c.insertdot(d, false);
+    c.compact();
+  }
+  st.items = n;
+}
+BENCHMARK(dotcontext_compact, bench::product(bench::sizes(), {1, 16}));
+
+// Contexts with every other dot missing, joined together
+void dotcontext_join_holes(bench::state &st)
+{
+  long n = st.range(0);
+  dtcrdt::dotcontext<int> a, b;
+  for (long i = 1; i <= n; i++)
+    (i % 2 ? a : b).insertdot(std::pair<int, int>(0, int(i) + 1));
+  while (st.keeprunning())
+  {
+    st.pause();
+    dtcrdt::dotcontext<int> x;
+    x = a;
+    st.resume();
+    x.join(b);
+  }
+  st.items = n;
+}
+BENCHMARK(dotcontext_join_holes, bench::sizes());
+
+// ---- Batched joins
+
+// A replica catching up on k deltas from a peer, some of them removals,
+// joined one at a time or all at once
+template <bool many>
+void aworset_catchup(bench::state &st)
+{
+  long n = st.range(0), k = st.range(1);
+  typedef dtcrdt::aworset<long, int> set;
+  set a(0), b(1);
+  for (long i = 0; i < n; i++)
+    b.join(a.add(i));
+  std::vector<set> ds;
+  for (long i = 0; i < k; i++)
+    ds.push_back(i % 4 == 3 ? a.rmv(i * 7919 % n) : a.add(n + i));
+  set x;
+  while (st.keeprunning())
+  {
+    st.pause();
+    x = b;
+    st.resume();
+    if (many)
+      x.join_many(ds.begin(), ds.end());
+    else
+      for (const auto &d : ds)
+        x.join(d);
+  }
+  st.items = k;
+}
+void aworset_catchup_each(bench::state &st) { aworset_catchup<false>(st); }
+void aworset_catchup_many(bench::state &st) { aworset_catchup<true>(st); }
+BENCHMARK(aworset_catchup_each, bench::product(bench::sizes(10000), {100, 1000}));
+BENCHMARK(aworset_catchup_many, bench::product(bench::sizes(10000), {100, 1000}));
+
+template <bool many>
+void ormap_catchup(bench::state &st)
+{
+  long n = st.range(0), k = st.range(1);
+  typedef dtcrdt::ormap<long, dtcrdt::aworset<long, int>, int> map;
+  map a(0), b(1);
+  for (long i = 0; i < n; i++)
+    b.join(a.apply(i, [&](dtcrdt::aworset<long, int> &s) { return s.add(i); }));
+  std::vector<map> ds;
+  for (long i = 0; i < k; i++)
+    ds.push_back(i % 4 == 3 ? a.erase(i * 7919 % n)
+                            : a.apply(i * 104729 % n, [&](dtcrdt::aworset<long, int> &s) { return s.add(n + i); }));
+  map x(1);
+  while (st.keeprunning())
+  {
+    st.pause();
+    x = b;
+    st.resume();
+    if (many)
+      x.join_many(ds.begin(), ds.end());
+    else
+      for (const auto &d : ds)
+        x.join(d);
+  }
+  st.items = k;
+}
+void ormap_catchup_each(bench::state &st) { ormap_catchup<false>(st); }
+void ormap_catchup_many(bench::state &st) { ormap_catchup<true>(st); }
+BENCHMARK(ormap_catchup_each, bench::product(bench::sizes(10000), {100, 1000}));
+BENCHMARK(ormap_catchup_many, bench::product(bench::sizes(10000), {100, 1000}));
+
+// Anti-entropy after a partition in which the peer missed k updates, a
+// quarter of them erases. Reports encoded delta and state sizes.
+void ormap_delta_since(bench::state &st)
+{
+  long n = st.range(0), k = st.range(1);
+  typedef dtcrdt::ormap<long, dtcrdt::aworset<long, int>, int> map;
+  map a(0), b(1);
+  for (long i = 0; i < n; i++)
+    a.apply(i, [&](dtcrdt::aworset<long, int> &s) { return s.add(i); });
+  b.join(a);
+  for (long i = 0; i < k; i++)
+    if (i % 4 == 3)
+      a.erase(i * 7919 % n);
+    else
+      a.apply(i * 104729 % n, [&](dtcrdt::aworset<long, int> &s) { return s.add(n + i); });
+  size_t bytes = 0;
+  while (st.keeprunning())
+    bytes = dtcrdt::encode(a.delta_since(b.context())).size();
+  st.items = n;
+  st.counters["delta_bytes"] = double(bytes);
+  st.counters["state_bytes"] = double(dtcrdt::encode(a).size());
+}
+BENCHMARK(ormap_delta_since, bench::product(bench::sizes(100000), {100}));
+
+// ---- Concurrency
+
+// Threads doing 8 reads, a local mutation and a remote delta join per
+// 10 operations on a map of 1e5 keys, args are shards and threads
+void shardmap_ops(bench::state &st)
+{
+  long shards = st.range(0), threads = st.range(1), keys = 100000, ops = 64000;
+  typedef dtcrdt::aworset<long, int> set;
+  typedef dtcrdt::ormap<long, set, int> map;
+  std::vector<int> ids;
+  for (int i = 0; i < shards; i++)
+    ids.push_back(i);
+  dtcrdt::shardmap<long, set, int> m(ids);
+  for (long k = 0; k < keys; k++)
+    m.apply(k, [&](set &s) { return s.add(k); });
+  std::vector<map> remotes;
+  std::vector<std::minstd_rand> rnds;
+  for (long t = 0; t < threads; t++)
+  {
+    remotes.push_back(map(int(1000 + t)));
+    rnds.push_back(std::minstd_rand(t + 1));
+  }
+  long hits = 0, next = keys; // added values are fresh, so deltas remove nothing
+  while (st.keeprunning())
+  {
+    std::vector<std::thread> ts;
+    std::vector<long> found(threads);
+    for (long t = 0; t < threads; t++, next += ops / threads)
+      ts.emplace_back([&, t](long v) {
+        for (long i = 0; i < ops / threads; i++, v++)
+        {
+          long k = rnds[t]() % keys;
+          if (i % 10 < 8)
+            m.find(k, [&](set &s) { found[t] += s.in(k); });
+          else if (i % 10 == 8)
+            m.apply(k, [&](set &s) { return s.add(v); });
+          else
+            m.join(remotes[t].apply(k, [&](set &s) { return s.add(v); }));
+        }
+      }, next);
+    for (auto &th : ts)
+      th.join();
+    for (long f : found)
+      hits += f;
+  }
+  bench::sink = hits;
+  st.items = ops;
+}
+BENCHMARK(shardmap_ops, bench::product({{1}, {64}}, {1, 2, 4, 8, 16, 32, 64}));
+
+// Producer threads delivering 1000 remote deltas each to a set of 1e4
+// elements, joined under a mutex one by one or coalesced by a deltaqueue
+template <bool queued>
+void delta_ingest(bench::state &st)
+{
+  long producers = st.range(0), n = 10000, per = 1000;
+  typedef dtcrdt::aworset<long, int> set;
+  set base(0);
+  for (long i = 0; i < n; i++)
+    base.add(i);
+  std::vector<std::vector<set>> ds(producers);
+  for (long p = 0; p < producers; p++)
+  {
+    set r(int(p + 1));
+    for (long i = 0; i < per; i++)
+      ds[p].push_back(r.add(n + p * per + i));
+  }
+  set x;
+  while (st.keeprunning())
+  {
+    st.pause();
+    x = base;
+    st.resume();
+    std::mutex mtx;
+    dtcrdt::deltaqueue<set> q(x);
+    if (queued)
+      q.start();
+    std::vector<std::thread> ts;
+    for (long p = 0; p < producers; p++)
+      ts.emplace_back([&, p]() {
+        for (const auto &d : ds[p])
+          if (queued)
+            q.push(d);
+          else
+          {
+            std::lock_guard<std::mutex> lock(mtx);
+            x.join(d);
+          }
+      });
+    for (auto &t : ts)
+      t.join();
+    q.stop();
+  }
+  st.items = producers * per;
+}
+void delta_ingest_mutex(bench::state &st) { delta_ingest<false>(st); }
+void delta_ingest_queue(bench::state &st) { delta_ingest<true>(st); }
+BENCHMARK(delta_ingest_mutex, std::vector<std::vector<long>>({{1}, {2}, {4}, {8}}));
+BENCHMARK(delta_ingest_queue, std::vector<std::vector<long>>({{1}, {2}, {4}, {8}}));
+
+int main(int argc, char *argv[])
+{
+  return bench::main(argc, argv);
+}
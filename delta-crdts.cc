@@ -29,14 +29,36 @@
 //-------------------------------------------------------------------
 
 #include <set>
+#include <algorithm>
 #include <unordered_set>
 #include <map>
 #include <list>
 #include <tuple>
+#include <iterator>
 #include <vector>
 #include <string>
+#include <cstring>
+#include <cstdint>
+#include <limits>
+#include <cmath>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <thread>
+#include <memory>
+#include <functional>
+#include <unordered_map>
 #include <iostream>
 #include <type_traits>
+#include <array>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE4_1__)
+#include <smmintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 namespace dtcrdt
 {
@@ -45,12 +67,9 @@ template <bool b>
 struct join_selector
 {
   template <typename T>
-  static T join(const T &l, const T &r)
+  static void into(T &l, const T &r)
   {
-    T res;
-    res = l;
-    res.join(r);
-    return res;
+    l.join(r);
   }
 };
 
@@ -58,28 +77,193 @@ template <>
 struct join_selector<true>
 {
   template <typename T>
-  static T join(const T &l, const T &r)
+  static void into(T &l, const T &r)
   {
-    T res;
-    res = std::max(l, r);
-    return res;
+    if (l < r)
+      l = r;
   }
 };
 
 // Join with C++ traits
+template <typename T> // Join r into l, in place
+void join_into(T &l, const T &r)
+{
+  join_selector<std::is_arithmetic<T>::value>::into(l, r);
+}
+
+template <typename A, typename B> // Pairs join by member
+void join_into(std::pair<A, B> &l, const std::pair<A, B> &r)
+{
+  join_into(l.first, r.first);
+  join_into(l.second, r.second);
+}
+
 template <typename T>          // Join two objects, deriving a new one
 T join(const T &l, const T &r) // assuming copy constructor
 {
-  return join_selector<std::is_arithmetic<T>::value>::join(l, r);
+  T res;
+  res = l;
+  join_into(res, r);
+  return res;
 }
 
-template <typename A, typename B> // Join two pairs of objects
-std::pair<A, B> join(const std::pair<A, B> &l, const std::pair<A, B> &r)
+template <typename T> // Join into an expiring object, reusing its storage
+typename std::enable_if<!std::is_lvalue_reference<T>::value, T>::type join(T &&l, const T &r)
 {
-  std::pair<A, B> res;
-  res.first = join(r.first, l.first);
-  res.second = join(r.second, l.second);
-  return res;
+  join_into(l, r);
+  return std::move(l);
+}
+
+// Runs f(i) for every i below n, in contiguous chunks of at least grain
+// over up to threads threads, the calling one included
+template <typename F>
+void parallelfor(size_t n, unsigned threads, size_t grain, F f)
+{
+  size_t parts = std::max<size_t>(1, std::min<size_t>(threads, n / std::max<size_t>(grain, 1)));
+  size_t chunk = (n + parts - 1) / parts;
+  std::vector<std::thread> ts;
+  for (size_t t = 1; t < parts; t++)
+    ts.emplace_back([&f, t, chunk, n]() {
+      for (size_t i = t * chunk; i < std::min(n, (t + 1) * chunk); i++)
+        f(i);
+    });
+  for (size_t i = 0; i < std::min(n, chunk); i++)
+    f(i);
+  for (auto &th : ts)
+    th.join();
+}
+
+// Joins a vector of objects in log2(n) rounds of pairwise joins, moving
+// each right operand, and leaves the result in the first one
+template <typename T>
+void joinrounds(std::vector<T> &v)
+{
+  for (size_t w = 1; w < v.size(); w *= 2)
+    for (size_t i = 0; i + w < v.size(); i += 2 * w)
+      v[i].join(std::move(v[i + w]));
+}
+
+// Key extractors for kwaymerge over maps and sets
+struct firstof
+{
+  template <typename P>
+  const typename P::first_type &operator()(const P &p) const
+  {
+    return p.first;
+  }
+};
+
+struct itself
+{
+  template <typename T>
+  const T &operator()(const T &t) const
+  {
+    return t;
+  }
+};
+
+// Moves it forward to the first element of c whose key is not below k.
+// A few steps are taken before falling back to a tree search, so walking
+// c while seeking the keys of another sorted container in order costs
+// O(n + m) when the keys interleave, and O(m log n) when m is small.
+template <typename C, typename Key>
+typename C::iterator seek(C &c, typename C::iterator it, const typename C::key_type &k, Key key)
+{
+  for (int i = 0; i < 8; i++, ++it)
+    if (it == c.end() || !(key(*it) < k))
+      return it;
+  return c.lower_bound(k);
+}
+
+// Walks several sorted ranges at once with a heap. Each step holds an
+// iterator to every element that has the least key left, one per range
+template <typename It, typename Key>
+class kwaymerge
+{
+  std::vector<std::pair<It, It>> rs;
+  std::vector<size_t> heap;
+  std::vector<It> cur;
+  Key key;
+
+  struct later
+  {
+    const kwaymerge *m;
+    bool operator()(size_t a, size_t b) const
+    {
+      return m->key(*m->rs[b].first) < m->key(*m->rs[a].first);
+    }
+  };
+
+public:
+  kwaymerge(std::vector<std::pair<It, It>> r, Key k = Key()) : rs(std::move(r)), key(k)
+  {
+    for (size_t i = 0; i < rs.size(); i++)
+      if (rs[i].first != rs[i].second)
+        heap.push_back(i);
+    std::make_heap(heap.begin(), heap.end(), later{this});
+    next();
+  }
+
+  bool done() const { return cur.empty(); }
+
+  const std::vector<It> &group() const { return cur; }
+
+  void next()
+  {
+    cur.clear();
+    while (!heap.empty() &&
+           (cur.empty() || !(key(*cur.front()) < key(*rs[heap.front()].first))))
+    {
+      std::pop_heap(heap.begin(), heap.end(), later{this});
+      size_t i = heap.back();
+      cur.push_back(rs[i].first);
+      if (++rs[i].first == rs[i].second)
+        heap.pop_back();
+      else
+        std::push_heap(heap.begin(), heap.end(), later{this});
+    }
+  }
+};
+
+// Payloads whose operator< is a total order that agrees with join, so
+// that join is max. Specialize for other such types.
+template <typename T>
+struct totalorder : std::is_arithmetic<T>
+{
+};
+
+template <bool b>
+struct leq_selector
+{
+  template <typename T>
+  static bool leq(const T &l, const T &r)
+  {
+    return join(l, r) == r;
+  }
+};
+
+template <>
+struct leq_selector<true>
+{
+  template <typename T>
+  static bool leq(const T &l, const T &r)
+  {
+    return !(r < l);
+  }
+};
+
+// Order of the join semilattice, l <= r when joining l into r keeps r.
+// Overload it for types that can compare without building a join.
+template <typename T>
+bool leq(const T &l, const T &r)
+{
+  return leq_selector<totalorder<T>::value>::leq(l, r);
+}
+
+template <typename A, typename B> // Pairs join by member
+bool leq(const std::pair<A, B> &l, const std::pair<A, B> &r)
+{
+  return leq(l.first, r.first) && leq(l.second, r.second);
 }
 
 template <typename A, typename B> // Join lexicographic of two pairs of objects
@@ -125,29 +309,219 @@ std::ostream &operator<<(std::ostream &output, const std::set<T> &o)
 namespace dtcrdt
 {
 
-template <typename T> // get a point among two points
-std::vector<T> among(const std::vector<T> &l, const std::vector<T> &r, int j = 0)
+inline int clz64(uint64_t x) // x is not 0
+{
+#if defined(__GNUC__)
+  return __builtin_clzll(x);
+#else
+  int n = 0;
+  for (uint64_t m = uint64_t(1) << 63; !(x & m); m >>= 1)
+    n++;
+  return n;
+#endif
+}
+
+// Position identifier for sequences, a bit string packed most significant
+// bit first in 64 bit words. Ids of up to 128 bits are held inline, longer
+// ones spill to the heap. Orders like a std::vector<bool>, a word at a time.
+class posid
+{
+  static const uint32_t inl = 2; // Inline words
+  uint32_t n;                    // Length in bits
+  uint32_t cap;                  // Words at w, bits past n are kept 0
+  uint64_t buf[inl];
+  uint64_t *w;
+
+  static uint32_t words(size_t bits)
+  {
+    return uint32_t((bits + 63) / 64);
+  }
+
+  void reserve(uint32_t k)
+  {
+    if (k <= cap)
+      return;
+    uint32_t nc = std::max(k, 2 * cap);
+    uint64_t *nw = new uint64_t[nc];
+    std::copy(w, w + cap, nw);
+    std::fill(nw + cap, nw + nc, 0);
+    if (w != buf)
+      delete[] w;
+    w = nw;
+    cap = nc;
+  }
+
+public:
+  posid() : n(0), cap(inl), buf{0, 0}, w(buf) {}
+
+  posid(const posid &o) : n(0), cap(inl), buf{0, 0}, w(buf)
+  {
+    *this = o;
+  }
+
+  posid(posid &&o) : n(o.n), cap(o.cap), buf{o.buf[0], o.buf[1]}, w(o.w)
+  {
+    if (o.w == o.buf)
+      w = buf;
+    o.n = 0;
+    o.cap = inl;
+    o.buf[0] = o.buf[1] = 0;
+    o.w = o.buf;
+  }
+
+  ~posid()
+  {
+    if (w != buf)
+      delete[] w;
+  }
+
+  posid &operator=(const posid &o)
+  {
+    if (this == &o)
+      return *this;
+    uint32_t k = words(o.n);
+    reserve(k);
+    std::copy(o.w, o.w + k, w);
+    std::fill(w + k, w + std::max(k, words(n)), 0);
+    n = o.n;
+    return *this;
+  }
+
+  posid &operator=(posid &&o)
+  {
+    if (this == &o)
+      return *this;
+    if (o.w == o.buf)
+    {
+      *this = o;
+      o.resize(0);
+      return *this;
+    }
+    if (w != buf)
+      delete[] w;
+    n = o.n;
+    cap = o.cap;
+    w = o.w;
+    o.n = 0;
+    o.cap = inl;
+    o.buf[0] = o.buf[1] = 0;
+    o.w = o.buf;
+    return *this;
+  }
+
+  size_t size() const
+  {
+    return n;
+  }
+
+  bool empty() const
+  {
+    return n == 0;
+  }
+
+  bool operator[](size_t i) const
+  {
+    return (w[i / 64] >> (63 - i % 64)) & 1;
+  }
+
+  bool back() const
+  {
+    return (*this)[n - 1];
+  }
+
+  void set(size_t i, bool b)
+  {
+    uint64_t m = uint64_t(1) << (63 - i % 64);
+    if (b)
+      w[i / 64] |= m;
+    else
+      w[i / 64] &= ~m;
+  }
+
+  void push_back(bool b)
+  {
+    reserve(words(n + 1));
+    set(n++, b);
+  }
+
+  void pop_back()
+  {
+    set(--n, false);
+  }
+
+  // Truncates or pads with 0 bits
+  void resize(size_t k)
+  {
+    if (k < n)
+    {
+      if (k % 64)
+        w[k / 64] &= ~(~uint64_t(0) >> (k % 64));
+      std::fill(w + words(k), w + words(n), 0);
+    }
+    else
+      reserve(words(k));
+    n = uint32_t(k);
+  }
+
+  // Negative, zero or positive as this orders before, equal or after o
+  int compare(const posid &o) const
+  {
+    uint32_t m = std::min(n, o.n);
+    for (uint32_t i = 0, k = words(m); i < k; i++)
+      if (w[i] != o.w[i])
+      {
+        // Past m one of them is only padding, and that one is a prefix
+        if (64 * i + clz64(w[i] ^ o.w[i]) >= m)
+          break;
+        return w[i] < o.w[i] ? -1 : 1;
+      }
+    return n < o.n ? -1 : n > o.n;
+  }
+
+  friend bool operator==(const posid &a, const posid &b)
+  {
+    return a.n == b.n && std::equal(a.w, a.w + words(a.n), b.w);
+  }
+  friend bool operator!=(const posid &a, const posid &b) { return !(a == b); }
+  friend bool operator<(const posid &a, const posid &b) { return a.compare(b) < 0; }
+  friend bool operator>(const posid &a, const posid &b) { return a.compare(b) > 0; }
+  friend bool operator<=(const posid &a, const posid &b) { return a.compare(b) <= 0; }
+  friend bool operator>=(const posid &a, const posid &b) { return a.compare(b) >= 0; }
+
+  friend std::ostream &operator<<(std::ostream &output, const posid &o)
+  {
+    output << "[";
+    for (size_t i = 0; i < o.n; i++)
+      output << o[i];
+    output << "]";
+    return output;
+  }
+};
+
+template <typename P> // get a point among two points, P is posid or std::vector<bool>
+P among(const P &l, const P &r, int j = 0)
 {
   // Overall strategy is to first try wide advances to the right,
   // as compact as possible. If that fails, go with fine grain (less compact)
   // advances until eventually succeed.
   assert(l < r);
-  std::vector<T> res;
+  P res;
   // adjust res as forwardly compact as possible
-  for (int is = 0; is <= l.size(); is++)
+  for (size_t is = 0; is <= l.size(); is++)
   {
-    res.assign(l.begin(), l.begin() + is); // get initial segment
-    if (is < l.size())                     // if partial segment, try appending one
+    // res is the initial segment of l of size is
+    if (is < l.size()) // if partial segment, try appending one
     {
       res.push_back(true);
       if (res >= l && res < r)
         break; // see if we are there
+      res.pop_back();
+      res.push_back(l[is]);
     }
   }
   assert(res >= l && res < r);
   if (res > l)
     return res;
-  //std::vector<T> res=l;
   // forward finer and finer
   for (int i = 0; i < j; i++)
   {
@@ -157,7 +531,8 @@ std::vector<T> among(const std::vector<T> &l, const std::vector<T> &r, int j = 0
 
   while (res >= r)
   {
-    res.back() = false;
+    res.pop_back();
+    res.push_back(false);
     for (int i = 0; i < j; i++)
     {
       res.push_back(false);
@@ -168,6 +543,86 @@ std::vector<T> among(const std::vector<T> &l, const std::vector<T> &r, int j = 0
   return res;
 }
 
+// Position allocation strategies for sequences
+enum class alloc
+{
+  bisect, // among, short ids for few edits, but grows with every insert
+  lseq    // lseqamong, grows logarithmically under typical editing
+};
+
+// LSEQ allocation, after Nedelec, Molli, Mostefaoui and Desmontils. Level d
+// of an id is a digit of lseqbase + d bits, so every level doubles the room
+// of the one above. A new id takes the first level with room for
+// lseqboundary ids between its neighbours, so that replicas with other
+// seeds draw apart, at a random distance up to lseqboundary from the left
+// one on even levels (boundary+) and from the right one on odd levels
+// (boundary-).
+// Ids end in a 1 bit, so as binary fractions they are all distinct and can
+// be mixed with ids from among.
+const int lseqbase = 4;
+const uint64_t lseqboundary = 10;
+
+inline posid lseqamong(const posid &l, const posid &r, uint32_t &seed)
+{
+  assert(l < r);
+  const uint64_t cap = uint64_t(1) << 40;
+  size_t n = 0;
+  for (int d = 0;; d++)
+  {
+    n += lseqbase + d;
+    // Neighbours truncated to n bits, zero padded
+    posid lo = l, hi = r;
+    lo.resize(n);
+    hi.resize(n);
+    // gap = hi - lo, saturated at cap
+    uint64_t gap = 0;
+    bool borrow = false;
+    posid diff;
+    diff.resize(n);
+    for (size_t i = n; i-- > 0;)
+    {
+      int x = int(hi[i]) - int(lo[i]) - int(borrow);
+      borrow = x < 0;
+      diff.set(i, (x & 1) != 0);
+    }
+    for (size_t i = 0; i < n; i++)
+      gap = std::min(cap, gap * 2 + diff[i]);
+    // odd values strictly between lo and hi, as offsets from lo or hi
+    uint64_t first = lo.back() ? 2 : 1, last = hi.back() ? 2 : 1;
+    uint64_t odd = gap > first ? (gap - first + 1) / 2 : 0;
+    if (odd < lseqboundary) // too little room for replicas to draw apart
+      continue;
+    seed ^= seed << 13; // xorshift
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    uint64_t step = 2 * (seed % lseqboundary);
+    bool up = d % 2 == 0;
+    posid &res = up ? lo : hi;
+    uint64_t delta = (up ? first : last) + step;
+    // add or subtract delta, it always fits in n bits
+    for (size_t i = n; i-- > 0 && (delta != 0);)
+    {
+      uint64_t bit = delta & 1;
+      delta >>= 1;
+      if (up)
+      {
+        uint64_t x = uint64_t(res[i]) + bit;
+        res.set(i, (x & 1) != 0);
+        delta += x >> 1;
+      }
+      else
+      {
+        bool b = res[i];
+        res.set(i, b != (bit != 0));
+        if (!b && bit)
+          delta += 1;
+      }
+    }
+    assert(res > l && res < r && res.back());
+    return res;
+  }
+}
+
 }
 
 template <typename T> // Output a vector
@@ -180,1236 +635,4860 @@ std::ostream &operator<<(std::ostream &output, const std::vector<T> &o)
   return output;
 }
 
-namespace dtcrdt {
-
-// Autonomous causal context, for context sharing in maps
-template <typename K>
-class dotcontext
+namespace dtcrdt
 {
-public:
-  std::map<K, int> cc;            // Compact causal context
-  std::set<std::pair<K, int>> dc; // Dot cloud
 
-  dotcontext<K> &operator=(const dotcontext<K> &o)
-  {
-    if (&o == this)
-      return *this;
-    cc = o.cc;
-    dc = o.dc;
-    return *this;
-  }
+// Binary wire format
+//
+// Integers are LEB128 varints (zigzag mapped when signed), floating point
+// values are raw bytes, strings and containers are length prefixed, and
+// datatypes encode their own state through encode/decode members. Decoders
+// advance p and return false on truncated or malformed input.
 
-  friend std::ostream &operator<<(std::ostream &output, const dotcontext<K> &o)
+inline void putvarint(std::string &b, uint64_t v)
+{
+  while (v >= 0x80)
   {
-    output << "Context:";
-    output << " CC ( ";
-    for (const auto &ki : o.cc)
-      output << ki.first << ":" << ki.second << " ";
-    output << ")";
-    output << " DC ( ";
-    for (const auto &ki : o.dc)
-      output << ki.first << ":" << ki.second << " ";
-    output << ")";
-    return output;
+    b.push_back(char(v | 0x80));
+    v >>= 7;
   }
+  b.push_back(char(v));
+}
 
-  bool dotin(const std::pair<K, int> &d) const
+inline bool getvarint(const char *&p, const char *e, uint64_t &v)
+{
+  v = 0;
+  for (int shift = 0; shift < 64 && p != e; shift += 7)
   {
-    const auto itm = cc.find(d.first);
-    if (itm != cc.end() && d.second <= itm->second)
-      return true;
-    if (dc.count(d) != 0)
+    uint8_t byte = uint8_t(*p++);
+    v |= uint64_t(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0)
       return true;
-    return false;
   }
+  return false;
+}
 
-  void compact()
-  {
-    // Compact DC to CC if possible
-    //typename std::map<K,int>::iterator mit;
-    //typename std::set<std::pair<K,int> >::iterator sit;
-    bool flag; // may need to compact several times if ordering not best
-    do
-    {
-      flag = false;
-      for (auto sit = dc.begin(); sit != dc.end();)
-      {
-        auto mit = cc.find(sit->first);
-        if (mit == cc.end())    // No CC entry
-          if (sit->second == 1) // Can compact
-          {
-            cc.insert(*sit);
-            dc.erase(sit++);
-            flag = true;
-          }
-          else
-            ++sit;
-        else                                          // there is a CC entry already
-            if (sit->second == cc.at(sit->first) + 1) // Contiguous, can compact
-        {
-          cc.at(sit->first)++;
-          dc.erase(sit++);
-          flag = true;
-        }
-        else if (sit->second <= cc.at(sit->first)) // dominated, so prune
-        {
-          dc.erase(sit++);
-          // no extra compaction oportunities so flag untouched
-        }
-        else
-          ++sit;
-      }
-    } while (flag == true);
-  }
+// Element counts can not exceed the remaining bytes, reject them early
+inline bool getcount(const char *&p, const char *e, uint64_t &n)
+{
+  return getvarint(p, e, n) && n <= uint64_t(e - p);
+}
 
-  std::pair<K, int> makedot(const K &id)
-  {
-    // On a valid dot generator, all dots should be compact on the used id
-    // Making the new dot, updates the dot generator and returns the dot
-    // std::pair<typename std::map<K,int>::iterator,bool> ret;
-    auto kib = cc.insert(std::pair<K, int>(id, 1));
-    if (kib.second == false) // already there, so update it
-      (kib.first->second) += 1;
-    //return dot;
-    return std::pair<K, int>(*kib.first);
-  }
+// Read-only view of an encoded state, joined without decoding it first
+struct wireview
+{
+  const char *p;
+  const char *e;
 
-  void insertdot(const std::pair<K, int> &d, bool compactnow = true)
-  {
-    // Set
-    dc.insert(d);
-    if (compactnow)
-      compact();
-  }
+  wireview(const char *b, const char *end) : p(b), e(end) {}
+  wireview(const std::string &b) : p(b.data()), e(b.data() + b.size()) {}
+};
 
-  void join(const dotcontext<K> &o)
-  {
-    if (this == &o)
-      return; // Join is idempotent, but just dont do it.
-    // CC
-    //typename  std::map<K,int>::iterator mit;
-    //typename  std::map<K,int>::const_iterator mito;
-    auto mit = cc.begin();
-    auto mito = o.cc.begin();
-    do
-    {
-      if (mit != cc.end() && (mito == o.cc.end() || mit->first < mito->first))
-      {
-        // std::cout << "cc one\n";
+template <typename T>
+typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value>::type
+encode(std::string &b, const T &v)
+{
+  int64_t x = v;
+  putvarint(b, (uint64_t(x) << 1) ^ uint64_t(x >> 63));
+}
+
+template <typename T>
+typename std::enable_if<std::is_integral<T>::value && !std::is_signed<T>::value>::type
+encode(std::string &b, const T &v)
+{
+  putvarint(b, v);
+}
+
+// Floats travel as the little endian bit pattern of an IEEE 754 binary32
+// or binary64, whatever the byte order of the host
+static_assert(std::numeric_limits<float>::is_iec559 && sizeof(float) == 4, "float must be binary32");
+static_assert(std::numeric_limits<double>::is_iec559 && sizeof(double) == 8, "double must be binary64");
+
+template <typename U>
+void putle(std::string &b, U u)
+{
+  for (size_t i = 0; i < sizeof(U); i++)
+    b.push_back(char(uint8_t(u >> (8 * i))));
+}
+
+inline void encode(std::string &b, const float &v)
+{
+  uint32_t u;
+  std::memcpy(&u, &v, sizeof(u));
+  putle(b, u);
+}
+
+inline void encode(std::string &b, const double &v)
+{
+  uint64_t u;
+  std::memcpy(&u, &v, sizeof(u));
+  putle(b, u);
+}
+
+// A long double goes as the double nearest to it and the rest, also a
+// double, so no padding is sent. That is exact for the x87 format within
+// the range of a double.
+inline void encode(std::string &b, const long double &v)
+{
+  double hi = double(v);
+  encode(b, hi);
+  encode(b, std::isfinite(hi) ? double(v - hi) : 0.0);
+}
+
+inline void encode(std::string &b, const std::string &v)
+{
+  putvarint(b, v.size());
+  b.append(v);
+}
+
+inline void encode(std::string &b, const std::vector<bool> &v)
+{
+  // Bit length, then packed bits
+  putvarint(b, v.size());
+  for (size_t i = 0; i < v.size(); i += 8)
+  {
+    uint8_t byte = 0;
+    for (size_t j = i; j < v.size() && j < i + 8; j++)
+      if (v[j])
+        byte |= uint8_t(0x80 >> (j - i));
+    b.push_back(char(byte));
+  }
+}
+
+template <typename A, typename B>
+void encode(std::string &b, const std::pair<A, B> &v);
+template <typename T>
+void encode(std::string &b, const std::vector<T> &v);
+template <typename T>
+void encode(std::string &b, const std::set<T> &v);
+template <typename A, typename B>
+void encode(std::string &b, const std::map<A, B> &v);
+
+template <typename T> // Datatypes encode themselves
+typename std::enable_if<std::is_class<T>::value>::type
+encode(std::string &b, const T &v)
+{
+  v.encode(b);
+}
+
+template <typename A, typename B>
+void encode(std::string &b, const std::pair<A, B> &v)
+{
+  encode(b, v.first);
+  encode(b, v.second);
+}
+
+template <typename T>
+void encode(std::string &b, const std::vector<T> &v)
+{
+  putvarint(b, v.size());
+  for (const auto &e : v)
+    encode(b, e);
+}
+
+template <typename T>
+void encode(std::string &b, const std::set<T> &v)
+{
+  putvarint(b, v.size());
+  for (const auto &e : v)
+    encode(b, e);
+}
+
+template <typename A, typename B>
+void encode(std::string &b, const std::map<A, B> &v)
+{
+  putvarint(b, v.size());
+  for (const auto &kv : v)
+  {
+    encode(b, kv.first);
+    encode(b, kv.second);
+  }
+}
+
+template <typename T>
+typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value, bool>::type
+decode(const char *&p, const char *e, T &v)
+{
+  uint64_t u;
+  if (!getvarint(p, e, u))
+    return false;
+  int64_t x = int64_t(u >> 1) ^ -int64_t(u & 1);
+  v = T(x);
+  return int64_t(v) == x; // must fit
+}
+
+template <typename T>
+typename std::enable_if<std::is_integral<T>::value && !std::is_signed<T>::value, bool>::type
+decode(const char *&p, const char *e, T &v)
+{
+  uint64_t u;
+  if (!getvarint(p, e, u))
+    return false;
+  v = T(u);
+  return uint64_t(v) == u; // must fit
+}
+
+template <typename U>
+bool getle(const char *&p, const char *e, U &u)
+{
+  if (e - p < ptrdiff_t(sizeof(U)))
+    return false;
+  u = 0;
+  for (size_t i = 0; i < sizeof(U); i++)
+    u |= U(uint8_t(*p++)) << (8 * i);
+  return true;
+}
+
+inline bool decode(const char *&p, const char *e, float &v)
+{
+  uint32_t u;
+  if (!getle(p, e, u))
+    return false;
+  std::memcpy(&v, &u, sizeof(v));
+  return true;
+}
+
+inline bool decode(const char *&p, const char *e, double &v)
+{
+  uint64_t u;
+  if (!getle(p, e, u))
+    return false;
+  std::memcpy(&v, &u, sizeof(v));
+  return true;
+}
+
+inline bool decode(const char *&p, const char *e, long double &v)
+{
+  double hi, lo;
+  if (!decode(p, e, hi) || !decode(p, e, lo))
+    return false;
+  v = (long double)hi + lo;
+  return true;
+}
+
+inline bool decode(const char *&p, const char *e, std::string &v)
+{
+  uint64_t n;
+  if (!getcount(p, e, n))
+    return false;
+  v.assign(p, n);
+  p += n;
+  return true;
+}
+
+inline void encode(std::string &b, const posid &v)
+{
+  // Same as std::vector<bool>
+  putvarint(b, v.size());
+  for (size_t i = 0; i < v.size(); i += 8)
+  {
+    uint8_t byte = 0;
+    for (size_t j = i; j < v.size() && j < i + 8; j++)
+      if (v[j])
+        byte |= uint8_t(0x80 >> (j - i));
+    b.push_back(char(byte));
+  }
+}
+
+inline bool decode(const char *&p, const char *e, std::vector<bool> &v)
+{
+  uint64_t n;
+  if (!getvarint(p, e, n) || (n + 7) / 8 > uint64_t(e - p))
+    return false;
+  v.resize(n);
+  for (size_t j = 0; j < n; j++)
+    v[j] = (uint8_t(p[j / 8]) & (0x80 >> (j % 8))) != 0;
+  p += (n + 7) / 8;
+  return true;
+}
+
+inline bool decode(const char *&p, const char *e, posid &v)
+{
+  uint64_t n;
+  if (!getvarint(p, e, n) || (n + 7) / 8 > uint64_t(e - p))
+    return false;
+  v.resize(0);
+  for (size_t j = 0; j < n; j++)
+    v.push_back((uint8_t(p[j / 8]) & (0x80 >> (j % 8))) != 0);
+  p += (n + 7) / 8;
+  return true;
+}
+
+template <typename A, typename B>
+bool decode(const char *&p, const char *e, std::pair<A, B> &v);
+template <typename T>
+bool decode(const char *&p, const char *e, std::vector<T> &v);
+template <typename T>
+bool decode(const char *&p, const char *e, std::set<T> &v);
+template <typename A, typename B>
+bool decode(const char *&p, const char *e, std::map<A, B> &v);
+
+template <typename T> // Datatypes decode themselves
+typename std::enable_if<std::is_class<T>::value, bool>::type
+decode(const char *&p, const char *e, T &v)
+{
+  return v.decode(p, e);
+}
+
+template <typename A, typename B>
+bool decode(const char *&p, const char *e, std::pair<A, B> &v)
+{
+  return decode(p, e, v.first) && decode(p, e, v.second);
+}
+
+template <typename T>
+bool decode(const char *&p, const char *e, std::vector<T> &v)
+{
+  uint64_t n;
+  if (!getcount(p, e, n))
+    return false;
+  v.clear();
+  v.resize(n);
+  for (auto &x : v)
+    if (!decode(p, e, x))
+      return false;
+  return true;
+}
+
+template <typename T>
+bool decode(const char *&p, const char *e, std::set<T> &v)
+{
+  uint64_t n;
+  if (!getcount(p, e, n))
+    return false;
+  v.clear();
+  for (uint64_t i = 0; i < n; i++)
+  {
+    T x;
+    if (!decode(p, e, x))
+      return false;
+    v.insert(v.end(), x);
+  }
+  return true;
+}
+
+template <typename A, typename B>
+bool decode(const char *&p, const char *e, std::map<A, B> &v)
+{
+  uint64_t n;
+  if (!getcount(p, e, n))
+    return false;
+  v.clear();
+  for (uint64_t i = 0; i < n; i++)
+  {
+    std::pair<A, B> x;
+    if (!decode(p, e, x))
+      return false;
+    v.insert(v.end(), x);
+  }
+  return true;
+}
+
+// Skipping over an encoded value checks it as decoding does, without
+// building it. The last argument only picks the type. Datatypes with a
+// static skip use it, others are decoded into a scratch copy.
+template <typename T>
+typename std::enable_if<std::is_arithmetic<T>::value, bool>::type
+skip(const char *&p, const char *e, const T *)
+{
+  T v;
+  return decode(p, e, v);
+}
+
+inline bool skip(const char *&p, const char *e, const std::string *)
+{
+  uint64_t n;
+  if (!getcount(p, e, n))
+    return false;
+  p += n;
+  return true;
+}
+
+inline bool skipbits(const char *&p, const char *e)
+{
+  uint64_t n;
+  if (!getvarint(p, e, n) || (n + 7) / 8 > uint64_t(e - p))
+    return false;
+  p += (n + 7) / 8;
+  return true;
+}
+
+inline bool skip(const char *&p, const char *e, const std::vector<bool> *) { return skipbits(p, e); }
+inline bool skip(const char *&p, const char *e, const posid *) { return skipbits(p, e); }
+
+template <typename A, typename B>
+bool skip(const char *&p, const char *e, const std::pair<A, B> *);
+template <typename T>
+bool skip(const char *&p, const char *e, const std::vector<T> *);
+template <typename T>
+bool skip(const char *&p, const char *e, const std::set<T> *);
+template <typename A, typename B>
+bool skip(const char *&p, const char *e, const std::map<A, B> *);
+
+template <typename T>
+auto skipstate(const char *&p, const char *e, T *, bool ctx, int) -> decltype(T::skip(p, e, ctx))
+{
+  return T::skip(p, e, ctx);
+}
+
+template <typename T>
+bool skipstate(const char *&p, const char *e, T *scratch, bool ctx, long)
+{
+  return scratch->decode(p, e, ctx);
+}
+
+// Skips an encoded datatype, decoding it into scratch unless it can skip
+// itself. Entries of a map go without context.
+template <typename T>
+bool skipstate(const char *&p, const char *e, T &scratch, bool ctx = true)
+{
+  return skipstate(p, e, &scratch, ctx, 0);
+}
+
+template <typename T>
+auto skipvalue(const char *&p, const char *e, int) -> decltype(T::skip(p, e))
+{
+  return T::skip(p, e);
+}
+
+template <typename T>
+bool skipvalue(const char *&p, const char *e, long)
+{
+  T v;
+  return decode(p, e, v);
+}
+
+template <typename T>
+typename std::enable_if<std::is_class<T>::value, bool>::type
+skip(const char *&p, const char *e, const T *)
+{
+  return skipvalue<T>(p, e, 0);
+}
+
+template <typename A, typename B>
+bool skip(const char *&p, const char *e, const std::pair<A, B> *)
+{
+  return skip(p, e, (const A *)nullptr) && skip(p, e, (const B *)nullptr);
+}
+
+template <typename T>
+bool skipcount(const char *&p, const char *e, const T *)
+{
+  uint64_t n;
+  if (!getcount(p, e, n))
+    return false;
+  for (uint64_t i = 0; i < n; i++)
+    if (!skip(p, e, (const T *)nullptr))
+      return false;
+  return true;
+}
+
+template <typename T>
+bool skip(const char *&p, const char *e, const std::vector<T> *) { return skipcount(p, e, (const T *)nullptr); }
+template <typename T>
+bool skip(const char *&p, const char *e, const std::set<T> *) { return skipcount(p, e, (const T *)nullptr); }
+template <typename A, typename B>
+bool skip(const char *&p, const char *e, const std::map<A, B> *) { return skipcount(p, e, (const std::pair<A, B> *)nullptr); }
+
+// Whole buffer helpers, decoding fails unless all bytes are consumed
+template <typename T>
+std::string encode(const T &v)
+{
+  std::string b;
+  encode(b, v);
+  return b;
+}
+
+template <typename T>
+bool decode(const std::string &b, T &v)
+{
+  const char *p = b.data();
+  return decode(p, b.data() + b.size(), v) && p == b.data() + b.size();
+}
+
+} // namespace dtcrdt
+
+namespace dtcrdt {
+
+// Replica ids interned in a process wide table, so that dots hold and compare
+// a dense integer instead of a string. Names are only looked up for printing
+// and on the wire. Ids order by interning, which differs across processes, so
+// use them as the K of causal types, not as the I of orseq, whose element
+// order depends on the id order. E.g. aworset<int, replicaid> x("x");
+class replicaid
+{
+  uint32_t i;
+
+  struct table
+  {
+    std::mutex mtx;
+    std::unordered_map<std::string, uint32_t> ids;
+    std::deque<std::string> names;
+
+    table() { intern(std::string()); } // the default id is index 0
+
+    uint32_t intern(const std::string &n)
+    {
+      auto it = ids.find(n);
+      if (it != ids.end())
+        return it->second;
+      assert(names.size() < std::numeric_limits<uint32_t>::max());
+      names.push_back(n);
+      return ids[n] = uint32_t(names.size() - 1);
+    }
+  };
+
+  static table &tab()
+  {
+    static table t;
+    return t;
+  }
+
+  static uint32_t intern(const std::string &n)
+  {
+    table &t = tab();
+    std::lock_guard<std::mutex> lock(t.mtx);
+    return t.intern(n);
+  }
+
+public:
+  replicaid() : i(0) {}
+  replicaid(const std::string &n) : i(intern(n)) {}
+  replicaid(const char *n) : i(intern(n)) {}
+
+  uint32_t index() const { return i; }
+
+  // The id interned at index n
+  static replicaid at(uint32_t n)
+  {
+    table &t = tab();
+    std::lock_guard<std::mutex> lock(t.mtx);
+    assert(n < t.names.size());
+    replicaid r;
+    r.i = n;
+    return r;
+  }
+
+  std::string name() const
+  {
+    table &t = tab();
+    std::lock_guard<std::mutex> lock(t.mtx);
+    return t.names[i];
+  }
+
+  bool operator==(const replicaid &o) const { return i == o.i; }
+  bool operator!=(const replicaid &o) const { return i != o.i; }
+  bool operator<(const replicaid &o) const { return i < o.i; }
+
+  friend std::ostream &operator<<(std::ostream &output, const replicaid &o)
+  {
+    return output << o.name();
+  }
+
+  // Sent by name, the receiver interns it in its own table
+  void encode(std::string &b) const
+  {
+    ::dtcrdt::encode(b, name());
+  }
+
+  bool decode(const char *&p, const char *e)
+  {
+    std::string n;
+    if (!::dtcrdt::decode(p, e, n))
+      return false;
+    i = intern(n);
+    return true;
+  }
+};
+
+// Slot of a replica id in dense counters, for ids that are small integers
+// or interned. Slots only need to be dense within a process, as dense
+// counters go on the wire by id.
+template <typename K, typename Enable = void>
+struct slotof;
+
+template <typename K>
+struct slotof<K, typename std::enable_if<std::is_integral<K>::value>::type>
+{
+  static size_t index(const K &k)
+  {
+    assert(!(k < K(0)));
+    return size_t(k);
+  }
+  static K id(size_t n) { return K(n); }
+  static bool valid(const K &k) { return !(k < K(0)); }
+};
+
+template <>
+struct slotof<replicaid>
+{
+  static size_t index(const replicaid &k) { return k.index(); }
+  static replicaid id(size_t n) { return replicaid::at(uint32_t(n)); }
+  static bool valid(const replicaid &) { return true; }
+};
+
+// Free list of N byte blocks, one per thread. Blocks freed by another
+// thread join that thread's list, and all are kept until thread exit.
+template <size_t N>
+class nodepool
+{
+  struct block
+  {
+    block *next;
+  };
+  block *head;
+
+  nodepool() : head(nullptr) {}
+
+public:
+  ~nodepool()
+  {
+    while (head)
+    {
+      block *b = head;
+      head = b->next;
+      ::operator delete(b);
+    }
+  }
+
+  static nodepool<N> &local()
+  {
+    static thread_local nodepool<N> p;
+    return p;
+  }
+
+  void *get()
+  {
+    if (!head)
+      return ::operator new(N < sizeof(block) ? sizeof(block) : N);
+    block *b = head;
+    head = b->next;
+    return b;
+  }
+
+  void put(void *p)
+  {
+    block *b = static_cast<block *>(p);
+    b->next = head;
+    head = b;
+  }
+};
+
+// Node allocator recycling through the pool of its node size
+template <typename T>
+class poolalloc
+{
+public:
+  typedef T value_type;
+
+  poolalloc() {}
+  template <typename U>
+  poolalloc(const poolalloc<U> &) {}
+
+  T *allocate(size_t n)
+  {
+    if (n != 1)
+      return static_cast<T *>(::operator new(n * sizeof(T)));
+    return static_cast<T *>(nodepool<sizeof(T)>::local().get());
+  }
+
+  void deallocate(T *p, size_t n)
+  {
+    if (n != 1)
+      ::operator delete(p);
+    else
+      nodepool<sizeof(T)>::local().put(p);
+  }
+
+  template <typename U>
+  bool operator==(const poolalloc<U> &) const { return true; }
+  template <typename U>
+  bool operator!=(const poolalloc<U> &) const { return false; }
+};
+
+// Monotonic arena. Allocation bumps a pointer and freeing is a no-op,
+// release() takes back everything at once and keeps the chunks for reuse.
+class arena
+{
+  std::vector<std::pair<char *, size_t>> chunks;
+  size_t cur, used;
+
+  arena(const arena &) = delete;
+  arena &operator=(const arena &) = delete;
+
+public:
+  arena(size_t first = 4096) : cur(0), used(0)
+  {
+    chunks.push_back(std::make_pair(static_cast<char *>(::operator new(first)), first));
+  }
+
+  ~arena()
+  {
+    for (auto &ch : chunks)
+      ::operator delete(ch.first);
+  }
+
+  void *allocate(size_t n, size_t align)
+  {
+    while (true)
+    {
+      size_t off = (used + align - 1) & ~(align - 1);
+      if (off + n <= chunks[cur].second)
+      {
+        used = off + n;
+        return chunks[cur].first + off;
+      }
+      used = 0;
+      if (++cur == chunks.size())
+      {
+        size_t sz = std::max(chunks.back().second * 2, n + align);
+        chunks.push_back(std::make_pair(static_cast<char *>(::operator new(sz)), sz));
+      }
+    }
+  }
+
+  void release()
+  {
+    cur = 0;
+    used = 0;
+  }
+
+  // The arena that containers made on this thread allocate from, if any
+  static arena *&current()
+  {
+    static thread_local arena *a = nullptr;
+    return a;
+  }
+};
+
+// Makes an arena current for the lifetime of the scope. Given a null
+// arena it makes none current, so that what is made there is on the heap.
+class arenascope
+{
+  arena *prev;
+
+public:
+  arenascope(arena &a) : prev(arena::current()) { arena::current() = &a; }
+  arenascope(arena *a) : prev(arena::current()) { arena::current() = a; }
+  ~arenascope() { arena::current() = prev; }
+};
+
+// Allocates from the arena current when the container was made, or from
+// the heap if there was none. Containers never trade allocators, so state
+// made outside a scope stays on the heap when arena deltas are joined in.
+// Containers nested in a context or a map follow its allocator instead.
+// Make deltas inside a scope and drop them before the arena is released.
+template <typename T>
+class arenaalloc
+{
+public:
+  typedef T value_type;
+
+  arena *a;
+
+  arenaalloc() : a(arena::current()) {}
+  template <typename U>
+  arenaalloc(const arenaalloc<U> &o) : a(o.a) {}
+
+  arenaalloc<T> select_on_container_copy_construction() const { return arenaalloc<T>(); }
+
+  T *allocate(size_t n)
+  {
+    if (a)
+      return static_cast<T *>(a->allocate(n * sizeof(T), alignof(T)));
+    return static_cast<T *>(::operator new(n * sizeof(T)));
+  }
+
+  void deallocate(T *p, size_t)
+  {
+    if (!a)
+      ::operator delete(p);
+  }
+
+  template <typename U>
+  bool operator==(const arenaalloc<U> &o) const { return a == o.a; }
+  template <typename U>
+  bool operator!=(const arenaalloc<U> &o) const { return a != o.a; }
+};
+
+// Whether two containers can trade their nodes
+template <typename C>
+bool samealloc(const C &, const C &) { return true; }
+
+template <typename D, typename T, typename L, typename A>
+bool samealloc(const std::map<D, T, L, A> &a, const std::map<D, T, L, A> &b)
+{
+  return a.get_allocator() == b.get_allocator();
+}
+
+// Sorted disjoint [lo,hi] ranges of dot counters, adjacent ranges are fused
+class rangeset
+{
+public:
+  typedef std::map<int, int, std::less<int>, arenaalloc<std::pair<const int, int>>> ranges;
+  ranges r; // Range start to range end, inclusive
+
+  bool operator==(const rangeset &o) const { return r == o.r; }
+
+  bool empty() const { return r.empty(); }
+  size_t size() const { return r.size(); }
+
+  ranges::const_iterator begin() const { return r.begin(); }
+  ranges::const_iterator end() const { return r.end(); }
+
+  bool overlaps(int lo, int hi) const
+  {
+    auto it = r.upper_bound(hi); // ranges before it start at most at hi
+    if (it == r.begin())
+      return false;
+    --it;
+    return lo <= it->second;
+  }
+
+  bool in(int n) const
+  {
+    auto it = r.upper_bound(n); // first range starting after n
+    if (it == r.begin())
+      return false;
+    --it;
+    return n <= it->second;
+  }
+
+  void insert(int lo, int hi)
+  {
+    // find the first range that overlaps or touches [lo,hi]
+    auto it = r.upper_bound(lo);
+    if (it != r.begin())
+    {
+      --it;
+      if (it->second < lo - 1) // ends before, not even adjacent
+        ++it;
+    }
+    // swallow all ranges that overlap or touch [lo,hi]
+    while (it != r.end() && it->first <= hi + 1)
+    {
+      lo = std::min(lo, it->first);
+      hi = std::max(hi, it->second);
+      r.erase(it++);
+    }
+    r.insert(it, std::pair<int, int>(lo, hi));
+  }
+
+  // Fold ranges that are contiguous to a compact base into it, and prune
+  // ranges dominated by it. Returns the new base.
+  int absorb(int base)
+  {
+    auto it = r.begin();
+    while (it != r.end() && it->first <= base + 1)
+    {
+      base = std::max(base, it->second);
+      r.erase(it++);
+    }
+    return base;
+  }
+};
+
+// Autonomous causal context, for context sharing in maps
+template <typename K>
+class dotcontext
+{
+public:
+  // Contexts of deltas made in an arena scope are kept in the arena
+  std::map<K, int, std::less<K>, arenaalloc<std::pair<const K, int>>> cc;           // Compact causal context
+  std::map<K, rangeset, std::less<K>, arenaalloc<std::pair<const K, rangeset>>> dc; // Dot cloud, as ranges per id
+
+  dotcontext() {}
+  dotcontext(const dotcontext<K> &o) = default;
+  dotcontext(dotcontext<K> &&o) = default;
+
+  dotcontext<K> &operator=(dotcontext<K> &&o)
+  {
+    if (home() != o.home()) // Nodes of another allocator are not taken
+      return *this = o;
+    cc = std::move(o.cc);
+    dc = std::move(o.dc);
+    return *this;
+  }
+
+  dotcontext<K> &operator=(const dotcontext<K> &o)
+  {
+    if (&o == this)
+      return *this;
+    arenascope s(home()); // Copied ranges follow our allocator
+    cc = o.cc;
+    dc = o.dc;
+    return *this;
+  }
+
+  // The arena this context allocates from, null when on the heap
+  arena *home() const
+  {
+    return cc.get_allocator().a;
+  }
+
+  // Ranges of id i, made with our allocator when missing
+  rangeset &ranges(const K &i)
+  {
+    auto it = dc.lower_bound(i);
+    if (it != dc.end() && !(i < it->first))
+      return it->second;
+    arenascope s(home());
+    return dc.insert(it, std::pair<const K, rangeset>(i, rangeset()))->second;
+  }
+
+  friend std::ostream &operator<<(std::ostream &output, const dotcontext<K> &o)
+  {
+    output << "Context:";
+    output << " CC ( ";
+    for (const auto &ki : o.cc)
+      output << ki.first << ":" << ki.second << " ";
+    output << ")";
+    output << " DC ( ";
+    for (const auto &kr : o.dc)
+      for (const auto &lh : kr.second)
+        if (lh.first == lh.second)
+          output << kr.first << ":" << lh.first << " ";
+        else
+          output << kr.first << ":" << lh.first << "-" << lh.second << " ";
+    output << ")";
+    return output;
+  }
+
+  // Whether some dot is in both contexts
+  bool overlaps(const dotcontext<K> &o) const
+  {
+    for (const auto &ki : o.cc)
+    {
+      if (ki.second < 1)
+        continue;
+      if (cc.count(ki.first))
+        return true;
+      auto dit = dc.find(ki.first);
+      if (dit != dc.end() && dit->second.overlaps(1, ki.second))
+        return true;
+    }
+    for (const auto &kr : o.dc)
+    {
+      auto mit = cc.find(kr.first);
+      auto dit = dc.find(kr.first);
+      for (const auto &lh : kr.second)
+        if ((mit != cc.end() && lh.first <= mit->second) ||
+            (dit != dc.end() && dit->second.overlaps(lh.first, lh.second)))
+          return true;
+    }
+    return false;
+  }
+
+  bool dotin(const std::pair<K, int> &d) const
+  {
+    const auto itm = cc.find(d.first);
+    if (itm != cc.end() && d.second <= itm->second)
+      return true;
+    const auto itr = dc.find(d.first);
+    if (itr != dc.end() && itr->second.in(d.second))
+      return true;
+    return false;
+  }
+
+  void compact(const K &id)
+  {
+    // Compact DC to CC if possible, only for a given id
+    auto dit = dc.find(id);
+    if (dit == dc.end())
+      return;
+    auto mit = cc.find(id);
+    int base = (mit == cc.end()) ? 0 : mit->second;
+    int nbase = dit->second.absorb(base);
+    if (nbase != base)
+    {
+      if (mit == cc.end()) // No CC entry
+        cc.insert(std::pair<K, int>(id, nbase));
+      else
+        mit->second = nbase;
+    }
+    if (dit->second.empty())
+      dc.erase(dit);
+  }
+
+  void compact()
+  {
+    // Compact DC to CC if possible
+    // Ranges are kept fused on insert, so a single pass suffices
+    for (auto dit = dc.begin(); dit != dc.end();)
+      compact((dit++)->first); // may erase the entry, so step before
+  }
+
+  // Dots known here and not in o
+  dotcontext<K> minus(const dotcontext<K> &o) const
+  {
+    dotcontext<K> r;
+    std::vector<std::pair<int, int>> a, b;
+    auto sub = [&](const K &i) {
+      spans(i, a);
+      o.spans(i, b);
+      size_t j = 0;
+      for (const auto &x : a)
+      {
+        int lo = x.first;
+        while (j < b.size() && b[j].second < lo)
+          j++;
+        for (size_t k = j; lo <= x.second; k++)
+        {
+          int hi = k == b.size() ? x.second : std::min(x.second, b[k].first - 1);
+          if (lo <= hi)
+          {
+            if (lo == 1)
+              r.cc[i] = hi;
+            else
+              r.ranges(i).insert(lo, hi);
+          }
+          if (k == b.size() || b[k].second >= x.second)
+            break;
+          lo = std::max(lo, b[k].second + 1);
+        }
+      }
+    };
+    for (const auto &ki : cc)
+      sub(ki.first);
+    for (const auto &kr : dc)
+      if (!cc.count(kr.first))
+        sub(kr.first);
+    r.compact();
+    return r;
+  }
+
+private:
+  // Sorted disjoint [lo,hi] ranges of the dots of id i
+  void spans(const K &i, std::vector<std::pair<int, int>> &v) const
+  {
+    v.clear();
+    auto mit = cc.find(i);
+    if (mit != cc.end() && mit->second > 0)
+      v.push_back(std::make_pair(1, mit->second));
+    auto dit = dc.find(i);
+    if (dit != dc.end())
+    {
+      for (const auto &lh : dit->second)
+      {
+        if (!v.empty() && lh.first <= v.back().second + 1)
+          v.back().second = std::max(v.back().second, lh.second);
+        else
+          v.push_back(lh);
+      }
+    }
+  }
+
+public:
+  std::pair<K, int> makedot(const K &id)
+  {
+    // On a valid dot generator, all dots should be compact on the used id
+    // Making the new dot, updates the dot generator and returns the dot
+    // std::pair<typename std::map<K,int>::iterator,bool> ret;
+    auto kib = cc.insert(std::pair<K, int>(id, 1));
+    if (kib.second == false) // already there, so update it
+      (kib.first->second) += 1;
+    //return dot;
+    return std::pair<K, int>(*kib.first);
+  }
+
+  void insertdot(const std::pair<K, int> &d, bool compactnow = true)
+  {
+    if (dotin(d))
+      return; // Already known
+    // Ranges are fused as dots arrive, compaction then only looks at the id
+    ranges(d.first).insert(d.second, d.second);
+    if (compactnow)
+      compact(d.first);
+  }
+
+  // An empty context takes the other one's maps instead of copying them
+  void join(dotcontext<K> &&o)
+  {
+    if (this == &o)
+      return;
+    if (cc.empty() && dc.empty() && samealloc(cc, o.cc))
+    {
+      cc.swap(o.cc);
+      dc.swap(o.dc);
+      return;
+    }
+    join(o);
+  }
+
+  void join(const dotcontext<K> &o)
+  {
+    if (this == &o)
+      return; // Join is idempotent, but just dont do it.
+    // CC
+    //typename  std::map<K,int>::iterator mit;
+    //typename  std::map<K,int>::const_iterator mito;
+    auto mit = cc.begin();
+    auto mito = o.cc.begin();
+    do
+    {
+      if (mit != cc.end() && (mito == o.cc.end() || mit->first < mito->first))
+      {
+        // std::cout << "cc one\n";
         // entry only at here
         ++mit;
       }
-      else if (mito != o.cc.end() && (mit == cc.end() || mito->first < mit->first))
+      else if (mito != o.cc.end() && (mit == cc.end() || mito->first < mit->first))
+      {
+        // std::cout << "cc two\n";
+        // entry only at other
+        cc.insert(*mito);
+        ++mito;
+      }
+      else if (mit != cc.end() && mito != o.cc.end())
+      {
+        // std::cout << "cc three\n";
+        // in both
+        cc.at(mit->first) = std::max(mit->second, mito->second);
+        ++mit;
+        ++mito;
+      }
+    } while (mit != cc.end() || mito != o.cc.end());
+    // DC
+    // Ranges
+    for (const auto &kr : o.dc)
+    {
+      rangeset &rs = ranges(kr.first);
+      for (const auto &lh : kr.second)
+        rs.insert(lh.first, lh.second);
+    }
+
+    compact();
+  }
+
+  // Join many contexts, compacting once at the end. Elements of [first,
+  // last) must convert to const dotcontext<K>&.
+  template <typename It>
+  void join_many(It first, It last)
+  {
+    for (; first != last; ++first)
+    {
+      const dotcontext<K> &o = *first;
+      if (this == &o)
+        continue;
+      auto mit = cc.begin();
+      for (const auto &ki : o.cc)
+      {
+        while (mit != cc.end() && mit->first < ki.first)
+          ++mit;
+        if (mit == cc.end() || ki.first < mit->first)
+          cc.insert(mit, ki);
+        else if (mit->second < ki.second)
+          mit->second = ki.second;
+      }
+      for (const auto &kr : o.dc)
+      {
+        rangeset &rs = ranges(kr.first);
+        for (const auto &lh : kr.second)
+          rs.insert(lh.first, lh.second);
+      }
+    }
+    compact();
+  }
+
+  void encode(std::string &b) const
+  {
+    putvarint(b, cc.size());
+    for (const auto &ki : cc)
+    {
+      ::dtcrdt::encode(b, ki.first);
+      putvarint(b, ki.second);
+    }
+    // Dot cloud ranges are run-length coded, as gap and length
+    putvarint(b, dc.size());
+    for (const auto &kr : dc)
+    {
+      ::dtcrdt::encode(b, kr.first);
+      putvarint(b, kr.second.size());
+      int prev = 0;
+      for (const auto &lh : kr.second)
+      {
+        putvarint(b, lh.first - prev);
+        putvarint(b, lh.second - lh.first);
+        prev = lh.second;
+      }
+    }
+  }
+
+  bool decode(const char *&p, const char *e)
+  {
+    const uint64_t maxc = std::numeric_limits<int>::max();
+    uint64_t n, m, u, v;
+    cc.clear();
+    dc.clear();
+    if (!getcount(p, e, n))
+      return false;
+    for (uint64_t i = 0; i < n; i++)
+    {
+      K id;
+      if (!::dtcrdt::decode(p, e, id) || !getvarint(p, e, u) || u > maxc)
+        return false;
+      cc.insert(cc.end(), std::pair<K, int>(id, int(u)));
+    }
+    if (!getcount(p, e, n))
+      return false;
+    for (uint64_t i = 0; i < n; i++)
+    {
+      K id;
+      if (!::dtcrdt::decode(p, e, id) || !getcount(p, e, m))
+        return false;
+      rangeset &rs = ranges(id);
+      uint64_t prev = 0;
+      for (uint64_t j = 0; j < m; j++)
+      {
+        if (!getvarint(p, e, u) || !getvarint(p, e, v) || u == 0 ||
+            u > maxc - prev || v > maxc - prev - u)
+          return false;
+        rs.insert(int(prev + u), int(prev + u + v));
+        prev += u + v;
+      }
+    }
+    compact(); // In case the sender did not
+    return true;
+  }
+};
+
+// Sorted vector with the subset of the std::map interface used by kernels.
+// Lookups are binary searches and iteration runs over contiguous memory,
+// while single inserts and erases shift the tail.
+template <typename Key, typename T>
+class flatmap
+{
+public:
+  typedef Key key_type;
+  typedef T mapped_type;
+  typedef std::pair<Key, T> value_type;
+  typedef typename std::vector<value_type>::iterator iterator;
+  typedef typename std::vector<value_type>::const_iterator const_iterator;
+
+private:
+  std::vector<value_type> v;
+
+  struct keyless
+  {
+    bool operator()(const value_type &e, const Key &k) const { return e.first < k; }
+  };
+
+public:
+  iterator begin() { return v.begin(); }
+  iterator end() { return v.end(); }
+  const_iterator begin() const { return v.begin(); }
+  const_iterator end() const { return v.end(); }
+
+  size_t size() const { return v.size(); }
+  bool empty() const { return v.empty(); }
+  void clear() { v.clear(); }
+  void reserve(size_t n) { v.reserve(n); }
+  void swap(flatmap<Key, T> &o) { v.swap(o.v); }
+
+  bool operator==(const flatmap<Key, T> &o) const { return v == o.v; }
+
+  iterator lower_bound(const Key &k)
+  {
+    return std::lower_bound(v.begin(), v.end(), k, keyless());
+  }
+
+  const_iterator lower_bound(const Key &k) const
+  {
+    return std::lower_bound(v.begin(), v.end(), k, keyless());
+  }
+
+  iterator find(const Key &k)
+  {
+    auto it = lower_bound(k);
+    if (it != v.end() && !(k < it->first))
+      return it;
+    return v.end();
+  }
+
+  const_iterator find(const Key &k) const
+  {
+    auto it = lower_bound(k);
+    if (it != v.end() && !(k < it->first))
+      return it;
+    return v.end();
+  }
+
+  size_t count(const Key &k) const
+  {
+    return find(k) != v.end() ? 1 : 0;
+  }
+
+  std::pair<iterator, bool> insert(const value_type &e)
+  {
+    auto it = lower_bound(e.first);
+    if (it != v.end() && !(e.first < it->first)) // already there
+      return std::pair<iterator, bool>(it, false);
+    return std::pair<iterator, bool>(v.insert(it, e), true);
+  }
+
+  iterator insert(iterator hint, const value_type &e)
+  {
+    // Use the hint only if it is the right place, as std::map does
+    if ((hint == v.end() || e.first < hint->first) &&
+        (hint == v.begin() || (hint - 1)->first < e.first))
+      return v.insert(hint, e);
+    return insert(e).first;
+  }
+
+  iterator erase(iterator it)
+  {
+    return v.erase(it);
+  }
+
+  size_t erase(const Key &k)
+  {
+    auto it = find(k);
+    if (it == v.end())
+      return 0;
+    v.erase(it);
+    return 1;
+  }
+
+  // Append at the back, callers must keep keys sorted and unique
+  void push_back(const value_type &e) { v.push_back(e); }
+  void push_back(value_type &&e) { v.push_back(std::move(e)); }
+};
+
+// Storage policies for the dot store in kernels
+
+struct mapstore // Node based, the default
+{
+  template <typename D, typename T>
+  using store = std::map<D, T>;
+};
+
+struct flatstore // Contiguous sorted vector, for large kernels
+{
+  template <typename D, typename T>
+  using store = flatmap<D, T>;
+};
+
+struct poolstore // Node based, nodes recycled by per thread free lists
+{
+  template <typename D, typename T>
+  using store = std::map<D, T, std::less<D>, poolalloc<std::pair<const D, T>>>;
+};
+
+struct arenastore // Node based, nodes taken from the arena in scope, if any
+{
+  template <typename D, typename T>
+  using store = std::map<D, T, std::less<D>, arenaalloc<std::pair<const D, T>>>;
+};
+
+// Contiguous stores are joined by rebuilding, node based ones in place
+template <typename C>
+struct contiguous : std::false_type
+{
+};
+
+template <typename Key, typename T>
+struct contiguous<flatmap<Key, T>> : std::true_type
+{
+};
+
+// Index policies for the values in kernels. An index is told of every dot
+// entering and leaving the store, and byvalue says if it answers lookups.
+
+template <typename D, typename T>
+class nullindex // No index, lookups by value scan the store
+{
+public:
+  static const bool byvalue = false;
+
+  void insert(const T &, const D &) {}
+  void erase(const T &, const D &) {}
+  void clear() {}
+};
+
+template <typename D, typename T>
+class valueindex // From each value to the dots holding it
+{
+  typedef std::multimap<T, D, std::less<T>, arenaalloc<std::pair<const T, D>>> values;
+  values m;
+
+public:
+  static const bool byvalue = true;
+  typedef typename values::const_iterator const_iterator;
+
+  void insert(const T &v, const D &d)
+  {
+    m.insert(std::pair<const T, D>(v, d));
+  }
+
+  void erase(const T &v, const D &d)
+  {
+    auto r = m.equal_range(v);
+    for (auto it = r.first; it != r.second; ++it)
+      if (it->second == d)
+      {
+        m.erase(it);
+        return;
+      }
+  }
+
+  void erase(const T &v)
+  {
+    m.erase(v);
+  }
+
+  void clear()
+  {
+    m.clear();
+  }
+
+  bool has(const T &v) const
+  {
+    return m.find(v) != m.end();
+  }
+
+  std::pair<const_iterator, const_iterator> dots(const T &v) const
+  {
+    return m.equal_range(v);
+  }
+};
+
+struct noindex // The default
+{
+  template <typename D, typename T>
+  using index = nullindex<D, T>;
+};
+
+struct valindex // For kernels that look up and remove by value, like sets
+{
+  template <typename D, typename T>
+  using index = valueindex<D, T>;
+};
+
+// A value index that also keeps the set of elements read from the values.
+// P maps values to elements and decides if an element is in, after any
+// change to the dots of a value.
+template <typename D, typename T, typename P>
+class valueview : public valueindex<D, T>
+{
+  std::set<typename P::elem> v;
+
+public:
+  void insert(const T &t, const D &d)
+  {
+    valueindex<D, T>::insert(t, d);
+    P::update(v, *this, t);
+  }
+
+  void erase(const T &t, const D &d)
+  {
+    valueindex<D, T>::erase(t, d);
+    P::update(v, *this, t);
+  }
+
+  void erase(const T &t)
+  {
+    valueindex<D, T>::erase(t);
+    P::update(v, *this, t);
+  }
+
+  void clear()
+  {
+    valueindex<D, T>::clear();
+    v.clear();
+  }
+
+  const std::set<typename P::elem> &view() const
+  {
+    return v;
+  }
+};
+
+template <typename P>
+struct viewindex
+{
+  template <typename D, typename T>
+  using index = valueview<D, T, P>;
+};
+
+template <typename D, typename T>
+class sumvalues // Running sum of the values, pairs are summed by member
+{
+  T s;
+
+  template <typename U>
+  static void add(U &a, const U &b, int sign)
+  {
+    if (sign > 0)
+      a += b;
+    else
+      a -= b;
+  }
+  template <typename A, typename B>
+  static void add(std::pair<A, B> &a, const std::pair<A, B> &b, int sign)
+  {
+    add(a.first, b.first, sign);
+    add(a.second, b.second, sign);
+  }
+
+public:
+  static const bool byvalue = false;
+
+  sumvalues() : s() {}
+
+  void insert(const T &v, const D &) { add(s, v, 1); }
+  void erase(const T &v, const D &) { add(s, v, -1); }
+  void clear() { s = T(); }
+
+  const T &sum() const
+  {
+    return s;
+  }
+};
+
+struct sumindex
+{
+  template <typename D, typename T>
+  using index = sumvalues<D, T>;
+};
+
+// Read policies for datatypes. uncached folds the state on every read.
+// cached keeps the read up to date as the state changes, so counters read
+// in O(1) and sets give a stable reference, at some cost to every update.
+// E.g. aworset<int, std::string, mapstore, cached>.
+struct uncached
+{
+  static const bool on = false;
+  template <typename P>
+  using setpolicy = valindex;
+  typedef noindex sumpolicy;
+};
+
+struct cached
+{
+  static const bool on = true;
+  template <typename P>
+  using setpolicy = viewindex<P>;
+  typedef sumindex sumpolicy;
+};
+
+template <typename T, typename K, typename S = mapstore, typename X = noindex>
+class dotkernel
+{
+public:
+  typedef typename S::template store<std::pair<K, int>, T> dotstore;
+  typedef typename X::template index<std::pair<K, int>, T> dotindex;
+
+  dotstore ds; // Map of dots to vals
+  dotindex idx; // Kept in step with ds
+
+  dotcontext<K> cbase;
+  dotcontext<K> &c;
+
+  // if no causal context supplied, used base one
+  dotkernel() : c(cbase) {}
+  // if supplied, use a shared causal context
+  dotkernel(dotcontext<K> &jointc) : c(jointc) {}
+  // copies of a standalone kernel take their own context, copies of
+  // a kernel in a map keep sharing the map context
+  dotkernel(const dotkernel<T, K, S, X> &adk)
+      : ds(adk.ds), idx(adk.idx), cbase(&adk.c == &adk.cbase ? adk.cbase : dotcontext<K>()),
+        c(&adk.c == &adk.cbase ? cbase : adk.c) {}
+
+  // moves take the store, and the context only if it is not a map's
+  dotkernel(dotkernel<T, K, S, X> &&adk)
+      : ds(std::move(adk.ds)), idx(std::move(adk.idx)),
+        cbase(&adk.c == &adk.cbase ? std::move(adk.cbase) : dotcontext<K>()),
+        c(&adk.c == &adk.cbase ? cbase : adk.c) {}
+
+  dotkernel<T, K, S, X> &operator=(const dotkernel<T, K, S, X> &adk)
+  {
+    if (&adk == this)
+      return *this;
+    if (&c != &adk.c)
+      c = adk.c;
+    ds = adk.ds;
+    idx = adk.idx;
+    return *this;
+  }
+
+  dotkernel<T, K, S, X> &operator=(dotkernel<T, K, S, X> &&adk)
+  {
+    if (&adk == this)
+      return *this;
+    if (&c != &adk.c)
+    {
+      if (&adk.c == &adk.cbase)
+        c = std::move(adk.c);
+      else
+        c = adk.c;
+    }
+    ds = std::move(adk.ds);
+    idx = std::move(adk.idx);
+    return *this;
+  }
+
+  friend std::ostream &operator<<(std::ostream &output, const dotkernel<T, K, S, X> &o)
+  {
+    output << "Kernel: DS ( ";
+    for (const auto &dv : o.ds)
+      output << dv.first.first << ":" << dv.first.second << "->" << dv.second << " ";
+    output << ") ";
+
+    std::cout << o.c;
+
+    return output;
+  }
+
+private:
+  // Payload handling for dots present in both kernels
+  struct keeppayload
+  {
+    void operator()(const std::pair<K, int> &, T &, const T &) const {}
+  };
+
+  struct joinpayload
+  {
+    dotindex &idx;
+
+    joinpayload(dotindex &i) : idx(i) {}
+    void operator()(const std::pair<K, int> &d, T &a, const T &b) const
+    {
+      // if payloads are not equal, they must be mergeable
+      // use the more general binary join
+      if (a != b)
+      {
+        idx.erase(a, d);
+        join_into(a, b);
+        idx.insert(a, d);
+      }
+    }
+  };
+
+  // Sources of dots to merge in, walked in dot order
+
+  struct storesource // another kernel
+  {
+    typename dotstore::const_iterator it, end;
+
+    storesource(const dotstore &o) : it(o.begin()), end(o.end()) {}
+    bool done() const { return it == end; }
+    const std::pair<K, int> &dot() const { return it->first; }
+    const T &val() const { return it->second; }
+    const T &take() { return it->second; }
+    void next() { ++it; }
+  };
+
+  struct movesource // an expiring kernel, whose payloads are moved in
+  {
+    typename dotstore::iterator it, end;
+
+    movesource(dotstore &o) : it(o.begin()), end(o.end()) {}
+    bool done() const { return it == end; }
+    const std::pair<K, int> &dot() const { return it->first; }
+    const T &val() const { return it->second; }
+    T &&take() { return std::move(it->second); }
+    void next() { ++it; }
+  };
+
+  struct wiresource // an encoded dot store, decoded one entry at a time
+  {
+    const char *p;
+    const char *e;
+    uint64_t groups, left; // replicas and entries in replica still to read
+    std::pair<K, int> cur;
+    T curval;
+    bool ok, end, started;
+    bool sorted; // replicas came in our order
+    bool keep;   // else payloads are only skipped, to check the store
+
+    wiresource(const char *b, const char *be, bool k = true)
+        : p(b), e(be), groups(0), left(0), ok(true), end(false), started(false),
+          sorted(true), keep(k)
+    {
+      ok = getcount(p, e, groups);
+      next();
+    }
+    bool done() const { return end; }
+    const std::pair<K, int> &dot() const { return cur; }
+    const T &val() const { return curval; }
+    T &&take() { return std::move(curval); }
+    void next()
+    {
+      uint64_t u;
+      while (ok && left == 0 && groups > 0) // start the next replica
+      {
+        K id;
+        groups--;
+        ok = ::dtcrdt::decode(p, e, id) && getcount(p, e, left);
+        if (started && !(cur.first < id))
+          sorted = false;
+        cur = std::pair<K, int>(id, 0);
+        started = true;
+      }
+      if (!ok || left == 0)
+      {
+        end = true;
+        return;
+      }
+      left--;
+      ok = getvarint(p, e, u) && u > 0 &&
+           u <= uint64_t(std::numeric_limits<int>::max() - cur.second) &&
+           (keep ? ::dtcrdt::decode(p, e, curval) : ::dtcrdt::skip(p, e, (const T *)nullptr));
+      cur.second += int(u);
+      end = !ok;
+    }
+  };
+
+  struct manysource // several kernels, merged by dot
+  {
+    typedef typename dotstore::const_iterator iter;
+
+    kwaymerge<iter, firstof> m;
+    const std::vector<const dotkernel *> &ks;
+    std::vector<std::pair<int, int>> edges; // for id, where the kernels knowing a dot change
+    size_t at;
+    int known; // kernels whose context has the current dot
+    K id;
+    bool hasid;
+
+    static std::vector<std::pair<iter, iter>> stores(const std::vector<const dotkernel *> &ks)
+    {
+      std::vector<std::pair<iter, iter>> r;
+      for (auto k : ks)
+        r.push_back(std::make_pair(k->ds.begin(), k->ds.end()));
+      return r;
+    }
+
+    manysource(const std::vector<const dotkernel *> &k)
+        : m(stores(k)), ks(k), at(0), known(0), hasid(false)
+    {
+      skip();
+    }
+    bool done() const { return m.done(); }
+    const std::pair<K, int> &dot() const { return m.group().front()->first; }
+    const T &val() const { return m.group().front()->second; }
+    const T &take() { return val(); }
+    void next()
+    {
+      m.next();
+      skip();
+    }
+
+  private:
+    // Passes over dots that some kernel knows but no longer holds, so
+    // that only dots held by every kernel knowing them come out
+    void skip()
+    {
+      for (; !m.done(); m.next())
+      {
+        const std::pair<K, int> &d = dot();
+        if (!hasid || id < d.first || d.first < id)
+          sweep(d.first);
+        while (at < edges.size() && edges[at].first <= d.second)
+          known += edges[at++].second;
+        if (size_t(known) == m.group().size())
+          return;
+      }
+    }
+
+    void sweep(const K &i)
+    {
+      id = i;
+      hasid = true;
+      edges.clear();
+      at = 0;
+      known = 0;
+      for (auto k : ks)
+      {
+        auto mit = k->c.cc.find(i);
+        if (mit != k->c.cc.end())
+        {
+          edges.push_back(std::make_pair(1, 1));
+          edges.push_back(std::make_pair(mit->second + 1, -1));
+        }
+        auto dit = k->c.dc.find(i);
+        if (dit != k->c.dc.end())
+          for (const auto &lh : dit->second)
+          {
+            edges.push_back(std::make_pair(lh.first, 1));
+            edges.push_back(std::make_pair(lh.second + 1, -1));
+          }
+      }
+      std::sort(edges.begin(), edges.end());
+    }
+  };
+
+  // will iterate over the two sorted sets to compute join
+  template <typename Src, typename F>
+  void mergeds(Src &src, const dotcontext<K> &oc, F both, std::false_type)
+  {
+    auto it = ds.begin();
+    while (it != ds.end() || !src.done())
+    {
+      if (it != ds.end() && (src.done() || it->first < src.dot()))
+      {
+        // dot only at this
+        if (oc.dotin(it->first)) // other knows dot, must delete here
+        {
+          idx.erase(it->second, it->first);
+          it = ds.erase(it);
+        }
+        else // keep it
+          ++it;
+      }
+      else if (!src.done() && (it == ds.end() || src.dot() < it->first))
+      {
+        // dot only at other
+        if (!c.dotin(src.dot())) // If I dont know, import
+        {
+          auto ins = ds.insert(it, typename dotstore::value_type(src.dot(), src.take()));
+          idx.insert(ins->second, ins->first);
+        }
+        src.next();
+      }
+      else
+      {
+        // dot in both
+        both(it->first, it->second, src.val());
+        ++it;
+        src.next();
+      }
+    }
+  }
+
+  // same walk, but surviving entries are appended to a new buffer
+  template <typename Src, typename F>
+  void mergeds(Src &src, const dotcontext<K> &oc, F both, std::true_type)
+  {
+    dotstore res;
+    res.reserve(ds.size());
+    auto it = ds.begin();
+    while (it != ds.end() || !src.done())
+    {
+      if (it != ds.end() && (src.done() || it->first < src.dot()))
+      {
+        // dot only at this, keep it unless other knows it
+        if (!oc.dotin(it->first))
+          res.push_back(std::move(*it));
+        else
+          idx.erase(it->second, it->first);
+        ++it;
+      }
+      else if (!src.done() && (it == ds.end() || src.dot() < it->first))
+      {
+        // dot only at other, import it if I dont know it
+        if (!c.dotin(src.dot()))
+        {
+          res.push_back(typename dotstore::value_type(src.dot(), src.take()));
+          idx.insert(std::prev(res.end())->second, src.dot());
+        }
+        src.next();
+      }
+      else
+      {
+        // dot in both
+        both(it->first, it->second, src.val());
+        res.push_back(std::move(*it));
+        ++it;
+        src.next();
+      }
+    }
+    ds.swap(res);
+  }
+
+  template <typename F>
+  bool joinwire(wireview v, F both)
+  {
+    dotcontext<K> oc;
+    if (!oc.decode(v.p, v.e))
+      return false;
+    // Check the whole store before touching this kernel, payloads are
+    // decoded only once, when merged
+    wiresource chk(v.p, v.e, false);
+    while (!chk.done())
+      chk.next();
+    if (!chk.ok)
+      return false;
+    if (chk.sorted)
+    {
+      wiresource src(v.p, v.e);
+      mergeds(src, oc, both, contiguous<dotstore>());
+    }
+    else // the sender orders replicas differently, e.g. interned ids
+    {
+      dotkernel<T, K, S> o;
+      const char *p = v.p;
+      o.decode(p, v.e, false);
+      storesource src(o.ds);
+      mergeds(src, oc, both, contiguous<dotstore>());
+    }
+    c.join(oc);
+    return true;
+  }
+
+public:
+  void join(const dotkernel<T, K, S, X> &o)
+  {
+    if (this == &o)
+      return; // Join is idempotent, but just dont do it.
+    // DS
+    joinstore(o);
+    // CC
+    c.join(o.c);
+  }
+
+  // Joins an expiring kernel. Payloads are moved in, and an empty kernel
+  // with an empty context takes the other one's store whole.
+  void join(dotkernel<T, K, S, X> &&o)
+  {
+    if (this == &o)
+      return;
+    if (ds.empty() && c.cc.empty() && c.dc.empty() && samealloc(ds, o.ds))
+    {
+      ds.swap(o.ds);
+      std::swap(idx, o.idx);
+    }
+    else
+      joinstore(std::move(o));
+    c.join(std::move(o.c));
+  }
+
+  // Joins many kernels in one walk of the store, and compacts the context
+  // once. Elements of [first, last) must convert to const dotkernel&.
+  template <typename It>
+  void join_many(It first, It last)
+  {
+    std::vector<const dotkernel *> ks;
+    for (; first != last; ++first)
+    {
+      const dotkernel<T, K, S, X> &o = *first;
+      if (this != &o)
+        ks.push_back(&o);
+    }
+    if (ks.empty())
+      return;
+    dotcontext<K> u;
+    std::vector<std::reference_wrapper<const dotcontext<K>>> cs;
+    for (auto k : ks)
+      cs.push_back(std::cref(k->c));
+    u.join_many(cs.begin(), cs.end());
+    manysource src(ks);
+    mergeds(src, u, keeppayload(), contiguous<dotstore>());
+    c.join(std::move(u));
+  }
+
+  void deepjoin(const dotkernel<T, K, S, X> &o)
+  {
+    if (this == &o)
+      return; // Join is idempotent, but just dont do it.
+    // DS
+    deepjoinstore(o);
+    // CC
+    c.join(o.c);
+  }
+
+  // Joins the dot stores only, reading both contexts but leaving this one
+  // untouched. Entries of a map share its context, so the map joins their
+  // stores against an unchanged context and joins the context once at the end.
+  void joinstore(const dotkernel<T, K, S, X> &o)
+  {
+    storesource src(o.ds);
+    mergeds(src, o.c, keeppayload(), contiguous<dotstore>());
+  }
+
+  void joinstore(dotkernel<T, K, S, X> &&o)
+  {
+    movesource src(o.ds);
+    mergeds(src, o.c, keeppayload(), contiguous<dotstore>());
+  }
+
+  void deepjoinstore(const dotkernel<T, K, S, X> &o)
+  {
+    // check it payloads are diferent for dots in both
+    storesource src(o.ds);
+    mergeds(src, o.c, joinpayload(idx), contiguous<dotstore>());
+  }
+
+  // What a replica whose context is peer has not seen: the entries with
+  // dots it does not know, under this context less the dots of entries it
+  // already has. Dots of entries removed here stay in the context, so the
+  // peer also drops them. With inplace, as for payloads that update
+  // rewrites under the newest dot of a replica, that entry of each replica
+  // goes along even if peer knows its dot, to be deep joined there.
+  dotkernel<T, K, S, X> delta_since(const dotcontext<K> &peer, bool inplace = false) const
+  {
+    dotkernel<T, K, S, X> res;
+    dotcontext<K> held;
+    storesince(peer, res, held, inplace);
+    res.c = c.minus(held);
+    return res;
+  }
+
+  // Store part of delta_since, for entries of a map, whose context is
+  // then made once for all. Dots held here that peer knows go to held.
+  // True if res got any entry.
+  bool storesince(const dotcontext<K> &peer, dotkernel<T, K, S, X> &res, dotcontext<K> &held, bool inplace = false) const
+  {
+    bool any = false;
+    for (auto it = ds.begin(); it != ds.end(); ++it)
+    {
+      auto nx = std::next(it); // Dots of a replica are adjacent, newest last
+      bool newest = nx == ds.end() || !(nx->first.first == it->first.first);
+      if (peer.dotin(it->first) && !(inplace && newest))
+        held.insertdot(it->first, false);
+      else
+      {
+        auto ins = res.ds.insert(res.ds.end(), *it);
+        res.idx.insert(ins->second, ins->first);
+        any = true;
+      }
+    }
+    return any;
+  }
+
+  // Joins straight from an encoded kernel, false if it is malformed
+  bool join(wireview v)
+  {
+    return joinwire(v, keeppayload());
+  }
+
+  bool deepjoin(wireview v)
+  {
+    return joinwire(v, joinpayload(idx));
+  }
+
+  void encode(std::string &b, bool ctx = true) const
+  {
+    if (ctx)
+      c.encode(b);
+    // Dots are grouped by replica, with delta coded counters
+    uint64_t groups = 0;
+    for (auto it = ds.begin(); it != ds.end(); ++it)
+      if (it == ds.begin() || !(std::prev(it)->first.first == it->first.first))
+        groups++;
+    putvarint(b, groups);
+    for (auto it = ds.begin(); it != ds.end();)
+    {
+      auto gend = it;
+      uint64_t n = 0;
+      while (gend != ds.end() && gend->first.first == it->first.first)
+        ++gend, ++n;
+      ::dtcrdt::encode(b, it->first.first);
+      putvarint(b, n);
+      int prev = 0;
+      for (; it != gend; ++it)
+      {
+        putvarint(b, it->first.second - prev);
+        ::dtcrdt::encode(b, it->second);
+        prev = it->first.second;
+      }
+    }
+  }
+
+  // Skips an encoded kernel, checking it as decode does
+  static bool skip(const char *&p, const char *e, bool ctx = true)
+  {
+    dotcontext<K> oc;
+    if (ctx && !oc.decode(p, e))
+      return false;
+    wiresource src(p, e, false);
+    while (!src.done())
+      src.next();
+    p = src.p;
+    return src.ok;
+  }
+
+  bool decode(const char *&p, const char *e, bool ctx = true)
+  {
+    if (ctx && !c.decode(p, e))
+      return false;
+    ds.clear();
+    wiresource src(p, e);
+    for (; !src.done(); src.next())
+      ds.insert(ds.end(), typename dotstore::value_type(src.dot(), src.take()));
+    reindex();
+    p = src.p;
+    return src.ok;
+  }
+
+  // Is there a dot holding val
+  bool has(const T &val) const
+  {
+    return has(val, std::integral_constant<bool, dotindex::byvalue>());
+  }
+
+  dotkernel<T, K, S, X> add(const K &id, const T &val)
+  {
+    dotkernel<T, K, S, X> res;
+    // get new dot
+    std::pair<K, int> dot = c.makedot(id);
+    // add under new dot
+    ds.insert(std::pair<std::pair<K, int>, T>(dot, val));
+    idx.insert(val, dot);
+    // make delta
+    res.ds.insert(std::pair<std::pair<K, int>, T>(dot, val));
+    res.idx.insert(val, dot);
+    res.c.insertdot(dot);
+    return res;
+  }
+
+  // Add that returns the added dot, instead of kernel delta
+  std::pair<K, int> dotadd(const K &id, const T &val)
+  {
+    // get new dot
+    std::pair<K, int> dot = c.makedot(id);
+    // add under new dot
+    ds.insert(std::pair<std::pair<K, int>, T>(dot, val));
+    idx.insert(val, dot);
+    return dot;
+  }
+
+  // Replaces the payload under a dot in place, keeping the index in step
+  void update(const std::pair<K, int> &dot, const T &val)
+  {
+    auto dsit = ds.find(dot);
+    assert(dsit != ds.end());
+    idx.erase(dsit->second, dot);
+    dsit->second = val;
+    idx.insert(val, dot);
+  }
+
+  dotkernel<T, K, S, X> rmv(const T &val) // remove all dots matching value
+  {
+    dotkernel<T, K, S, X> res;
+    rmv(val, res, std::integral_constant<bool, dotindex::byvalue>());
+    res.c.compact(); // Maybe several dots there, so atempt compactation
+    return res;
+  }
+
+  dotkernel<T, K, S, X> rmv(const std::pair<K, int> &dot) // remove a dot
+  {
+    dotkernel<T, K, S, X> res;
+    auto dsit = ds.find(dot);
+    if (dsit != ds.end()) // found it
+    {
+      res.c.insertdot(dsit->first, false); // result knows removed dots
+      idx.erase(dsit->second, dsit->first);
+      ds.erase(dsit);
+    }
+    res.c.compact(); // Atempt compactation
+    return res;
+  }
+
+  // remove all dots whose value satisfies p, in a single sweep
+  template <typename P>
+  dotkernel<T, K, S, X> rmvif(P p)
+  {
+    dotkernel<T, K, S, X> res;
+    rmvif(p, res, contiguous<dotstore>());
+    res.c.compact();
+    return res;
+  }
+
+  dotkernel<T, K, S, X> rmv() // remove all dots
+  {
+    dotkernel<T, K, S, X> res;
+    for (const auto &dv : ds)
+      res.c.insertdot(dv.first, false);
+    res.c.compact();
+    ds.clear(); // Clear the payload, but remember context
+    idx.clear();
+    return res;
+  }
+
+private:
+  void reindex()
+  {
+    if (std::is_same<X, noindex>::value)
+      return;
+    idx.clear();
+    for (const auto &dv : ds)
+      idx.insert(dv.second, dv.first);
+  }
+
+  bool has(const T &val, std::false_type) const
+  {
+    for (const auto &dv : ds)
+      if (dv.second == val)
+        return true;
+    return false;
+  }
+
+  bool has(const T &val, std::true_type) const
+  {
+    return idx.has(val);
+  }
+
+  void rmv(const T &val, dotkernel<T, K, S, X> &res, std::false_type)
+  {
+    for (auto dsit = ds.begin(); dsit != ds.end();)
+    {
+      if (dsit->second == val) // match
+      {
+        res.c.insertdot(dsit->first, false); // result knows removed dots
+        idx.erase(dsit->second, dsit->first);
+        dsit = ds.erase(dsit);
+      }
+      else
+        ++dsit;
+    }
+  }
+
+  template <typename P>
+  void rmvif(P p, dotkernel<T, K, S, X> &res, std::false_type)
+  {
+    for (auto dsit = ds.begin(); dsit != ds.end();)
+    {
+      if (p(dsit->second))
+      {
+        res.c.insertdot(dsit->first, false);
+        idx.erase(dsit->second, dsit->first);
+        dsit = ds.erase(dsit);
+      }
+      else
+        ++dsit;
+    }
+  }
+
+  template <typename P> // Contiguous stores are rebuilt, not erased from
+  void rmvif(P p, dotkernel<T, K, S, X> &res, std::true_type)
+  {
+    dotstore keep;
+    keep.reserve(ds.size());
+    for (auto &dv : ds)
+      if (p(dv.second))
+      {
+        res.c.insertdot(dv.first, false);
+        idx.erase(dv.second, dv.first);
+      }
+      else
+        keep.push_back(std::move(dv));
+    ds.swap(keep);
+  }
+
+  void rmv(const T &val, dotkernel<T, K, S, X> &res, std::true_type)
+  {
+    auto r = idx.dots(val);
+    for (auto it = r.first; it != r.second; ++it)
+    {
+      res.c.insertdot(it->second, false); // result knows removed dots
+      ds.erase(it->second);
+    }
+    idx.erase(val);
+  }
+};
+
+template <typename V = int, typename K = std::string, typename C = uncached>
+class gcounter
+{
+private:
+  std::map<K, V> m;
+  K id;
+  V total; // Kept only with cached reads
+
+  // Entry k grows to v, if larger. Entries are sought from it, which is
+  // left at entry k, so visiting keys in order walks the map once.
+  void grow(typename std::map<K, V>::iterator &it, const K &k, const V &v)
+  {
+    it = seek(m, it, k, firstof());
+    if (it == m.end() || k < it->first)
+      it = m.insert(it, std::pair<const K, V>(k, V()));
+    if (it->second < v)
+    {
+      if (C::on)
+        total += v - it->second;
+      it->second = v;
+    }
+  }
+
+public:
+  gcounter() : total() {}            // Only for deltas and those should not be mutated
+  gcounter(K a) : id(a), total() {} // Mutable replicas need a unique id
+
+  gcounter inc(V tosum = {1}) // argument is optional
+  {
+    gcounter<V, K, C> res;
+    m[id] += tosum;
+    if (C::on)
+      total += tosum;
+    res.m[id] = m[id];
+    res.total = m[id];
+    return res;
+  }
+
+  bool operator==(const gcounter<V, K, C> &o) const
+  {
+    return m == o.m;
+  }
+
+  V local() // get local counter value // CBM make this const
+  {
+    V res = 0;
+    res += m[id];
+    return res;
+  }
+
+  V read() const // get counter value
+  {
+    if (C::on)
+      return total;
+    V res = 0;
+    for (const auto &kv : m) // Fold+ on value list
+      res += kv.second;
+    return res;
+  }
+
+  void join(const gcounter<V, K, C> &o)
+  {
+    auto it = m.begin();
+    for (const auto &okv : o.m)
+      grow(it, okv.first, okv.second);
+  }
+
+  // Joins many counters, growing each entry once to the largest value
+  // any of them has for it
+  template <typename It>
+  void join_many(It first, It last)
+  {
+    typedef typename std::map<K, V>::const_iterator iter;
+    std::vector<std::pair<iter, iter>> rs;
+    for (; first != last; ++first)
+      if (&*first != this)
+        rs.push_back(std::make_pair(first->m.begin(), first->m.end()));
+    auto it = m.begin();
+    for (kwaymerge<iter, firstof> w(rs); !w.done(); w.next())
+    {
+      const V *v = &w.group().front()->second;
+      for (const auto &kv : w.group())
+        if (*v < kv->second)
+          v = &kv->second;
+      grow(it, w.group().front()->first, *v);
+    }
+  }
+
+  void encode(std::string &b) const
+  {
+    ::dtcrdt::encode(b, m);
+  }
+
+  bool decode(const char *&p, const char *e)
+  {
+    total = V();
+    if (!::dtcrdt::decode(p, e, m))
+      return false;
+    for (const auto &kv : m)
+      total += kv.second;
+    return true;
+  }
+
+  // Joins straight from an encoded gcounter, false if it is malformed
+  bool join(wireview v)
+  {
+    uint64_t n;
+    if (!getcount(v.p, v.e, n))
+      return false;
+    std::pair<K, V> okv;
+    auto it = m.begin();
+    for (uint64_t i = 0; i < n; i++)
+    {
+      if (!::dtcrdt::decode(v.p, v.e, okv))
+        return false;
+      grow(it, okv.first, okv.second);
+    }
+    return true;
+  }
+
+  friend std::ostream &operator<<(std::ostream &output, const gcounter<V, K, C> &o)
+  {
+    output << "GCounter: ( ";
+    for (const auto &kv : o.m)
+      output << kv.first << "->" << kv.second << " ";
+    output << ")";
+    return output;
+  }
+};
+
+// Element-wise max of b into a, and sum of a, over n counts. int32_t and
+// int64_t counts use SSE2 or AVX2 lanes when the build enables them, e.g.
+// with -mavx2, and other counts plain loops.
+template <typename V>
+void maxinto(V *a, const V *b, size_t n)
+{
+  for (size_t i = 0; i < n; i++)
+    if (a[i] < b[i])
+      a[i] = b[i];
+}
+
+template <typename V>
+V sumof(const V *a, size_t n)
+{
+  V r = V();
+  for (size_t i = 0; i < n; i++)
+    r += a[i];
+  return r;
+}
+
+inline void maxinto(int32_t *a, const int32_t *b, size_t n)
+{
+  size_t i = 0;
+#if defined(__AVX2__)
+  for (; i + 8 <= n; i += 8)
+  {
+    __m256i x = _mm256_loadu_si256((const __m256i *)(a + i));
+    __m256i y = _mm256_loadu_si256((const __m256i *)(b + i));
+    _mm256_storeu_si256((__m256i *)(a + i), _mm256_max_epi32(x, y));
+  }
+#elif defined(__SSE4_1__)
+  for (; i + 4 <= n; i += 4)
+  {
+    __m128i x = _mm_loadu_si128((const __m128i *)(a + i));
+    __m128i y = _mm_loadu_si128((const __m128i *)(b + i));
+    _mm_storeu_si128((__m128i *)(a + i), _mm_max_epi32(x, y));
+  }
+#elif defined(__SSE2__)
+  for (; i + 4 <= n; i += 4)
+  {
+    __m128i x = _mm_loadu_si128((const __m128i *)(a + i));
+    __m128i y = _mm_loadu_si128((const __m128i *)(b + i));
+    __m128i gt = _mm_cmpgt_epi32(y, x);
+    _mm_storeu_si128((__m128i *)(a + i), _mm_or_si128(_mm_and_si128(gt, y), _mm_andnot_si128(gt, x)));
+  }
+#endif
+  for (; i < n; i++)
+    if (a[i] < b[i])
+      a[i] = b[i];
+}
+
+inline int32_t sumof(const int32_t *a, size_t n)
+{
+  size_t i = 0;
+  int32_t r = 0;
+#if defined(__SSE2__)
+  __m128i s = _mm_setzero_si128();
+#if defined(__AVX2__)
+  __m256i w = _mm256_setzero_si256();
+  for (; i + 8 <= n; i += 8)
+    w = _mm256_add_epi32(w, _mm256_loadu_si256((const __m256i *)(a + i)));
+  s = _mm_add_epi32(_mm256_castsi256_si128(w), _mm256_extracti128_si256(w, 1));
+#endif
+  for (; i + 4 <= n; i += 4)
+    s = _mm_add_epi32(s, _mm_loadu_si128((const __m128i *)(a + i)));
+  int32_t l[4];
+  _mm_storeu_si128((__m128i *)l, s);
+  r = l[0] + l[1] + l[2] + l[3];
+#endif
+  for (; i < n; i++)
+    r += a[i];
+  return r;
+}
+
+inline void maxinto(int64_t *a, const int64_t *b, size_t n)
+{
+  size_t i = 0;
+#if defined(__AVX2__)
+  for (; i + 4 <= n; i += 4)
+  {
+    __m256i x = _mm256_loadu_si256((const __m256i *)(a + i));
+    __m256i y = _mm256_loadu_si256((const __m256i *)(b + i));
+    _mm256_storeu_si256((__m256i *)(a + i), _mm256_blendv_epi8(x, y, _mm256_cmpgt_epi64(y, x)));
+  }
+#endif
+  for (; i < n; i++)
+    if (a[i] < b[i])
+      a[i] = b[i];
+}
+
+inline int64_t sumof(const int64_t *a, size_t n)
+{
+  size_t i = 0;
+  int64_t r = 0;
+#if defined(__SSE2__)
+  __m128i s = _mm_setzero_si128();
+#if defined(__AVX2__)
+  __m256i w = _mm256_setzero_si256();
+  for (; i + 4 <= n; i += 4)
+    w = _mm256_add_epi64(w, _mm256_loadu_si256((const __m256i *)(a + i)));
+  s = _mm_add_epi64(_mm256_castsi256_si128(w), _mm256_extracti128_si256(w, 1));
+#endif
+  for (; i + 2 <= n; i += 2)
+    s = _mm_add_epi64(s, _mm_loadu_si128((const __m128i *)(a + i)));
+  int64_t l[2];
+  _mm_storeu_si128((__m128i *)l, s);
+  r = l[0] + l[1];
+#endif
+  for (; i < n; i++)
+    r += a[i];
+  return r;
+}
+
+// Counts by slot, in a std::array when the number of slots N is fixed at
+// compile time, or in a vector that grows to the largest slot seen if N is 0
+template <typename V, size_t N>
+class slotarray
+{
+  std::array<V, N> a;
+
+public:
+  slotarray() { a.fill(V()); }
+  size_t size() const { return N; }
+  bool fit(size_t n) const { return n <= N; }
+  V *data() { return a.data(); }
+  const V *data() const { return a.data(); }
+  V &operator[](size_t i) { return a[i]; }
+  const V &operator[](size_t i) const { return a[i]; }
+};
+
+template <typename V>
+class slotarray<V, 0>
+{
+  std::vector<V> a;
+
+public:
+  size_t size() const { return a.size(); }
+  bool fit(size_t n)
+  {
+    if (a.size() < n)
+      a.resize(n);
+    return true;
+  }
+  V *data() { return a.data(); }
+  const V *data() const { return a.data(); }
+  V &operator[](size_t i) { return a[i]; }
+  const V &operator[](size_t i) const { return a[i]; }
+};
+
+// G-Counter with one count per replica slot, for clusters of known
+// membership whose ids are small integers or interned, see slotof. Join is
+// an element-wise max and read a sum over the slots. N fixes the number of
+// slots at compile time, 0 grows them as ids show up. Same interface and
+// wire format as gcounter, and pncounter and bcounter can be built on it,
+// e.g. pncounter<int, replicaid, densecounter<int, replicaid>>.
+template <typename V = int, typename K = replicaid, size_t N = 0>
+class densecounter
+{
+private:
+  slotarray<V, N> a;
+  K id;
+
+  void grow(size_t k, const V &v)
+  {
+    if (a[k] < v)
+      a[k] = v;
+  }
+
+public:
+  densecounter() {}            // Only for deltas and those should not be mutated
+  densecounter(K k) : id(k) {} // Mutable replicas need a unique id
+
+  densecounter inc(V tosum = {1}) // argument is optional
+  {
+    densecounter<V, K, N> res;
+    size_t k = slotof<K>::index(id);
+    bool in = a.fit(k + 1) && res.a.fit(k + 1);
+    assert(in && "replica slot beyond N");
+    if (!in)
+      return res;
+    a[k] += tosum;
+    res.a[k] = a[k];
+    return res;
+  }
+
+  bool operator==(const densecounter<V, K, N> &o) const
+  {
+    size_t n = std::max(a.size(), o.a.size());
+    for (size_t k = 0; k < n; k++)
+      if (!((k < a.size() ? a[k] : V()) == (k < o.a.size() ? o.a[k] : V())))
+        return false;
+    return true;
+  }
+
+  V local() const // get local counter value
+  {
+    size_t k = slotof<K>::index(id);
+    return k < a.size() ? a[k] : V();
+  }
+
+  V read() const // get counter value
+  {
+    return sumof(a.data(), a.size());
+  }
+
+  void join(const densecounter<V, K, N> &o)
+  {
+    a.fit(o.a.size());
+    maxinto(a.data(), o.a.data(), o.a.size());
+  }
+
+  template <typename It>
+  void join_many(It first, It last)
+  {
+    for (; first != last; ++first)
+      join(*first);
+  }
+
+  // Nonzero slots as (id, count) pairs in slot order, like a gcounter map
+  void encode(std::string &b) const
+  {
+    size_t n = 0;
+    for (size_t k = 0; k < a.size(); k++)
+      n += !(a[k] == V());
+    putvarint(b, n);
+    for (size_t k = 0; k < a.size(); k++)
+      if (!(a[k] == V()))
+      {
+        ::dtcrdt::encode(b, slotof<K>::id(k));
+        ::dtcrdt::encode(b, a[k]);
+      }
+  }
+
+  bool decode(const char *&p, const char *e)
+  {
+    a = slotarray<V, N>();
+    return join(wireview(p, e), p);
+  }
+
+  // Joins straight from an encoded gcounter or densecounter, false if it
+  // is malformed or names a slot beyond N
+  bool join(wireview v)
+  {
+    return join(v, v.p);
+  }
+
+  friend std::ostream &operator<<(std::ostream &output, const densecounter<V, K, N> &o)
+  {
+    output << "DenseCounter: ( ";
+    for (size_t k = 0; k < o.a.size(); k++)
+      if (!(o.a[k] == V()))
+        output << slotof<K>::id(k) << "->" << o.a[k] << " ";
+    output << ")";
+    return output;
+  }
+
+private:
+  bool join(wireview v, const char *&p)
+  {
+    uint64_t n;
+    if (!getcount(v.p, v.e, n))
+      return false;
+    std::pair<K, V> okv;
+    for (uint64_t i = 0; i < n; i++)
+    {
+      if (!::dtcrdt::decode(v.p, v.e, okv) || !slotof<K>::valid(okv.first))
+        return false;
+      size_t k = slotof<K>::index(okv.first);
+      if (!a.fit(k + 1))
+        return false;
+      grow(k, okv.second);
+    }
+    p = v.p;
+    return true;
+  }
+};
+
+// G is the grow-only counter kept for increments and for decrements,
+// gcounter or densecounter
+template <typename V = int, typename K = std::string, typename G = gcounter<V, K>>
+class pncounter
+{
+private:
+  G p, n;
+
+public:
+  pncounter() {}                 // Only for deltas and those should not be mutated
+  pncounter(K a) : p(a), n(a) {} // Mutable replicas need a unique id
+
+  pncounter inc(V tosum = {1}) // Argument is optional
+  {
+    pncounter<V, K, G> res;
+    res.p = p.inc(tosum);
+    return res;
+  }
+
+  pncounter dec(V tosum = {1}) // Argument is optional
+  {
+    pncounter<V, K, G> res;
+    res.n = n.inc(tosum);
+    return res;
+  }
+
+  V local() // get local counter value
+  {
+    V res = p.local() - n.local();
+    return res;
+  }
+
+  V read() const // get counter value
+  {
+    V res = p.read() - n.read();
+    return res;
+  }
+
+  void join(const pncounter &o)
+  {
+    p.join(o.p);
+    n.join(o.n);
+  }
+
+  void encode(std::string &b) const
+  {
+    p.encode(b);
+    n.encode(b);
+  }
+
+  bool decode(const char *&b, const char *e)
+  {
+    return p.decode(b, e) && n.decode(b, e);
+  }
+
+  friend std::ostream &operator<<(std::ostream &output, const pncounter<V, K, G> &o)
+  {
+    output << "PNCounter:P:" << o.p << " PNCounter:N:" << o.n;
+    return output;
+  }
+};
+
+template <typename V = int, typename K = std::string>
+class lexcounter
+{
+private:
+  std::map<K, std::pair<int, V>> m;
+  K id;
+
+public:
+  lexcounter() {}            // Only for deltas and those should not be mutated
+  lexcounter(K a) : id(a) {} // Mutable replicas need a unique id
+
+  lexcounter inc(V tosum = 1) // Argument is optional
+  {
+    lexcounter<V, K> res;
+
+    //    m[id].first+=1; // optional
+    m[id].second += tosum;
+    res.m[id] = m[id];
+
+    return res;
+  }
+
+  lexcounter dec(V tosum = 1) // Argument is optional
+  {
+    lexcounter<V, K> res;
+
+    m[id].first += 1; // mandatory
+    m[id].second -= tosum;
+    res.m[id] = m[id];
+
+    return res;
+  }
+
+  V read() const // get counter value
+  {
+    V res = 0;
+    for (const auto &kv : m) // Fold+ on value list
+      res += kv.second.second;
+    return res;
+  }
+
+  void join(const lexcounter<V, K> &o)
+  {
+    auto it = m.begin();
+    for (const auto &okv : o.m)
+    {
+      it = seek(m, it, okv.first, firstof());
+      if (it == m.end() || okv.first < it->first) // as joined with a zero entry
+        it = m.insert(it, std::make_pair(okv.first, lexjoin(okv.second, std::pair<int, V>())));
+      else
+        it->second = lexjoin(okv.second, it->second);
+    }
+  }
+
+  void encode(std::string &b) const
+  {
+    ::dtcrdt::encode(b, m);
+  }
+
+  bool decode(const char *&p, const char *e)
+  {
+    return ::dtcrdt::decode(p, e, m);
+  }
+
+  friend std::ostream &operator<<(std::ostream &output, const lexcounter<V, K> &o)
+  {
+    output << "LexCounter: ( ";
+    for (const auto &kv : o.m)
+      output << kv.first << "->" << kv.second << " ";
+    output << ")";
+    return output;
+  }
+};
+
+template <typename V, typename K = std::string, typename S = mapstore, typename C = uncached>
+class ccounter // Causal counter, variation of Riak_dt_emcntr and lexcounter
+{
+private:
+  // To re-use the kernel there is an artificial need for dot-tagged bool payload
+  dotkernel<V, K, S, typename C::sumpolicy> dk; // Dot kernel
+  K id;
+  std::pair<K, int> own; // Our current dot, when known
+  bool hasown;           // Cleared by joins and resets
+
+  typedef typename dotkernel<V, K, S, typename C::sumpolicy>::dotstore::iterator dotiter;
+
+  dotiter mine()
+  {
+    if (hasown)
+    {
+      auto it = dk.ds.find(own);
+      if (it != dk.ds.end() || own.second == 0) // found, or known to have none
+        return it;
+    }
+    hasown = true;
+    for (auto it = dk.ds.begin(); it != dk.ds.end(); ++it)
+      if (it->first.first == id) // there should be a single one such
       {
-        // std::cout << "cc two\n";
-        // entry only at other
-        cc.insert(*mito);
-        ++mito;
+        own = it->first;
+        return it;
       }
-      else if (mit != cc.end() && mito != o.cc.end())
+    own = std::pair<K, int>(id, 0); // None, dots start at 1
+    return dk.ds.end();
+  }
+
+  // Replaces our dot by a new one with value v
+  ccounter<V, K, S, C> replace(dotiter me, const V &v)
+  {
+    ccounter<V, K, S, C> r;
+    if (me != dk.ds.end())
+    {
+      r.dk.c.insertdot(me->first, false);
+      dk.idx.erase(me->second, me->first);
+      dk.ds.erase(me);
+    }
+    own = dk.dotadd(id, v);
+    r.dk.ds.insert(std::make_pair(own, v));
+    r.dk.idx.insert(v, own);
+    r.dk.c.insertdot(own);
+    return r;
+  }
+
+public:
+  ccounter() : hasown(false) {}            // Only for deltas and those should not be mutated
+  ccounter(K k) : id(k), hasown(false) {} // Mutable replicas need a unique id
+  ccounter(K k, dotcontext<K> &jointc) : id(k), dk(jointc), hasown(false) {}
+
+  dotcontext<K> &context()
+  {
+    return dk.c;
+  }
+
+  friend std::ostream &operator<<(std::ostream &output, const ccounter<V, K, S, C> &o)
+  {
+    output << "CausalCounter:" << o.dk;
+    return output;
+  }
+
+  // Our dot is looked up in O(log n), and scanned for only after joins
+  ccounter<V, K, S, C> inc(const V &val = 1)
+  {
+    dotiter me = mine();
+    V base = me != dk.ds.end() ? me->second : V(); // typically 0
+    return replace(me, base + val);
+  }
+
+  ccounter<V, K, S, C> dec(const V &val = 1)
+  {
+    dotiter me = mine();
+    V base = me != dk.ds.end() ? me->second : V(); // typically 0
+    return replace(me, base - val);
+  }
+
+  ccounter<V, K, S, C> reset() // Other nodes might however upgrade their counts
+  {
+    ccounter<V, K, S, C> r;
+    r.dk = dk.rmv();
+    hasown = false;
+    return r;
+  }
+
+  V read()
+  {
+    return read(std::integral_constant<bool, C::on>());
+  }
+
+  void join(const ccounter<V, K, S, C> &o)
+  {
+    dk.join(o.dk);
+    hasown = false;
+  }
+
+  void join(ccounter<V, K, S, C> &&o)
+  {
+    dk.join(std::move(o.dk));
+    hasown = false;
+  }
+
+  // Payload only join, for entries of a map
+  void joinstore(const ccounter<V, K, S, C> &o)
+  {
+    dk.joinstore(o.dk);
+    hasown = false;
+  }
+
+  // What a replica with context peer has not seen, see dotkernel
+  ccounter<V, K, S, C> delta_since(const dotcontext<K> &peer) const
+  {
+    ccounter<V, K, S, C> r;
+    r.dk = dk.delta_since(peer);
+    return r;
+  }
+
+  // Store part of delta_since, for entries of a map
+  bool storesince(const dotcontext<K> &peer, ccounter<V, K, S, C> &r, dotcontext<K> &held) const
+  {
+    return dk.storesince(peer, r.dk, held);
+  }
+
+  void encode(std::string &b, bool ctx = true) const
+  {
+    dk.encode(b, ctx);
+  }
+
+  static bool skip(const char *&p, const char *e, bool ctx = true)
+  {
+    return dotkernel<V, K, S, typename C::sumpolicy>::skip(p, e, ctx);
+  }
+
+  bool decode(const char *&p, const char *e, bool ctx = true)
+  {
+    hasown = false;
+    return dk.decode(p, e, ctx);
+  }
+
+  // Joins straight from an encoded state, false if it is malformed
+  bool join(wireview v)
+  {
+    hasown = false;
+    return dk.join(v);
+  }
+
+private:
+  V read(std::true_type)
+  {
+    return dk.idx.sum();
+  }
+
+  V read(std::false_type)
+  {
+    V v = {}; // Usually 0
+    for (const auto &dse : dk.ds)
+      v += dse.second;
+    return v;
+  }
+};
+
+template <typename T>
+class gset
+{
+private:
+  std::set<T> s;
+
+public:
+  gset() {}
+  //  gset(std::string id, dotcontext<K> &jointdc) {}
+
+  // For map compliance reply with an empty context
+  //  dotcontext<K> context()
+  //  {
+  //    return dotcontext<K>();
+  //  }
+
+  std::set<T> read() const { return s; }
+
+  bool operator==(const gset<T> &o) const { return s == o.s; }
+
+  bool in(const T &val)
+  {
+    return s.count(val);
+  }
+
+  friend std::ostream &operator<<(std::ostream &output, const gset<T> &o)
+  {
+    output << "GSet: " << o.s;
+    return output;
+  }
+
+  gset<T> add(const T &val)
+  {
+    gset<T> res;
+    s.insert(val);
+    res.s.insert(val);
+    return res;
+  }
+
+  void join(const gset<T> &o)
+  {
+    auto it = s.begin();
+    for (const auto &e : o.s)
+    {
+      it = seek(s, it, e, itself());
+      if (it == s.end() || e < *it)
+        s.insert(it, e);
+    }
+  }
+
+  void join(gset<T> &&o)
+  {
+    if (s.empty())
+      s.swap(o.s);
+    else
+      join(o);
+  }
+
+  // Joins many sets, merging them in one heap walk so that each
+  // distinct element is looked up here once
+  template <typename It>
+  void join_many(It first, It last)
+  {
+    typedef typename std::set<T>::const_iterator iter;
+    std::vector<std::pair<iter, iter>> rs;
+    for (; first != last; ++first)
+      if (&*first != this)
+        rs.push_back(std::make_pair(first->s.begin(), first->s.end()));
+    auto it = s.begin();
+    for (kwaymerge<iter, itself> w(rs); !w.done(); w.next())
+    {
+      const T &e = *w.group().front();
+      it = seek(s, it, e, itself());
+      if (it == s.end() || e < *it)
+        s.insert(it, e);
+    }
+  }
+
+  void encode(std::string &b) const
+  {
+    ::dtcrdt::encode(b, s);
+  }
+
+  bool decode(const char *&p, const char *e)
+  {
+    return ::dtcrdt::decode(p, e, s);
+  }
+
+  // Joins straight from an encoded gset, false if it is malformed
+  bool join(wireview v)
+  {
+    uint64_t n;
+    if (!getcount(v.p, v.e, n))
+      return false;
+    T val;
+    for (uint64_t i = 0; i < n; i++)
+    {
+      if (!::dtcrdt::decode(v.p, v.e, val))
+        return false;
+      s.insert(s.end(), val);
+    }
+    return true;
+  }
+};
+
+template <typename T, typename K = std::string> // Map embedable datatype
+class twopset
+{
+private:
+  std::set<T> s;
+  std::set<T> t; // removed elements are added to t and removed from s
+
+public:
+  twopset() {}
+  twopset(std::string id, dotcontext<K> &jointdc) {}
+  // For map compliance reply with an empty context
+  dotcontext<K> context()
+  {
+    return dotcontext<K>();
+  }
+
+  std::set<T> read() { return s; }
+
+  bool operator==(const twopset<T> &o) const
+  {
+    return s == o.s && t == o.t;
+  }
+
+  bool in(const T &val)
+  {
+    return s.count(val);
+  }
+
+  friend std::ostream &operator<<(std::ostream &output, const twopset<T> &o)
+  {
+    output << "2PSet: S" << o.s << " T " << o.t;
+    return output;
+  }
+
+  twopset<T> add(const T &val)
+  {
+    twopset<T> res;
+    if (t.count(val) == 0) // only add if not in tombstone set
+    {
+      s.insert(val);
+      res.s.insert(val);
+    }
+    return res;
+  }
+
+  twopset<T> rmv(const T &val)
+  {
+    twopset<T> res;
+    s.erase(val);
+    t.insert(val); // add to tombstones
+    res.t.insert(val);
+    return res;
+  }
+
+  twopset<T> reset()
+  {
+    twopset<T> res;
+    for (auto const &val : s)
+    {
+      t.insert(val);
+      res.t.insert(val);
+    }
+    s.clear();
+    return res;
+  }
+
+  void join(const twopset<T> &o)
+  {
+    auto tit = t.begin();
+    auto sit = s.begin();
+    for (const auto &ot : o.t) // see other tombstones
+    {
+      tit = seek(t, tit, ot, itself());
+      if (tit == t.end() || ot < *tit)
+        tit = t.insert(tit, ot); // insert them locally
+      sit = seek(s, sit, ot, itself());
+      if (sit != s.end() && !(ot < *sit)) // remove val if present
+        sit = s.erase(sit);
+    }
+    tit = t.begin();
+    sit = s.begin();
+    for (const auto &os : o.s) // add other vals, if not tombstone
+    {
+      tit = seek(t, tit, os, itself());
+      if (tit != t.end() && !(os < *tit))
+        continue;
+      sit = seek(s, sit, os, itself());
+      if (sit == s.end() || os < *sit)
+        s.insert(sit, os);
+    }
+  }
+
+  // No context, so the payload join is the join
+  void joinstore(const twopset<T> &o)
+  {
+    join(o);
+  }
+
+  // Store part of a map's delta_since. There are no dots to tell what the
+  // peer has seen, so the whole set goes.
+  bool storesince(const dotcontext<K> &, twopset<T, K> &r, dotcontext<K> &) const
+  {
+    r.s = s;
+    r.t = t;
+    return !s.empty() || !t.empty();
+  }
+
+  void encode(std::string &b, bool = true) const // no context to send
+  {
+    ::dtcrdt::encode(b, s);
+    ::dtcrdt::encode(b, t);
+  }
+
+  bool decode(const char *&p, const char *e, bool = true)
+  {
+    return ::dtcrdt::decode(p, e, s) && ::dtcrdt::decode(p, e, t);
+  }
+
+  static bool skip(const char *&p, const char *e, bool = true)
+  {
+    return ::dtcrdt::skip(p, e, (const std::set<T> *)nullptr) && ::dtcrdt::skip(p, e, (const std::set<T> *)nullptr);
+  }
+};
+
+// Element views of set kernels, for cached reads
+
+template <typename E>
+struct plainview // Values are the elements
+{
+  typedef E elem;
+
+  template <typename I>
+  static void update(std::set<E> &v, const I &idx, const E &t)
+  {
+    if (idx.has(t))
+      v.insert(t);
+    else
+      v.erase(t);
+  }
+};
+
+template <typename E>
+struct rwview // Elements with add tokens and no remove tokens
+{
+  typedef E elem;
+
+  template <typename I>
+  static void update(std::set<E> &v, const I &idx, const std::pair<E, bool> &t)
+  {
+    if (idx.has(std::pair<E, bool>(t.first, true)) && !idx.has(std::pair<E, bool>(t.first, false)))
+      v.insert(t.first);
+    else
+      v.erase(t.first);
+  }
+};
+
+template <typename E, typename K = std::string, typename S = mapstore, typename C = uncached> // Map embedable datatype
+class aworset                                   // Add-Wins Observed-Remove Set
+{
+private:
+  dotkernel<E, K, S, typename C::template setpolicy<plainview<E>>> dk; // Dot kernel
+  K id;
+
+public:
+  aworset() {}            // Only for deltas and those should not be mutated
+  aworset(K k) : id(k) {} // Mutable replicas need a unique id
+  aworset(K k, dotcontext<K> &jointc) : id(k), dk(jointc) {}
+
+  dotcontext<K> &context()
+  {
+    return dk.c;
+  }
+
+  friend std::ostream &operator<<(std::ostream &output, const aworset<E, K, S, C> &o)
+  {
+    output << "AWORSet:" << o.dk;
+    return output;
+  }
+
+  std::set<E> read()
+  {
+    return read(std::integral_constant<bool, C::on>());
+  }
+
+  // Only with cached reads, valid until the next change
+  const std::set<E> &view() const
+  {
+    return dk.idx.view();
+  }
+
+  bool in(const E &val)
+  {
+    return dk.has(val);
+  }
+
+  aworset<E, K, S, C> add(const E &val)
+  {
+    aworset<E, K, S, C> r;
+    r.dk = dk.rmv(val); // optimization that first deletes val
+    r.dk.join(dk.add(id, val));
+    return r;
+  }
+
+  aworset<E, K, S, C> rmv(const E &val)
+  {
+    aworset<E, K, S, C> r;
+    r.dk = dk.rmv(val);
+    return r;
+  }
+
+  aworset<E, K, S, C> reset()
+  {
+    aworset<E, K, S, C> r;
+    r.dk = dk.rmv();
+    return r;
+  }
+
+  void join(const aworset<E, K, S, C> &o)
+  {
+    dk.join(o.dk);
+    // Further optimization can be done by keeping for val x and id A
+    // only the highest dot from A supporting x.
+  }
+
+  void join(aworset<E, K, S, C> &&o)
+  {
+    dk.join(std::move(o.dk));
+  }
+
+  template <typename It>
+  void join_many(It first, It last)
+  {
+    std::vector<std::reference_wrapper<const decltype(dk)>> ks;
+    for (; first != last; ++first)
+      ks.push_back(std::cref(first->dk));
+    dk.join_many(ks.begin(), ks.end());
+  }
+
+  // Payload only join, for entries of a map
+  void joinstore(const aworset<E, K, S, C> &o)
+  {
+    dk.joinstore(o.dk);
+  }
+
+  void joinstore(aworset<E, K, S, C> &&o)
+  {
+    dk.joinstore(std::move(o.dk));
+  }
+
+  // What a replica with context peer has not seen, see dotkernel
+  aworset<E, K, S, C> delta_since(const dotcontext<K> &peer) const
+  {
+    aworset<E, K, S, C> r;
+    r.dk = dk.delta_since(peer);
+    return r;
+  }
+
+  // Store part of delta_since, for entries of a map
+  bool storesince(const dotcontext<K> &peer, aworset<E, K, S, C> &r, dotcontext<K> &held) const
+  {
+    return dk.storesince(peer, r.dk, held);
+  }
+
+  void encode(std::string &b, bool ctx = true) const
+  {
+    dk.encode(b, ctx);
+  }
+
+  static bool skip(const char *&p, const char *e, bool ctx = true)
+  {
+    return dotkernel<E, K, S, typename C::template setpolicy<plainview<E>>>::skip(p, e, ctx);
+  }
+
+  bool decode(const char *&p, const char *e, bool ctx = true)
+  {
+    return dk.decode(p, e, ctx);
+  }
+
+  // Joins straight from an encoded state, false if it is malformed
+  bool join(wireview v)
+  {
+    return dk.join(v);
+  }
+
+private:
+  std::set<E> read(std::true_type)
+  {
+    return view();
+  }
+
+  std::set<E> read(std::false_type)
+  {
+    std::set<E> res;
+    for (const auto &dv : dk.ds)
+      res.insert(dv.second);
+    return res;
+  }
+};
+
+template <typename E, typename K = std::string, typename S = mapstore, typename C = uncached> // Map embedable datatype
+class rworset                                   // Remove-Wins Observed-Remove Set
+{
+private:
+  dotkernel<std::pair<E, bool>, K, S, typename C::template setpolicy<rwview<E>>> dk; // Dot kernel
+  K id;
+
+public:
+  rworset() {}            // Only for deltas and those should not be mutated
+  rworset(K k) : id(k) {} // Mutable replicas need a unique id
+  rworset(K k, dotcontext<K> &jointc) : id(k), dk(jointc) {}
+
+  dotcontext<K> &context()
+  {
+    return dk.c;
+  }
+
+  friend std::ostream &operator<<(std::ostream &output, const rworset<E, K, S, C> &o)
+  {
+    output << "RWORSet:" << o.dk;
+    return output;
+  }
+
+  std::set<E> read()
+  {
+    return read(std::integral_constant<bool, C::on>());
+  }
+
+  // Only with cached reads, valid until the next change
+  const std::set<E> &view() const
+  {
+    return dk.idx.view();
+  }
+
+  bool in(const E &val) // Some add token and no remove token
+  {
+    return dk.has(std::pair<E, bool>(val, true)) && !dk.has(std::pair<E, bool>(val, false));
+  }
+
+  rworset<E, K, S, C> add(const E &val)
+  {
+    rworset<E, K, S, C> r;
+    r.dk = dk.rmv(std::pair<E, bool>(val, true));      // Remove any observed add token
+    r.dk.join(dk.rmv(std::pair<E, bool>(val, false))); // Remove any observed remove token
+    r.dk.join(dk.add(id, std::pair<E, bool>(val, true)));
+    return r;
+  }
+
+  rworset<E, K, S, C> rmv(const E &val)
+  {
+    rworset<E, K, S, C> r;
+    r.dk = dk.rmv(std::pair<E, bool>(val, true));      // Remove any observed add token
+    r.dk.join(dk.rmv(std::pair<E, bool>(val, false))); // Remove any observed remove token
+    r.dk.join(dk.add(id, std::pair<E, bool>(val, false)));
+    return r;
+  }
+
+  rworset<E, K, S, C> reset()
+  {
+    rworset<E, K, S, C> r;
+    r.dk = dk.rmv();
+    return r;
+  }
+
+  void join(const rworset<E, K, S, C> &o)
+  {
+    dk.join(o.dk);
+  }
+
+  void join(rworset<E, K, S, C> &&o)
+  {
+    dk.join(std::move(o.dk));
+  }
+
+  // Payload only join, for entries of a map
+  void joinstore(const rworset<E, K, S, C> &o)
+  {
+    dk.joinstore(o.dk);
+  }
+
+  void joinstore(rworset<E, K, S, C> &&o)
+  {
+    dk.joinstore(std::move(o.dk));
+  }
+
+  // What a replica with context peer has not seen, see dotkernel
+  rworset<E, K, S, C> delta_since(const dotcontext<K> &peer) const
+  {
+    rworset<E, K, S, C> r;
+    r.dk = dk.delta_since(peer);
+    return r;
+  }
+
+  // Store part of delta_since, for entries of a map
+  bool storesince(const dotcontext<K> &peer, rworset<E, K, S, C> &r, dotcontext<K> &held) const
+  {
+    return dk.storesince(peer, r.dk, held);
+  }
+
+  void encode(std::string &b, bool ctx = true) const
+  {
+    dk.encode(b, ctx);
+  }
+
+  static bool skip(const char *&p, const char *e, bool ctx = true)
+  {
+    return dotkernel<std::pair<E, bool>, K, S, typename C::template setpolicy<rwview<E>>>::skip(p, e, ctx);
+  }
+
+  bool decode(const char *&p, const char *e, bool ctx = true)
+  {
+    return dk.decode(p, e, ctx);
+  }
+
+  // Joins straight from an encoded state, false if it is malformed
+  bool join(wireview v)
+  {
+    return dk.join(v);
+  }
+
+private:
+  std::set<E> read(std::true_type)
+  {
+    return view();
+  }
+
+  std::set<E> read(std::false_type)
+  {
+    std::set<E> res;
+    std::map<E, bool> elems;
+    std::pair<typename std::map<E, bool>::iterator, bool> ret;
+    for (auto dsit = dk.ds.begin(); dsit != dk.ds.end(); ++dsit)
+    {
+      ret = elems.insert(std::pair<E, bool>(dsit->second));
+      if (ret.second == false) // val already exists
       {
-        // std::cout << "cc three\n";
-        // in both
-        cc.at(mit->first) = std::max(mit->second, mito->second);
-        ++mit;
-        ++mito;
+        elems.at(ret.first->first) &= dsit->second.second; // Fold by &&
       }
-    } while (mit != cc.end() || mito != o.cc.end());
-    // DC
-    // Set
-    for (const auto &e : o.dc)
-      insertdot(e, false);
+    }
+    typename std::map<E, bool>::iterator mit;
+    for (mit = elems.begin(); mit != elems.end(); ++mit)
+    {
+      if (mit->second == true)
+        res.insert(mit->first);
+    }
+    return res;
+  }
+};
+
+template <typename V, typename K = std::string, typename S = mapstore>
+class mvreg // Multi-value register, Optimized
+{
+private:
+  dotkernel<V, K, S> dk; // Dot kernel
+  K id;
+
+public:
+  mvreg() {}            // Only for deltas and those should not be mutated
+  mvreg(K k) : id(k) {} // Mutable replicas need a unique id
+  mvreg(K k, dotcontext<K> &jointc) : id(k), dk(jointc) {}
+
+  dotcontext<K> &context()
+  {
+    return dk.c;
+  }
+
+  friend std::ostream &operator<<(std::ostream &output, const mvreg<V, K, S> &o)
+  {
+    output << "MVReg:" << o.dk;
+    return output;
+  }
+
+  mvreg<V, K, S> write(const V &val)
+  {
+    mvreg<V, K, S> r, a;
+    r.dk = dk.rmv();
+    a.dk = dk.add(id, val);
+    r.join(a);
+    return r;
+  }
+
+  std::set<V> read()
+  {
+    std::set<V> s;
+    for (const auto &dse : dk.ds)
+      s.insert(dse.second);
+    return s;
+  }
+
+  mvreg<V, K, S> reset()
+  {
+    mvreg<V, K, S> r;
+    r.dk = dk.rmv();
+    return r;
+  }
+
+  // Removes the values below some other value, in the order of V
+  mvreg<V, K, S> resolve()
+  {
+    return resolve(totalorder<V>());
+  }
+
+private:
+  // Total orders keep the largest value, found in one pass
+  mvreg<V, K, S> resolve(std::true_type)
+  {
+    mvreg<V, K, S> r;
+    if (dk.ds.empty())
+      return r;
+    const V *top = &dk.ds.begin()->second;
+    for (const auto &dse : dk.ds)
+      if (*top < dse.second)
+        top = &dse.second;
+    V m = *top;
+    r.dk = dk.rmvif([&m](const V &v) { return v < m; });
+    return r;
+  }
+
+  // Partial orders keep the maximal values. Each value is compared with
+  // the maximals found so far, so this is quadratic only when most values
+  // are concurrent.
+  mvreg<V, K, S> resolve(std::false_type)
+  {
+    std::vector<V> top;
+    for (const auto &dse : dk.ds)
+    {
+      bool below = false;
+      for (auto it = top.begin(); it != top.end() && !below;)
+        if (leq(dse.second, *it))
+          below = true;
+        else if (leq(*it, dse.second))
+          it = top.erase(it);
+        else
+          ++it;
+      if (!below)
+        top.push_back(dse.second);
+    }
+    mvreg<V, K, S> r;
+    r.dk = dk.rmvif([&top](const V &v) {
+      return std::find(top.begin(), top.end(), v) == top.end();
+    });
+    return r;
+  }
+
+public:
+
+  void join(const mvreg<V, K, S> &o)
+  {
+    dk.join(o.dk);
+  }
+
+  void join(mvreg<V, K, S> &&o)
+  {
+    dk.join(std::move(o.dk));
+  }
+
+  // Payload only join, for entries of a map
+  void joinstore(const mvreg<V, K, S> &o)
+  {
+    dk.joinstore(o.dk);
+  }
+
+  void joinstore(mvreg<V, K, S> &&o)
+  {
+    dk.joinstore(std::move(o.dk));
+  }
+
+  // What a replica with context peer has not seen, see dotkernel
+  mvreg<V, K, S> delta_since(const dotcontext<K> &peer) const
+  {
+    mvreg<V, K, S> r;
+    r.dk = dk.delta_since(peer);
+    return r;
+  }
+
+  // Store part of delta_since, for entries of a map
+  bool storesince(const dotcontext<K> &peer, mvreg<V, K, S> &r, dotcontext<K> &held) const
+  {
+    return dk.storesince(peer, r.dk, held);
+  }
+
+  void encode(std::string &b, bool ctx = true) const
+  {
+    dk.encode(b, ctx);
+  }
+
+  static bool skip(const char *&p, const char *e, bool ctx = true)
+  {
+    return dotkernel<V, K, S>::skip(p, e, ctx);
+  }
+
+  bool decode(const char *&p, const char *e, bool ctx = true)
+  {
+    return dk.decode(p, e, ctx);
+  }
+
+  // Joins straight from an encoded state, false if it is malformed
+  bool join(wireview v)
+  {
+    return dk.join(v);
+  }
+};
+
+template <typename K = std::string, typename S = mapstore>
+class ewflag // Enable-Wins Flag
+{
+private:
+  // To re-use the kernel there is an artificial need for dot-tagged bool payload
+  dotkernel<bool, K, S> dk; // Dot kernel
+  K id;
+
+public:
+  ewflag() {}            // Only for deltas and those should not be mutated
+  ewflag(K k) : id(k) {} // Mutable replicas need a unique id
+  ewflag(K k, dotcontext<K> &jointc) : id(k), dk(jointc) {}
+
+  dotcontext<K> &context()
+  {
+    return dk.c;
+  }
 
-    compact();
+  friend std::ostream &operator<<(std::ostream &output, const ewflag<K, S> &o)
+  {
+    output << "EWFlag:" << o.dk;
+    return output;
+  }
+
+  bool read()
+  {
+    if (dk.ds.begin() == dk.ds.end())
+      // No active dots
+      return false;
+    else
+      // Some dots
+      return true;
+  }
+
+  ewflag<K, S> enable()
+  {
+    ewflag<K, S> r;
+    r.dk = dk.rmv(true); // optimization that first deletes active dots
+    r.dk.join(dk.add(id, true));
+    return r;
+  }
+
+  ewflag<K, S> disable()
+  {
+    ewflag<K, S> r;
+    r.dk = dk.rmv(true);
+    return r;
+  }
+
+  ewflag<K, S> reset()
+  {
+    ewflag<K, S> r;
+    r.dk = dk.rmv();
+    return r;
+  }
+
+  void join(const ewflag<K, S> &o)
+  {
+    dk.join(o.dk);
+  }
+
+  void join(ewflag<K, S> &&o)
+  {
+    dk.join(std::move(o.dk));
+  }
+
+  // Payload only join, for entries of a map
+  void joinstore(const ewflag<K, S> &o)
+  {
+    dk.joinstore(o.dk);
+  }
+
+  // What a replica with context peer has not seen, see dotkernel
+  ewflag<K, S> delta_since(const dotcontext<K> &peer) const
+  {
+    ewflag<K, S> r;
+    r.dk = dk.delta_since(peer);
+    return r;
+  }
+
+  // Store part of delta_since, for entries of a map
+  bool storesince(const dotcontext<K> &peer, ewflag<K, S> &r, dotcontext<K> &held) const
+  {
+    return dk.storesince(peer, r.dk, held);
+  }
+
+  void encode(std::string &b, bool ctx = true) const
+  {
+    dk.encode(b, ctx);
+  }
+
+  static bool skip(const char *&p, const char *e, bool ctx = true)
+  {
+    return dotkernel<bool, K, S>::skip(p, e, ctx);
+  }
+
+  bool decode(const char *&p, const char *e, bool ctx = true)
+  {
+    return dk.decode(p, e, ctx);
+  }
+
+  // Joins straight from an encoded state, false if it is malformed
+  bool join(wireview v)
+  {
+    return dk.join(v);
   }
 };
 
-template <typename T, typename K>
-class dotkernel
+template <typename K = std::string, typename S = mapstore>
+class dwflag // Disable-Wins Flag
 {
+private:
+  // To re-use the kernel there is an artificial need for dot-tagged bool payload
+  dotkernel<bool, K, S> dk; // Dot kernel
+  K id;
+
 public:
-  std::map<std::pair<K, int>, T> ds; // Map of dots to vals
+  dwflag() {}            // Only for deltas and those should not be mutated
+  dwflag(K k) : id(k) {} // Mutable replicas need a unique id
+  dwflag(K k, dotcontext<K> &jointc) : id(k), dk(jointc) {}
 
-  dotcontext<K> cbase;
-  dotcontext<K> &c;
+  dotcontext<K> &context()
+  {
+    return dk.c;
+  }
 
-  // if no causal context supplied, used base one
-  dotkernel() : c(cbase) {}
-  // if supplied, use a shared causal context
-  dotkernel(dotcontext<K> &jointc) : c(jointc) {}
-  //  dotkernel(const dotkernel<T,K> &adk) : c(adk.c), ds(adk.ds) {}
+  friend std::ostream &operator<<(std::ostream &output, const dwflag<K, S> &o)
+  {
+    output << "DWFlag:" << o.dk;
+    return output;
+  }
 
-  dotkernel<T, K> &operator=(const dotkernel<T, K> &adk)
+  bool read()
   {
-    if (&adk == this)
-      return *this;
-    if (&c != &adk.c)
-      c = adk.c;
-    ds = adk.ds;
-    return *this;
+    if (dk.ds.begin() == dk.ds.end())
+      // No active dots
+      return true;
+    else
+      // Some dots
+      return false;
   }
 
-  friend std::ostream &operator<<(std::ostream &output, const dotkernel<T, K> &o)
+  dwflag<K, S> disable()
   {
-    output << "Kernel: DS ( ";
-    for (const auto &dv : o.ds)
-      output << dv.first.first << ":" << dv.first.second << "->" << dv.second << " ";
-    output << ") ";
+    dwflag<K, S> r;
+    r.dk = dk.rmv(false); // optimization that first deletes active dots
+    r.dk.join(dk.add(id, false));
+    return r;
+  }
 
-    std::cout << o.c;
+  dwflag<K, S> enable()
+  {
+    dwflag<K, S> r;
+    r.dk = dk.rmv(false);
+    return r;
+  }
 
-    return output;
+  dwflag<K, S> reset()
+  {
+    dwflag<K, S> r;
+    r.dk = dk.rmv();
+    return r;
   }
 
-  void join(const dotkernel<T, K> &o)
+  void join(const dwflag<K, S> &o)
   {
-    if (this == &o)
-      return; // Join is idempotent, but just dont do it.
-    // DS
-    // will iterate over the two sorted sets to compute join
-    //typename  std::map<std::pair<K,int>,T>::iterator it;
-    //typename  std::map<std::pair<K,int>,T>::const_iterator ito;
-    auto it = ds.begin();
-    auto ito = o.ds.begin();
-    do
-    {
-      if (it != ds.end() && (ito == o.ds.end() || it->first < ito->first))
-      {
-        // dot only at this
-        if (o.c.dotin(it->first)) // other knows dot, must delete here
-          ds.erase(it++);
-        else // keep it
-          ++it;
-      }
-      else if (ito != o.ds.end() && (it == ds.end() || ito->first < it->first))
-      {
-        // dot only at other
-        if (!c.dotin(ito->first)) // If I dont know, import
-          ds.insert(*ito);
-        ++ito;
-      }
-      else if (it != ds.end() && ito != o.ds.end())
-      {
-        // dot in both
-        ++it;
-        ++ito;
-      }
-    } while (it != ds.end() || ito != o.ds.end());
-    // CC
-    c.join(o.c);
+    dk.join(o.dk);
   }
 
-  void deepjoin(const dotkernel<T, K> &o)
+  void join(dwflag<K, S> &&o)
   {
-    if (this == &o)
-      return; // Join is idempotent, but just dont do it.
-    // DS
-    // will iterate over the two sorted sets to compute join
-    //typename  std::map<std::pair<K,int>,T>::iterator it;
-    //typename  std::map<std::pair<K,int>,T>::const_iterator ito;
-    auto it = ds.begin();
-    auto ito = o.ds.begin();
-    do
-    {
-      if (it != ds.end() && (ito == o.ds.end() || it->first < ito->first))
-      {
-        // dot only at this
-        if (o.c.dotin(it->first)) // other knows dot, must delete here
-          ds.erase(it++);
-        else // keep it
-          ++it;
-      }
-      else if (ito != o.ds.end() && (it == ds.end() || ito->first < it->first))
-      {
-        // dot only at other
-        if (!c.dotin(ito->first)) // If I dont know, import
-          ds.insert(*ito);
-        ++ito;
-      }
-      else if (it != ds.end() && ito != o.ds.end())
-      {
-        // dot in both
-        // check it payloads are diferent
-        if (it->second != ito->second)
-        {
-          // if payloads are not equal, they must be mergeable
-          // use the more general binary join
-          it->second = ::dtcrdt::join(it->second, ito->second);
-        }
-        ++it;
-        ++ito;
-      }
-    } while (it != ds.end() || ito != o.ds.end());
-    // CC
-    c.join(o.c);
+    dk.join(std::move(o.dk));
   }
 
-  dotkernel<T, K> add(const K &id, const T &val)
+  // Payload only join, for entries of a map
+  void joinstore(const dwflag<K, S> &o)
   {
-    dotkernel<T, K> res;
-    // get new dot
-    std::pair<K, int> dot = c.makedot(id);
-    // add under new dot
-    ds.insert(std::pair<std::pair<K, int>, T>(dot, val));
-    // make delta
-    res.ds.insert(std::pair<std::pair<K, int>, T>(dot, val));
-    res.c.insertdot(dot);
-    return res;
+    dk.joinstore(o.dk);
   }
 
-  // Add that returns the added dot, instead of kernel delta
-  std::pair<K, int> dotadd(const K &id, const T &val)
+  // What a replica with context peer has not seen, see dotkernel
+  dwflag<K, S> delta_since(const dotcontext<K> &peer) const
   {
-    // get new dot
-    std::pair<K, int> dot = c.makedot(id);
-    // add under new dot
-    ds.insert(std::pair<std::pair<K, int>, T>(dot, val));
-    return dot;
+    dwflag<K, S> r;
+    r.dk = dk.delta_since(peer);
+    return r;
   }
 
-  dotkernel<T, K> rmv(const T &val) // remove all dots matching value
+  // Store part of delta_since, for entries of a map
+  bool storesince(const dotcontext<K> &peer, dwflag<K, S> &r, dotcontext<K> &held) const
   {
-    dotkernel<T, K> res;
-    //typename  std::map<std::pair<K,int>,T>::iterator dsit;
-    for (auto dsit = ds.begin(); dsit != ds.end();)
-    {
-      if (dsit->second == val) // match
-      {
-        res.c.insertdot(dsit->first, false); // result knows removed dots
-        ds.erase(dsit++);
-      }
-      else
-        ++dsit;
-    }
-    res.c.compact(); // Maybe several dots there, so atempt compactation
-    return res;
+    return dk.storesince(peer, r.dk, held);
   }
 
-  dotkernel<T, K> rmv(const std::pair<K, int> &dot) // remove a dot
+  void encode(std::string &b, bool ctx = true) const
   {
-    dotkernel<T, K> res;
-    auto dsit = ds.find(dot);
-    if (dsit != ds.end()) // found it
-    {
-      res.c.insertdot(dsit->first, false); // result knows removed dots
-      ds.erase(dsit++);
-    }
-    res.c.compact(); // Atempt compactation
-    return res;
+    dk.encode(b, ctx);
   }
 
-  dotkernel<T, K> rmv() // remove all dots
+  static bool skip(const char *&p, const char *e, bool ctx = true)
   {
-    dotkernel<T, K> res;
-    for (const auto &dv : ds)
-      res.c.insertdot(dv.first, false);
-    res.c.compact();
-    ds.clear(); // Clear the payload, but remember context
-    return res;
+    return dotkernel<bool, K, S>::skip(p, e, ctx);
+  }
+
+  bool decode(const char *&p, const char *e, bool ctx = true)
+  {
+    return dk.decode(p, e, ctx);
+  }
+
+  // Joins straight from an encoded state, false if it is malformed
+  bool join(wireview v)
+  {
+    return dk.join(v);
   }
 };
 
-template <typename V = int, typename K = std::string>
-class gcounter
+// U is timestamp, T is payload
+template <typename U, typename T>
+class rwlwwset // remove wins bias for identical timestamps
 {
 private:
-  std::map<K, V> m;
-  K id;
+  std::map<T, std::pair<U, bool>> s;
+
+  rwlwwset<U, T> addrmv(const U &ts, const T &val, bool b)
+  {
+    rwlwwset<U, T> res;
+    std::pair<U, bool> a(ts, b);
+    res.s.insert(std::pair<T, std::pair<U, bool>>(val, a));
+    std::pair<typename std::map<T, std::pair<U, bool>>::iterator, bool> ret;
+    ret = s.insert(std::pair<T, std::pair<U, bool>>(val, a));
+    if (ret.second == false) // some value there
+    {
+      ret.first->second = lexjoin(ret.first->second, a);
+    }
+    return res;
+  }
 
 public:
-  gcounter() {}            // Only for deltas and those should not be mutated
-  gcounter(K a) : id(a) {} // Mutable replicas need a unique id
+  friend std::ostream &operator<<(std::ostream &output, const rwlwwset<U, T> &o)
+  {
+    output << "RW LWWSet: ( ";
+    for (typename std::map<T, std::pair<U, bool>>::const_iterator it = o.s.begin(); it != o.s.end(); ++it)
+    {
+      if (it->second.second == false)
+        output << it->first << " ";
+    }
+    output << ")" << std::endl;
+    return output;
+  }
 
-  gcounter inc(V tosum = {1}) // argument is optional
+  rwlwwset<U, T> add(const U &ts, const T &val)
   {
-    gcounter<V, K> res;
-    m[id] += tosum;
-    res.m[id] = m[id];
-    return res;
+    return addrmv(ts, val, false);
   }
 
-  bool operator==(const gcounter<V, K> &o) const
+  rwlwwset<U, T> rmv(const U &ts, const T &val)
   {
-    return m == o.m;
+    return addrmv(ts, val, true);
   }
 
-  V local() // get local counter value // CBM make this const
+  bool in(const T &val)
   {
-    V res = 0;
-    res += m[id];
-    return res;
+    typename std::map<T, std::pair<U, bool>>::const_iterator it = s.find(val);
+    if (it == s.end() || it->second.second == true)
+      return false;
+    else
+      return true;
   }
 
-  V read() const // get counter value
+  void join(const rwlwwset<U, T> &o)
   {
-    V res = 0;
-    for (const auto &kv : m) // Fold+ on value list
-      res += kv.second;
-    return res;
+    if (this == &o)
+      return; // Join is idempotent, but just dont do it.
+    // will iterate over the two sorted sets to compute join, entries
+    // only at this are kept
+    auto it = s.begin();
+    for (const auto &okv : o.s)
+    {
+      it = seek(s, it, okv.first, firstof());
+      if (it == s.end() || okv.first < it->first)
+      {
+        // entry only at other
+        // import it
+        s.insert(it, okv);
+      }
+      else
+      {
+        // in both
+        // merge values by lex operator
+        it->second = lexjoin(it->second, okv.second);
+      }
+    }
   }
 
-  void join(const gcounter<V, K> &o)
+  void encode(std::string &b) const
   {
-    for (const auto &okv : o.m)
-      m[okv.first] = std::max(okv.second, m[okv.first]);
+    ::dtcrdt::encode(b, s);
   }
 
-  friend std::ostream &operator<<(std::ostream &output, const gcounter<V, K> &o)
+  bool decode(const char *&p, const char *e)
   {
-    output << "GCounter: ( ";
-    for (const auto &kv : o.m)
-      output << kv.first << "->" << kv.second << " ";
-    output << ")";
-    return output;
+    return ::dtcrdt::decode(p, e, s);
   }
 };
 
-template <typename V = int, typename K = std::string>
-class pncounter
+template <typename U, typename T>
+class lwwreg // U must be comparable
 {
 private:
-  gcounter<V, K> p, n;
+  std::pair<U, T> r;
 
 public:
-  pncounter() {}                 // Only for deltas and those should not be mutated
-  pncounter(K a) : p(a), n(a) {} // Mutable replicas need a unique id
-
-  pncounter inc(V tosum = {1}) // Argument is optional
+  friend std::ostream &operator<<(std::ostream &output, const lwwreg<U, T> &o)
   {
-    pncounter<V, K> res;
-    res.p = p.inc(tosum);
-    return res;
+    output << "LWWReg: " << o.r;
+    return output;
   }
 
-  pncounter dec(V tosum = {1}) // Argument is optional
+  void join(const lwwreg<U, T> &o)
   {
-    pncounter<V, K> res;
-    res.n = n.inc(tosum);
-    return res;
+    if (o.r.first > r.first)
+    {
+      r = o.r;
+    }
   }
 
-  V local() // get local counter value
+  void encode(std::string &b) const
   {
-    V res = p.local() - n.local();
-    return res;
+    ::dtcrdt::encode(b, r);
   }
 
-  V read() const // get counter value
+  bool decode(const char *&p, const char *e)
   {
-    V res = p.read() - n.read();
-    return res;
+    return ::dtcrdt::decode(p, e, r);
   }
 
-  void join(const pncounter &o)
+  lwwreg<U, T> write(const U &ts, const T &val)
   {
-    p.join(o.p);
-    n.join(o.n);
+    lwwreg<U, T> res;
+    res.r.first = ts;
+    res.r.second = val;
+    join(res); // Will only update if ts is greater
+    return res;
   }
 
-  friend std::ostream &operator<<(std::ostream &output, const pncounter<V, K> &o)
+  T read()
   {
-    output << "PNCounter:P:" << o.p << " PNCounter:N:" << o.n;
-    return output;
+    return r.second;
   }
 };
 
-template <typename V = int, typename K = std::string>
-class lexcounter
+template <typename N, typename V, typename K = std::string>
+class ormap
 {
-private:
-  std::map<K, std::pair<int, V>> m;
+  std::map<N, V> m;
+
+  dotcontext<K> cbase;
+  dotcontext<K> &c;
   K id;
 
 public:
-  lexcounter() {}            // Only for deltas and those should not be mutated
-  lexcounter(K a) : id(a) {} // Mutable replicas need a unique id
+  // if no causal context supplied, use base one
+  ormap() : c(cbase) {}
+  ormap(K i) : id(i), c(cbase) {}
+  // if supplied, use a shared causal context
+  ormap(K i, dotcontext<K> &jointc) : id(i), c(jointc) {}
 
-  lexcounter inc(V tosum = 1) // Argument is optional
+  // copies of a standalone map take their own context, and entries must
+  // then be rebound to it, copies of a map in a map keep sharing the context
+  ormap(const ormap<N, V, K> &o) : c(&o.c == &o.cbase ? cbase : o.c), id(o.id)
   {
-    lexcounter<V, K> res;
-
-    //    m[id].first+=1; // optional
-    m[id].second += tosum;
-    res.m[id] = m[id];
-
-    return res;
+    if (&c == &o.c)
+      m = o.m;
+    else
+      copyentries(o);
   }
 
-  lexcounter dec(V tosum = 1) // Argument is optional
+  ormap<N, V, K> &operator=(const ormap<N, V, K> &o)
   {
-    lexcounter<V, K> res;
-
-    m[id].first += 1; // mandatory
-    m[id].second -= tosum;
-    res.m[id] = m[id];
+    if (&o == this)
+      return *this;
+    id = o.id;
+    if (&c != &o.c)
+    {
+      c = dotcontext<K>();
+      copyentries(o);
+    }
+    else
+      m = o.m;
+    return *this;
+  }
 
-    return res;
+private:
+  // Entries are rebuilt against an empty context, so none of them is
+  // obsoleted on the way, and the context is copied last
+  void copyentries(const ormap<N, V, K> &o)
+  {
+    m.clear();
+    for (const auto &kv : o.m)
+      entry(m.end(), kv.first)->second.joinstore(kv.second);
+    c = o.c;
   }
 
-  V read() const // get counter value
+  // Inserts an empty entry for n before hint. It is made with the
+  // allocator of our context, not from whatever arena is in scope, as it
+  // lives as long as the map does.
+  typename std::map<N, V>::iterator entry(typename std::map<N, V>::iterator hint, const N &n)
   {
-    V res = 0;
-    for (const auto &kv : m) // Fold+ on value list
-      res += kv.second.second;
-    return res;
+    arenascope s(c.home());
+    return m.insert(hint, std::pair<N, V>(n, V(id, c)));
   }
 
-  void join(const lexcounter<V, K> &o)
+public:
+
+  dotcontext<K> &context() const
   {
-    for (const auto &okv : o.m)
-      m[okv.first] = lexjoin(okv.second, m[okv.first]);
+    return c;
   }
 
-  friend std::ostream &operator<<(std::ostream &output, const lexcounter<V, K> &o)
+  friend std::ostream &operator<<(std::ostream &output, const ormap<N, V, K> &o)
   {
-    output << "LexCounter: ( ";
+    output << "Map:" << o.c << std::endl;
     for (const auto &kv : o.m)
-      output << kv.first << "->" << kv.second << " ";
-    output << ")";
+      std::cout << kv.first << "->" << kv.second << std::endl;
     return output;
   }
-};
 
-template <typename V, typename K = std::string>
-class ccounter // Causal counter, variation of Riak_dt_emcntr and lexcounter
-{
-private:
-  // To re-use the kernel there is an artificial need for dot-tagged bool payload
-  dotkernel<V, K> dk; // Dot kernel
-  K id;
+  typedef typename std::map<N, V>::iterator iterator;
+  typedef typename std::map<N, V>::const_iterator const_iterator;
 
-public:
-  ccounter() {}            // Only for deltas and those should not be mutated
-  ccounter(K k) : id(k) {} // Mutable replicas need a unique id
-  ccounter(K k, dotcontext<K> &jointc) : id(k), dk(jointc) {}
+  iterator begin() { return m.begin(); }
+  iterator end() { return m.end(); }
+  iterator find(const N &n) { return m.find(n); }
+  const_iterator begin() const { return m.begin(); }
+  const_iterator end() const { return m.end(); }
+  const_iterator find(const N &n) const { return m.find(n); }
 
-  dotcontext<K> &context()
+  // Mutations through this interface yield no map delta, use apply for that
+  V &operator[](const N &n)
   {
-    return dk.c;
+    auto i = m.find(n);
+    if (i == m.end()) // 1st key access
+    {
+      return entry(i, n)->second;
+    }
+    else
+    {
+      return i->second;
+    }
   }
 
-  friend std::ostream &operator<<(std::ostream &output, const ccounter<V, K> &o)
+  // Mutates the entry at n with f, which gets a V& and returns the delta of
+  // the change. The delta is lifted to a map delta holding only that key,
+  // so nested maps compose, e.g. m.apply(k, [&](V &v){ return v.apply(...); })
+  template <typename F>
+  ormap<N, V, K> apply(const N &n, F f)
   {
-    output << "CausalCounter:" << o.dk;
-    return output;
+    ormap<N, V, K> r;
+    r[n].join(f((*this)[n]));
+    return r;
   }
 
-  ccounter<V, K> inc(const V &val = 1)
+  ormap<N, V, K> erase(const N &n)
   {
-    ccounter<V, K> r;
-    std::set<std::pair<K, int>> dots; // dots to remove, should be only 1
-    V base = {};                      // typically 0
-    for (const auto &dsit : dk.ds)
+    ormap<N, V, K> r;
+    if (m.count(n) != 0)
     {
-      if (dsit.first.first == id) // there should be a single one such
-      {
-        base = std::max(base, dsit.second);
-        dots.insert(dsit.first);
-      }
+      // need to collect erased dots, and list then in r context
+      V v;
+      v = m[n].reset();
+      r.c = v.context();
+      // now erase
+      m.erase(n);
     }
-    for (const auto &dot : dots)
-      r.dk.join(dk.rmv(dot));
-    r.dk.join(dk.add(id, base + val));
     return r;
   }
 
-  ccounter<V, K> dec(const V &val = 1)
+  ormap<N, V, K> reset()
   {
-    ccounter<V, K> r;
-    std::set<std::pair<K, int>> dots; // dots to remove, should be only 1
-    V base = {};                      // typically 0
-    for (const auto &dsit : dk.ds)
+    ormap<N, V, K> r;
+    if (!m.empty())
     {
-      if (dsit.first.first == id) // there should be a single one such
+      // need to collect erased dots, and list then in r context
+      for (auto &kv : m)
       {
-        base = std::max(base, dsit.second);
-        dots.insert(dsit.first);
+        V v;
+        v = kv.second.reset();
+        r.c.join(v.context());
       }
+      m.clear();
     }
-    for (const auto &dot : dots)
-      r.dk.join(dk.rmv(dot));
-    r.dk.join(dk.add(id, base - val));
-    return r;
-  }
-
-  ccounter<V, K> reset() // Other nodes might however upgrade their counts
-  {
-    ccounter<V, K> r;
-    r.dk = dk.rmv();
     return r;
   }
 
-  V read()
-  {
-    V v = {}; // Usually 0
-    for (const auto &dse : dk.ds)
-      v += dse.second;
-    return v;
-  }
-
-  void join(ccounter<V, K> o)
-  {
-    dk.join(o.dk);
-  }
-};
-
-template <typename T>
-class gset
-{
-private:
-  std::set<T> s;
-
-public:
-  gset() {}
-  //  gset(std::string id, dotcontext<K> &jointdc) {}
-
-  // For map compliance reply with an empty context
-  //  dotcontext<K> context()
-  //  {
-  //    return dotcontext<K>();
-  //  }
-
-  std::set<T> read() const { return s; }
-
-  bool operator==(const gset<T> &o) const { return s == o.s; }
-
-  bool in(const T &val)
-  {
-    return s.count(val);
-  }
-
-  friend std::ostream &operator<<(std::ostream &output, const gset<T> &o)
-  {
-    output << "GSet: " << o.s;
-    return output;
-  }
-
-  gset<T> add(const T &val)
+  void join(const ormap<N, V, K> &o)
   {
-    gset<T> res;
-    s.insert(val);
-    res.s.insert(val);
-    return res;
+    if (this == &o)
+      return; // Join is idempotent, but just dont do it.
+    joinstore(o);
+    c.join(o.c);
   }
 
-  void join(const gset<T> &o)
+  // Joins many maps. How an entry joins depends on the context it is
+  // joined against, so the inputs are not merged key by key: copies of
+  // them are joined pairwise in rounds, and the result is joined here once.
+  template <typename It>
+  void join_many(It first, It last)
   {
-    s.insert(o.s.begin(), o.s.end());
+    std::vector<ormap<N, V, K>> v;
+    v.reserve(std::distance(first, last));
+    for (; first != last; ++first)
+      if (&*first != this)
+        v.push_back(*first);
+    joinrounds(v);
+    if (!v.empty())
+      join(v.front());
   }
-};
-
-template <typename T, typename K = std::string> // Map embedable datatype
-class twopset
-{
-private:
-  std::set<T> s;
-  std::set<T> t; // removed elements are added to t and removed from s
 
-public:
-  twopset() {}
-  twopset(std::string id, dotcontext<K> &jointdc) {}
-  // For map compliance reply with an empty context
-  dotcontext<K> context()
+  // Same result as join, with the entries joined on up to threads threads.
+  // Keys only at other are inserted first, as the map itself cannot be
+  // shared, and the entries to join are then split in key ranges. The
+  // shared context is only read until it is joined, once, at the end.
+  void join(const ormap<N, V, K> &o, unsigned threads)
   {
-    return dotcontext<K>();
+    if (this == &o)
+      return;
+    bool removes = c.overlaps(o.c); // else entries only here are kept as is
+    std::vector<std::pair<V *, const V *>> work;
+    auto mit = m.begin();
+    auto mito = o.m.begin();
+    while (mit != m.end() || mito != o.m.end())
+    {
+      if (mit != m.end() && (mito == o.m.end() || mit->first < mito->first))
+      {
+        if (removes)
+          work.push_back(std::make_pair(&mit->second, (const V *)nullptr));
+        ++mit;
+      }
+      else
+      {
+        if (mit == m.end() || mito->first < mit->first)
+          work.push_back(std::make_pair(&entry(mit, mito->first)->second, &mito->second));
+        else
+          work.push_back(std::make_pair(&(mit++)->second, &mito->second));
+        ++mito;
+      }
+    }
+    parallelfor(work.size(), threads, 256, [&](size_t i) {
+      if (work[i].second)
+        work[i].first->joinstore(*work[i].second);
+      else
+        work[i].first->joinstore(V(id, o.c));
+    });
+    c.join(o.c);
   }
 
-  std::set<T> read() { return s; }
-
-  bool operator==(const twopset<T> &o) const
+  // Joins the entries only. They share our context, which stays unchanged
+  // while they are joined, so each entry sees the pre join context.
+  void joinstore(const ormap<N, V, K> &o)
   {
-    return s == o.s && t == o.t;
-  }
+    // Entries only here hold dots of our context, so if the other context
+    // has none of them, as with most deltas, only its keys are visited
+    if (!c.overlaps(o.c))
+    {
+      for (const auto &kv : o.m)
+      {
+        auto it = m.lower_bound(kv.first);
+        if (it == m.end() || kv.first < it->first)
+          it = entry(it, kv.first);
+        it->second.joinstore(kv.second);
+      }
+      return;
+    }
+    // join all keys
+    auto mit = m.begin();
+    auto mito = o.m.begin();
+    do
+    {
+      if (mit != m.end() && (mito == o.m.end() || mit->first < mito->first))
+      {
+        // entry only at here
 
-  bool in(const T &val)
-  {
-    return s.count(val);
+        // creaty and empty payload with the other context, since it might
+        // obsolete some local entries.
+        V empty(id, o.context());
+        mit->second.joinstore(empty);
+
+        ++mit;
+      }
+      else if (mito != o.m.end() && (mit == m.end() || mito->first < mit->first))
+      {
+        // entry only at other, inserted just before mit
+        auto ins = entry(mit, mito->first);
+        ins->second.joinstore(mito->second);
+
+        ++mito;
+      }
+      else if (mit != m.end() && mito != o.m.end())
+      {
+        // in both
+        mit->second.joinstore(mito->second);
+
+        ++mit;
+        ++mito;
+      }
+    } while (mit != m.end() || mito != o.m.end());
   }
 
-  friend std::ostream &operator<<(std::ostream &output, const twopset<T> &o)
+  // What a replica whose context is peer has not seen: the entries with
+  // dots it does not know, under this context less the dots of entries it
+  // already has, so that it also drops what was erased or reset here
+  ormap<N, V, K> delta_since(const dotcontext<K> &peer) const
   {
-    output << "2PSet: S" << o.s << " T " << o.t;
-    return output;
+    ormap<N, V, K> r;
+    dotcontext<K> held;
+    storesince(peer, r, held);
+    r.c = c.minus(held);
+    return r;
   }
 
-  twopset<T> add(const T &val)
+  // Store part of delta_since, for maps in a map
+  bool storesince(const dotcontext<K> &peer, ormap<N, V, K> &r, dotcontext<K> &held) const
   {
-    twopset<T> res;
-    if (t.count(val) == 0) // only add if not in tombstone set
+    bool any = false;
+    for (const auto &kv : m)
     {
-      s.insert(val);
-      res.s.insert(val);
+      auto it = r.entry(r.m.end(), kv.first);
+      if (kv.second.storesince(peer, it->second, held))
+        any = true;
+      else
+        r.m.erase(it);
     }
-    return res;
+    return any;
   }
 
-  twopset<T> rmv(const T &val)
+  // The context is sent once, entries carry only their payloads
+  void encode(std::string &b, bool ctx = true) const
   {
-    twopset<T> res;
-    s.erase(val);
-    t.insert(val); // add to tombstones
-    res.t.insert(val);
-    return res;
+    if (ctx)
+      c.encode(b);
+    putvarint(b, m.size());
+    for (const auto &kv : m)
+    {
+      ::dtcrdt::encode(b, kv.first);
+      kv.second.encode(b, false);
+    }
   }
 
-  twopset<T> reset()
+  bool decode(const char *&p, const char *e, bool ctx = true)
   {
-    twopset<T> res;
-    for (auto const &val : s)
+    uint64_t n;
+    if (ctx && !c.decode(p, e))
+      return false;
+    m.clear();
+    if (!getcount(p, e, n))
+      return false;
+    for (uint64_t i = 0; i < n; i++)
     {
-      t.insert(val);
-      res.t.insert(val);
+      N key;
+      if (!::dtcrdt::decode(p, e, key) || !(*this)[key].decode(p, e, false))
+        return false;
     }
-    s.clear();
-    return res;
+    return true;
   }
 
-  void join(const twopset<T> &o)
+  // Joins straight from an encoded map, false if it is malformed. The
+  // context is read first, then each entry is decoded on its own, under
+  // it, and joined in a walk of the keys here, as joinstore does.
+  bool join(wireview v)
   {
-    for (const auto &ot : o.t) // see other tombstones
+    ormap<N, V, K> o; // Holds the other context only
+    if (!o.c.decode(v.p, v.e))
+      return false;
+    // Check the entries before touching this map. They are skipped, and
+    // decoded only once, when joined.
+    const char *p = v.p;
+    uint64_t n;
+    bool sorted = true;
+    N key, prev;
+    V scratch(id, o.c); // For entries that cannot skip themselves
+    if (!getcount(p, v.e, n))
+      return false;
+    for (uint64_t i = 0; i < n; i++)
     {
-      t.insert(ot);         // insert them locally
-      if (s.count(ot) == 1) // remove val if present
-        s.erase(ot);
+      if (!::dtcrdt::decode(p, v.e, key) || !skipstate(p, v.e, scratch, false))
+        return false;
+      if (i > 0 && !(prev < key))
+        sorted = false;
+      prev = key;
     }
-    for (const auto &os : o.s) // add other vals, if not tombstone
+    p = v.p;
+    getcount(p, v.e, n);
+    if (!sorted) // the sender orders keys differently, e.g. interned ids
+    {
+      o.decode(p, v.e, false);
+      join(o);
+      return true;
+    }
+    bool removes = c.overlaps(o.c); // else entries only here are kept as is
+    const V none(id, o.c);
+    auto mit = m.begin();
+    for (uint64_t i = 0; i < n; i++)
     {
-      if (t.count(os) == 0)
-        s.insert(os);
+      ::dtcrdt::decode(p, v.e, key);
+      scratch.decode(p, v.e, false);
+      for (; mit != m.end() && mit->first < key; ++mit)
+        if (removes)
+          mit->second.joinstore(none);
+      if (mit == m.end() || key < mit->first)
+        mit = entry(mit, key);
+      (mit++)->second.joinstore(std::move(scratch)); // decode refills it
     }
+    for (; removes && mit != m.end(); ++mit)
+      mit->second.joinstore(none);
+    c.join(o.c);
+    return true;
+  }
+
+  // Skips an encoded map, checking it as decode does
+  static bool skip(const char *&p, const char *e, bool ctx = true)
+  {
+    dotcontext<K> oc;
+    uint64_t n;
+    if ((ctx && !oc.decode(p, e)) || !getcount(p, e, n))
+      return false;
+    V scratch(K(), oc);
+    for (uint64_t i = 0; i < n; i++)
+      if (!::dtcrdt::skip(p, e, (const N *)nullptr) || !skipstate(p, e, scratch, false))
+        return false;
+    return true;
   }
 };
 
-template <typename E, typename K = std::string> // Map embedable datatype
-class aworset                                   // Add-Wins Observed-Remove Set
+// ORMap split by key hash into shards, each with its own lock, so threads
+// on different shards run in parallel. Each shard is a replica of its own,
+// under one of the given ids, and joins every remote context, since those
+// can remove entries of keys the delta does not name. Remote joins and
+// state() take all shard locks. Deltas in and out are plain ormaps, so
+// peers need not be sharded.
+template <typename N, typename V, typename K = std::string, typename H = std::hash<N>>
+class shardmap
 {
-private:
-  dotkernel<E, K> dk; // Dot kernel
-  K id;
+  struct shard
+  {
+    std::mutex mtx;
+    ormap<N, V, K> m;
 
-public:
-  aworset() {}            // Only for deltas and those should not be mutated
-  aworset(K k) : id(k) {} // Mutable replicas need a unique id
-  aworset(K k, dotcontext<K> &jointc) : id(k), dk(jointc) {}
+    shard(const K &id) : m(id) {}
+  };
 
-  dotcontext<K> &context()
-  {
-    return dk.c;
-  }
+  std::vector<std::unique_ptr<shard>> shards;
+  H hash;
+
+  shardmap(const shardmap<N, V, K, H> &) = delete;
+  shardmap<N, V, K, H> &operator=(const shardmap<N, V, K, H> &) = delete;
 
-  friend std::ostream &operator<<(std::ostream &output, const aworset<E, K> &o)
+public:
+  shardmap(const std::vector<K> &ids)
   {
-    output << "AWORSet:" << o.dk;
-    return output;
+    assert(!ids.empty());
+    for (const auto &id : ids)
+      shards.emplace_back(new shard(id));
   }
 
-  std::set<E> read()
+  size_t size() const { return shards.size(); }
+
+  size_t shardof(const N &n) const { return hash(n) % shards.size(); }
+
+  // Mutates the entry at n as ormap::apply does, returning the map delta
+  template <typename F>
+  ormap<N, V, K> apply(const N &n, F f)
   {
-    std::set<E> res;
-    for (const auto &dv : dk.ds)
-      res.insert(dv.second);
-    return res;
+    shard &s = *shards[shardof(n)];
+    std::lock_guard<std::mutex> lock(s.mtx);
+    return s.m.apply(n, f);
   }
 
-  bool in(const E &val)
+  ormap<N, V, K> erase(const N &n)
   {
-    typename std::map<std::pair<K, int>, E>::iterator dsit;
-    for (dsit = dk.ds.begin(); dsit != dk.ds.end(); ++dsit)
-    {
-      if (dsit->second == val)
-        return true;
-    }
-    return false;
+    shard &s = *shards[shardof(n)];
+    std::lock_guard<std::mutex> lock(s.mtx);
+    return s.m.erase(n);
   }
 
-  aworset<E, K> add(const E &val)
+  // Calls f on the entry at n under its shard lock, false if there is none
+  template <typename F>
+  bool find(const N &n, F f)
   {
-    aworset<E, K> r;
-    r.dk = dk.rmv(val); // optimization that first deletes val
-    r.dk.join(dk.add(id, val));
-    return r;
+    shard &s = *shards[shardof(n)];
+    std::lock_guard<std::mutex> lock(s.mtx);
+    auto it = s.m.find(n);
+    if (it == s.m.end())
+      return false;
+    f(it->second);
+    return true;
   }
 
-  aworset<E, K> rmv(const E &val)
+  void join(const ormap<N, V, K> &o)
   {
-    aworset<E, K> r;
-    r.dk = dk.rmv(val);
-    return r;
+    std::vector<std::unique_ptr<ormap<N, V, K>>> parts(shards.size());
+    for (const auto &kv : o)
+    {
+      auto &p = parts[shardof(kv.first)];
+      if (!p)
+        p.reset(new ormap<N, V, K>());
+      (*p)[kv.first].joinstore(kv.second);
+    }
+    for (auto &p : parts)
+      if (p)
+        p->context() = o.context(); // after the entries, or they drop all dots
+    // The remote context reaches every shard, so the delta lands in all of
+    // them at once, or a snapshot could see its dots without its entries
+    auto locks = lockall();
+    for (size_t i = 0; i < shards.size(); i++)
+    {
+      ormap<N, V, K> &m = shards[i]->m;
+      if (parts[i])
+        m.join(*parts[i]);
+      else if (m.context().overlaps(o.context()))
+      {
+        ormap<N, V, K> none; // removals only
+        none.context() = o.context();
+        m.join(none);
+      }
+      else // nothing to remove here
+        m.context().join(o.context());
+    }
   }
 
-  aworset<E, K> reset()
+  // The whole state, for shipping to a peer. Shards know of dots held by
+  // other shards, so they are not joined, their entries are gathered under
+  // the join of their contexts. All shards are read under their locks at
+  // once, so no join lands in some of them only.
+  ormap<N, V, K> state()
   {
-    aworset<E, K> r;
-    r.dk = dk.rmv();
+    ormap<N, V, K> r;
+    dotcontext<K> c;
+    auto locks = lockall();
+    for (auto &s : shards)
+    {
+      for (const auto &kv : s->m)
+        r[kv.first].joinstore(kv.second);
+      c.join(s->m.context());
+    }
+    r.context() = c;
     return r;
   }
 
-  void join(aworset<E, K> o)
+private:
+  // Locks of all shards, taken in index order so that callers never deadlock
+  std::vector<std::unique_lock<std::mutex>> lockall()
   {
-    dk.join(o.dk);
-    // Further optimization can be done by keeping for val x and id A
-    // only the highest dot from A supporting x.
+    std::vector<std::unique_lock<std::mutex>> locks;
+    locks.reserve(shards.size());
+    for (auto &s : shards)
+      locks.emplace_back(s->mtx);
+    return locks;
   }
 };
 
-template <typename E, typename K = std::string> // Map embedable datatype
-class rworset                                   // Remove-Wins Observed-Remove Set
+// A bag is similar to an RWSet, but allows for CRDT payloads
+template <typename V, typename K = std::string, typename S = mapstore, typename X = noindex>
+class bag
 {
 private:
-  dotkernel<std::pair<E, bool>, K> dk; // Dot kernel
+  dotkernel<V, K, S, X> dk; // Dot kernel
   K id;
+  std::pair<K, int> own; // Our newest dot, when known
+  bool hasown;           // Cleared by whatever may bring or drop dots
 
-public:
-  rworset() {}            // Only for deltas and those should not be mutated
-  rworset(K k) : id(k) {} // Mutable replicas need a unique id
-  rworset(K k, dotcontext<K> &jointc) : id(k), dk(jointc) {}
-
-  dotcontext<K> &context()
-  {
-    return dk.c;
-  }
-
-  friend std::ostream &operator<<(std::ostream &output, const rworset<E, K> &o)
-  {
-    output << "RWORSet:" << o.dk;
-    return output;
-  }
-
-  std::set<E> read()
+  typename dotkernel<V, K, S, X>::dotstore::iterator mine()
   {
-    std::set<E> res;
-    std::map<E, bool> elems;
-    typename std::map<std::pair<K, int>, std::pair<E, bool>>::iterator dsit;
-    std::pair<typename std::map<E, bool>::iterator, bool> ret;
-    for (dsit = dk.ds.begin(); dsit != dk.ds.end(); ++dsit)
+    if (hasown)
     {
-      ret = elems.insert(std::pair<E, bool>(dsit->second));
-      if (ret.second == false) // val already exists
+      auto it = dk.ds.find(own);
+      if (it != dk.ds.end())
+        return it;
+    }
+    auto me = dk.ds.end();
+    for (auto it = dk.ds.begin(); it != dk.ds.end(); ++it)
+    {
+      if (it->first.first == id) // a candidate
       {
-        elems.at(ret.first->first) &= dsit->second.second; // Fold by &&
+        if (me == dk.ds.end()) // pick at least one valid
+          me = it;
+        else // need to switch if more recent
+        {
+          if (it->first.second > me->first.second)
+            me = it;
+        }
       }
     }
-    typename std::map<E, bool>::iterator mit;
-    for (mit = elems.begin(); mit != elems.end(); ++mit)
+    if (me == dk.ds.end())
     {
-      if (mit->second == true)
-        res.insert(mit->first);
+      fresh();
+      return dk.ds.find(own); // After a fresh it must be found
     }
-    return res;
-  }
-
-  bool in(const E &val) // Could
-  {
-    // Code could be slightly faster if re-using only part of read code
-    std::set<E> s = read();
-    if (s.find(val) != s.end())
-      return true;
-    return false;
+    own = me->first;
+    hasown = true;
+    return me;
   }
 
-  rworset<E, K> add(const E &val)
-  {
-    rworset<E, K> r;
-    r.dk = dk.rmv(std::pair<E, bool>(val, true));      // Remove any observed add token
-    r.dk.join(dk.rmv(std::pair<E, bool>(val, false))); // Remove any observed remove token
-    r.dk.join(dk.add(id, std::pair<E, bool>(val, true)));
-    return r;
-  }
+public:
+  bag() : hasown(false) {}            // Only for deltas and those should not be mutated
+  bag(K k) : id(k), hasown(false) {} // Mutable replicas need a unique id
+  bag(K k, dotcontext<K> &jointc) : id(k), dk(jointc), hasown(false) {}
 
-  rworset<E, K> rmv(const E &val)
+  bag<V, K, S, X> &operator=(const bag<V, K, S, X> &o)
   {
-    rworset<E, K> r;
-    r.dk = dk.rmv(std::pair<E, bool>(val, true));      // Remove any observed add token
-    r.dk.join(dk.rmv(std::pair<E, bool>(val, false))); // Remove any observed remove token
-    r.dk.join(dk.add(id, std::pair<E, bool>(val, false)));
-    return r;
+    if (&o == this)
+      return *this;
+    if (&dk != &o.dk)
+      dk = o.dk;
+    id = o.id;
+    own = o.own;
+    hasown = o.hasown;
+    return *this;
   }
 
-  rworset<E, K> reset()
+  dotcontext<K> &context()
   {
-    rworset<E, K> r;
-    r.dk = dk.rmv();
-    return r;
+    return dk.c;
   }
 
-  void join(rworset<E, K> o)
+  void insert(std::pair<std::pair<K, int>, V> t)
   {
-    dk.join(o.dk);
+    if (dk.ds.insert(std::pair<std::pair<K, int>, V>(t)).second)
+      dk.idx.insert(t.second, t.first);
+    dk.c.insertdot(t.first);
+    hasown = false;
   }
-};
-
-template <typename V, typename K = std::string>
-class mvreg // Multi-value register, Optimized
-{
-private:
-  dotkernel<V, K> dk; // Dot kernel
-  K id;
-
-public:
-  mvreg() {}            // Only for deltas and those should not be mutated
-  mvreg(K k) : id(k) {} // Mutable replicas need a unique id
-  mvreg(K k, dotcontext<K> &jointc) : id(k), dk(jointc) {}
 
-  dotcontext<K> &context()
+  friend std::ostream &operator<<(std::ostream &output, const bag<V, K, S, X> &o)
   {
-    return dk.c;
+    output << "Bag:" << o.dk;
+    return output;
   }
 
-  friend std::ostream &operator<<(std::ostream &output, const mvreg<V, K> &o)
+  typename dotkernel<V, K, S, X>::dotstore::iterator begin()
   {
-    output << "MVReg:" << o.dk;
-    return output;
+    return dk.ds.begin();
   }
 
-  mvreg<V, K> write(const V &val)
+  typename dotkernel<V, K, S, X>::dotstore::iterator end()
   {
-    mvreg<V, K> r, a;
-    r.dk = dk.rmv();
-    a.dk = dk.add(id, val);
-    r.join(a);
-    return r;
+    return dk.ds.end();
   }
 
-  std::set<V> read()
+  // Our newest dot, found in O(log n) unless joins or resets changed it
+  std::pair<K, int> mydot()
   {
-    std::set<V> s;
-    for (const auto &dse : dk.ds)
-      s.insert(dse.second);
-    return s;
+    return mine()->first;
   }
 
-  mvreg<V, K> reset()
+  V &mydata()
   {
-    mvreg<V, K> r;
-    r.dk = dk.rmv();
-    return r;
+    return mine()->second;
   }
 
-  mvreg<V, K> resolve()
+  // Replaces our own payload. Writing through mydata or the iterators
+  // bypasses the kernel index, so use this when one is kept.
+  std::pair<K, int> update(const V &v)
   {
-    mvreg<V, K> r, v;
-    std::set<V> s;                // collect all values that are not maximals
-    for (const auto &dsa : dk.ds) // Naif quadratic comparison
-      for (const auto &dsb : dk.ds)
-        if (dsa.second != dsb.second &&
-            ::dtcrdt::join(dsa.second, dsb.second) == dsb.second) // < based on join
-                                                                  // if (dsa.second < dsb.second) // values must implement operator<
-          s.insert(dsa.second);
-    // remove all non maximals and register deltas for those removals
-    for (const auto &val : s)
-    {
-      v.dk = dk.rmv(val);
-      r.join(v);
-    }
-    return r;
+    auto dot = mydot();
+    dk.update(dot, v);
+    return dot;
   }
 
-  void join(mvreg<V, K> o)
+  const typename dotkernel<V, K, S, X>::dotindex &index() const
   {
-    dk.join(o.dk);
+    return dk.idx;
   }
-};
-
-template <typename K = std::string>
-class ewflag // Enable-Wins Flag
-{
-private:
-  // To re-use the kernel there is an artificial need for dot-tagged bool payload
-  dotkernel<bool, K> dk; // Dot kernel
-  K id;
 
-public:
-  ewflag() {}            // Only for deltas and those should not be mutated
-  ewflag(K k) : id(k) {} // Mutable replicas need a unique id
-  ewflag(K k, dotcontext<K> &jointc) : id(k), dk(jointc) {}
+  // To protect from concurrent removes, create fresh dot for self
+  void fresh()
+  {
+    own = dk.dotadd(id, V());
+    hasown = true;
+  }
 
-  dotcontext<K> &context()
+  bag<V, K, S, X> reset()
   {
-    return dk.c;
+    bag<V, K, S, X> r;
+    r.dk = dk.rmv();
+    hasown = false;
+    return r;
   }
 
-  friend std::ostream &operator<<(std::ostream &output, const ewflag<K> &o)
+  // Using the deep join will try to join different payloads under same dot
+  void join(const bag<V, K, S, X> &o)
   {
-    output << "EWFlag:" << o.dk;
-    return output;
+    dk.deepjoin(o.dk);
+    hasown = false;
   }
 
-  bool read()
+  // Payload only join, for entries of a map
+  void joinstore(const bag<V, K, S, X> &o)
   {
-    typename std::map<std::pair<K, int>, bool>::iterator dsit;
-    if (dk.ds.begin() == dk.ds.end())
-      // No active dots
-      return false;
-    else
-      // Some dots
-      return true;
+    dk.deepjoinstore(o.dk);
+    hasown = false;
   }
 
-  ewflag<K> enable()
+  // What a replica with context peer has not seen, see dotkernel. As
+  // update rewrites payloads in place, the newest entry of each replica is
+  // sent even when peer knows its dot.
+  bag<V, K, S, X> delta_since(const dotcontext<K> &peer) const
   {
-    ewflag<K> r;
-    r.dk = dk.rmv(true); // optimization that first deletes active dots
-    r.dk.join(dk.add(id, true));
+    bag<V, K, S, X> r;
+    r.dk = dk.delta_since(peer, true);
     return r;
   }
 
-  ewflag<K> disable()
+  // Store part of delta_since, for entries of a map
+  bool storesince(const dotcontext<K> &peer, bag<V, K, S, X> &r, dotcontext<K> &held) const
   {
-    ewflag<K> r;
-    r.dk = dk.rmv(true);
-    return r;
+    return dk.storesince(peer, r.dk, held, true);
   }
 
-  ewflag<K> reset()
+  void encode(std::string &b, bool ctx = true) const
   {
-    ewflag<K> r;
-    r.dk = dk.rmv();
-    return r;
+    dk.encode(b, ctx);
   }
 
-  void join(ewflag<K> o)
+  static bool skip(const char *&p, const char *e, bool ctx = true)
   {
-    dk.join(o.dk);
+    return dotkernel<V, K, S, X>::skip(p, e, ctx);
+  }
+
+  bool decode(const char *&p, const char *e, bool ctx = true)
+  {
+    hasown = false;
+    return dk.decode(p, e, ctx);
+  }
+
+  // Deep joins straight from an encoded state, false if it is malformed
+  bool join(wireview v)
+  {
+    hasown = false;
+    return dk.deepjoin(v);
   }
 };
 
-template <typename K = std::string>
-class dwflag // Disable-Wins Flag
+// Inspired by designs from Carl Lerche and Paulo S. Almeida
+template <typename V, typename K = std::string, typename S = mapstore, typename C = uncached>
+class rwcounter //  Reset Wins Counter
 {
 private:
-  // To re-use the kernel there is an artificial need for dot-tagged bool payload
-  dotkernel<bool, K> dk; // Dot kernel
+  bag<std::pair<V, V>, K, S, typename C::sumpolicy> b; // Bag of pairs
   K id;
 
 public:
-  dwflag() {}            // Only for deltas and those should not be mutated
-  dwflag(K k) : id(k) {} // Mutable replicas need a unique id
-  dwflag(K k, dotcontext<K> &jointc) : id(k), dk(jointc) {}
+  rwcounter() {}                  // Only for deltas and those should not be mutated
+  rwcounter(K k) : id(k), b(k) {} // Mutable replicas need a unique id
+  rwcounter(K k, dotcontext<K> &jointc) : id(k), b(k, jointc) {}
 
-  dotcontext<K> &context()
+  rwcounter<V, K, S, C> &operator=(const rwcounter<V, K, S, C> &o)
   {
-    return dk.c;
+    if (&o == this)
+      return *this;
+    if (&b != &o.b)
+      b = o.b;
+    id = o.id;
+    return *this;
   }
 
-  friend std::ostream &operator<<(std::ostream &output, const dwflag<K> &o)
+  dotcontext<K> &context()
   {
-    output << "DWFlag:" << o.dk;
-    return output;
+    return b.context();
   }
 
-  bool read()
+  friend std::ostream &operator<<(std::ostream &output, const rwcounter<V, K, S, C> &o)
   {
-    typename std::map<std::pair<K, int>, bool>::iterator dsit;
-    if (dk.ds.begin() == dk.ds.end())
-      // No active dots
-      return true;
-    else
-      // Some dots
-      return false;
+    output << "ResetWinsCounter:" << o.b;
+    return output;
   }
 
-  dwflag<K> disable()
+  rwcounter<V, K, S, C> inc(const V &val = 1)
   {
-    dwflag<K> r;
-    r.dk = dk.rmv(false); // optimization that first deletes active dots
-    r.dk.join(dk.add(id, false));
+    rwcounter<V, K, S, C> r;
+    std::pair<V, V> d = b.mydata();
+    d.first += val;
+    r.b.insert(std::pair<std::pair<K, int>, std::pair<V, V>>(b.update(d), d));
     return r;
   }
 
-  dwflag<K> enable()
+  rwcounter<V, K, S, C> dec(const V &val = 1)
   {
-    dwflag<K> r;
-    r.dk = dk.rmv(false);
+    rwcounter<V, K, S, C> r;
+    std::pair<V, V> d = b.mydata();
+    d.second += val;
+    r.b.insert(std::pair<std::pair<K, int>, std::pair<V, V>>(b.update(d), d));
     return r;
   }
 
-  dwflag<K> reset()
+  rwcounter<V, K, S, C> reset()
   {
-    dwflag<K> r;
-    r.dk = dk.rmv();
+    rwcounter<V, K, S, C> r;
+    r.b = b.reset();
     return r;
   }
 
-  void join(dwflag<K> o)
+  void fresh()
   {
-    dk.join(o.dk);
+    b.fresh();
   }
-};
-
-// U is timestamp, T is payload
-template <typename U, typename T>
-class rwlwwset // remove wins bias for identical timestamps
-{
-private:
-  std::map<T, std::pair<U, bool>> s;
 
-  rwlwwset<U, T> addrmv(const U &ts, const T &val, bool b)
+  V read()
   {
-    rwlwwset<U, T> res;
-    std::pair<U, bool> a(ts, b);
-    res.s.insert(std::pair<T, std::pair<U, bool>>(val, a));
-    std::pair<typename std::map<T, std::pair<U, bool>>::iterator, bool> ret;
-    ret = s.insert(std::pair<T, std::pair<U, bool>>(val, a));
-    if (ret.second == false) // some value there
-    {
-      s.at(ret.first->first) = lexjoin(ret.first->second, a);
-    }
-    return res;
+    return read(std::integral_constant<bool, C::on>());
   }
 
-public:
-  friend std::ostream &operator<<(std::ostream &output, const rwlwwset<U, T> &o)
+  void join(const rwcounter<V, K, S, C> &o)
   {
-    output << "RW LWWSet: ( ";
-    for (typename std::map<T, std::pair<U, bool>>::const_iterator it = o.s.begin(); it != o.s.end(); ++it)
-    {
-      if (it->second.second == false)
-        output << it->first << " ";
-    }
-    output << ")" << std::endl;
-    return output;
+    b.join(o.b);
   }
 
-  rwlwwset<U, T> add(const U &ts, const T &val)
+  // Payload only join, for entries of a map
+  void joinstore(const rwcounter<V, K, S, C> &o)
   {
-    return addrmv(ts, val, false);
+    b.joinstore(o.b);
   }
 
-  rwlwwset<U, T> rmv(const U &ts, const T &val)
+  // What a replica with context peer has not seen, see dotkernel
+  rwcounter<V, K, S, C> delta_since(const dotcontext<K> &peer) const
   {
-    return addrmv(ts, val, true);
+    rwcounter<V, K, S, C> r;
+    r.b = b.delta_since(peer);
+    return r;
   }
 
-  bool in(const T &val)
+  // Store part of delta_since, for entries of a map
+  bool storesince(const dotcontext<K> &peer, rwcounter<V, K, S, C> &r, dotcontext<K> &held) const
   {
-    typename std::map<T, std::pair<U, bool>>::const_iterator it = s.find(val);
-    if (it == s.end() || it->second.second == true)
-      return false;
-    else
-      return true;
+    return b.storesince(peer, r.b, held);
   }
 
-  void join(const rwlwwset<U, T> &o)
+  void encode(std::string &out, bool ctx = true) const
   {
-    if (this == &o)
-      return; // Join is idempotent, but just dont do it.
-    // will iterate over the two sorted sets to compute join
-    typename std::map<T, std::pair<U, bool>>::iterator it;
-    typename std::map<T, std::pair<U, bool>>::const_iterator ito;
-    it = s.begin();
-    ito = o.s.begin();
-    do
-    {
-      if (it != s.end() && (ito == o.s.end() || it->first < ito->first))
-      {
-        // entry only at this
-        // keep it
-        ++it;
-      }
-      else if (ito != o.s.end() && (it == s.end() || ito->first < it->first))
-      {
-        // entry only at other
-        // import it
-        s.insert(*ito);
-        ++ito;
-      }
-      else if (it != s.end() && ito != o.s.end())
-      {
-        // in both
-        // merge values by lex operator
-        s.at(it->first) = lexjoin(it->second, ito->second);
-        ++it;
-        ++ito;
-      }
-    } while (it != s.end() || ito != o.s.end());
+    b.encode(out, ctx);
   }
-};
 
-template <typename U, typename T>
-class lwwreg // U must be comparable
-{
-private:
-  std::pair<U, T> r;
+  static bool skip(const char *&p, const char *e, bool ctx = true)
+  {
+    return bag<std::pair<V, V>, K, S, typename C::sumpolicy>::skip(p, e, ctx);
+  }
 
-public:
-  friend std::ostream &operator<<(std::ostream &output, const lwwreg<U, T> &o)
+  bool decode(const char *&p, const char *e, bool ctx = true)
   {
-    output << "LWWReg: " << o.r;
-    return output;
+    return b.decode(p, e, ctx);
   }
 
-  void join(const lwwreg<U, T> &o)
+  // Joins straight from an encoded state, false if it is malformed
+  bool join(wireview v)
   {
-    if (o.r.first > r.first)
-    {
-      r = o.r;
-    }
+    return b.join(v);
   }
 
-  lwwreg<U, T> write(const U &ts, const T &val)
+private:
+  V read(std::true_type)
   {
-    lwwreg<U, T> res;
-    res.r.first = ts;
-    res.r.second = val;
-    join(res); // Will only update if ts is greater
-    return res;
+    return b.index().sum().first - b.index().sum().second;
   }
 
-  T read()
+  V read(std::false_type)
   {
-    return r.second;
+    std::pair<V, V> ac;
+    for (const auto &dv : b)
+    {
+      ac.first += dv.second.first;
+      ac.second += dv.second.second;
+    }
+    return ac.first - ac.second;
   }
 };
 
-template <typename N, typename V, typename K = std::string>
-class ormap
+template <typename N, typename V>
+class gmap
 {
-  std::map<N, V> m;
-
-  dotcontext<K> cbase;
-  dotcontext<K> &c;
-  K id;
 
 public:
-  // if no causal context supplied, use base one
-  ormap() : c(cbase) {}
-  ormap(K i) : id(i), c(cbase) {}
-  // if supplied, use a shared causal context
-  ormap(K i, dotcontext<K> &jointc) : id(i), c(jointc) {}
-
-  //  ormap( const ormap<N,V,K>& o ) :  id(o.id), m(o.m), c(o.c) {}
-
-  ormap<N, V, K> &operator=(const ormap<N, V, K> &o)
-  {
-    if (&o == this)
-      return *this;
-    if (&c != &o.c)
-      c = o.c;
-    m = o.m;
-    id = o.id;
-    return *this;
-  }
-
-  dotcontext<K> &context() const
-  {
-    return c;
-  }
+  // later make m private by adding a begin() for iterators
+  std::map<N, V> m;
 
-  friend std::ostream &operator<<(std::ostream &output, const ormap<N, V, K> &o)
+  friend std::ostream &operator<<(std::ostream &output, const gmap<N, V> &o)
   {
-    output << "Map:" << o.c << std::endl;
+    output << "GMap:" << std::endl;
     for (const auto &kv : o.m)
       std::cout << kv.first << "->" << kv.second << std::endl;
     return output;
   }
 
-  // Need to find a way to collect deltas for this interface
+  // Need to find a better way to collect deltas for this interface
   V &operator[](const N &n)
   {
     auto i = m.find(n);
     if (i == m.end()) // 1st key access
     {
-      auto ins = m.insert(i, std::pair<N, V>(n, V(id, c)));
+      auto ins = m.insert(i, std::pair<N, V>(n, V()));
       return ins->second;
     }
     else
@@ -1418,455 +5497,802 @@ public:
     }
   }
 
-  ormap<N, V, K> erase(const N &n)
+  void join(const gmap<N, V> &o)
   {
-    ormap<N, V, K> r;
-    if (m.count(n) != 0)
+    // join all keys, entries only at here are kept
+    auto mit = m.begin();
+    for (const auto &kv : o.m)
     {
-      // need to collect erased dots, and list then in r context
-      V v;
-      v = m[n].reset();
-      r.c = v.context();
-      // now erase
-      m.erase(n);
+      mit = seek(m, mit, kv.first, firstof());
+      if (mit == m.end() || kv.first < mit->first)
+        m.insert(mit, kv); // entry only at other
+      else
+        join_into(mit->second, kv.second); // in both
     }
-    return r;
   }
 
-  ormap<N, V, K> reset()
+  // Joins many maps, visiting each key once with all the entries for it
+  template <typename It>
+  void join_many(It first, It last)
   {
-    ormap<N, V, K> r;
-    if (!m.empty())
+    typedef typename std::map<N, V>::const_iterator iter;
+    std::vector<std::pair<iter, iter>> rs;
+    for (; first != last; ++first)
+      if (&*first != this)
+        rs.push_back(std::make_pair(first->m.begin(), first->m.end()));
+    auto mit = m.begin();
+    for (kwaymerge<iter, firstof> w(rs); !w.done(); w.next())
     {
-      // need to collect erased dots, and list then in r context
-      for (auto &kv : m)
-      {
-        V v;
-        v = kv.second.reset();
-        r.c.join(v.context());
-      }
-      m.clear();
+      const auto &g = w.group();
+      mit = seek(m, mit, g.front()->first, firstof());
+      size_t i = 0;
+      if (mit == m.end() || g.front()->first < mit->first)
+        mit = m.insert(mit, *g[i++]);
+      for (; i < g.size(); i++)
+        join_into(mit->second, g[i]->second);
     }
-    return r;
   }
 
-  void join(const ormap<N, V> &o)
+  // Same result as join, with the entries joined on up to threads threads
+  // once the keys only at other are inserted
+  void join(const gmap<N, V> &o, unsigned threads)
   {
-    const dotcontext<K> ic = c; // need access to an immutable context
-
-    // join all keys
+    if (this == &o)
+      return;
+    std::vector<std::pair<V *, const V *>> work;
+    std::vector<bool> fresh;
     auto mit = m.begin();
-    auto mito = o.m.begin();
-    do
+    for (const auto &kv : o.m)
     {
-      // ---- debug
-      /*
-      std::cout << "key left ";
-      if (mit != m.end()) 
-        std::cout << mit->first;
+      while (mit != m.end() && mit->first < kv.first)
+        ++mit;
+      bool in = mit != m.end() && !(kv.first < mit->first);
+      if (in)
+        work.push_back(std::make_pair(&(mit++)->second, &kv.second));
       else
-        std::cout << "[empty]";
-      std::cout << ", key rigth ";
-      if (mito != o.m.end()) 
-        std::cout << mito->first;
+        work.push_back(std::make_pair(&m.insert(mit, std::pair<N, V>(kv.first, V()))->second, &kv.second));
+      fresh.push_back(!in);
+    }
+    parallelfor(work.size(), threads, 256, [&](size_t i) {
+      if (fresh[i])
+        *work[i].first = *work[i].second;
       else
-        std::cout << "[empty]";
-      std::cout << std::endl;
-      */
-      if (mit != m.end() && (mito == o.m.end() || mit->first < mito->first))
-      {
-        //std::cout << "entry left\n";
-        // entry only at here
-
-        // creaty and empty payload with the other context, since it might
-        // obsolete some local entries.
-        V empty(id, o.context());
-        mit->second.join(empty);
-        c = ic;
-
-        ++mit;
-      }
-      else if (mito != o.m.end() && (mit == m.end() || mito->first < mit->first))
-      {
-        // std::cout << "entry right\n";
-        // entry only at other
-
-        (*this)[mito->first].join(mito->second);
-        c = ic;
+        join_into(*work[i].first, *work[i].second);
+    });
+  }
 
-        ++mito;
-      }
-      else if (mit != m.end() && mito != o.m.end())
-      {
-        // std::cout << "entry both\n";
-        // in both
-        (*this)[mito->first].join(mito->second);
-        c = ic;
+  void encode(std::string &b) const
+  {
+    ::dtcrdt::encode(b, m);
+  }
 
-        ++mit;
-        ++mito;
-      }
-    } while (mit != m.end() || mito != o.m.end());
-    c.join(o.c);
+  bool decode(const char *&p, const char *e)
+  {
+    return ::dtcrdt::decode(p, e, m);
   }
 };
 
-// A bag is similar to an RWSet, but allows for CRDT payloads
-template <typename V, typename K = std::string>
-class bag
+// G is the grow-only counter under its pncounter, gcounter or densecounter
+template <typename V = int, typename K = std::string, typename G = gcounter<V, K>>
+class bcounter
 {
 private:
-  dotkernel<V, K> dk; // Dot kernel
+  pncounter<V, K, G> c;
+  gmap<std::pair<K, K>, int> m;
   K id;
 
 public:
-  bag() {}            // Only for deltas and those should not be mutated
-  bag(K k) : id(k) {} // Mutable replicas need a unique id
-  bag(K k, dotcontext<K> &jointc) : id(k), dk(jointc) {}
+  bcounter() {}                  // Only for deltas and those should not be mutated
+  bcounter(K a) : id(a), c(a) {} // Mutable replicas need a unique id
 
-  bag<V, K> &operator=(const bag<V, K> &o)
+  bcounter inc(V tosum = {1}) // Argument is optional
   {
-    if (&o == this)
-      return *this;
-    if (&dk != &o.dk)
-      dk = o.dk;
-    id = o.id;
-    return *this;
+    bcounter<V, K, G> res;
+    res.c = c.inc(tosum);
+    return res;
   }
 
-  dotcontext<K> &context()
+  bcounter dec(V todec = {1}) // Argument is optional
   {
-    return dk.c;
+    bcounter<V, K, G> res;
+    if (todec <= local()) // Check local capacity
+      res.c = c.dec(todec);
+    return res;
   }
 
-  void insert(std::pair<std::pair<K, int>, V> t)
+  bcounter mv(V q, K to) // Quantity V to node id K
   {
-    dk.ds.insert(std::pair<std::pair<K, int>, V>(t));
-    dk.c.insertdot(t.first);
+    bcounter<V, K, G> res;
+    if (q <= local()) // Check local capacity
+    {
+      m[std::pair<K, K>(id, to)] += q;
+      res.m[std::pair<K, K>(id, to)] = m[std::pair<K, K>(id, to)];
+    }
+    return res;
   }
 
-  friend std::ostream &operator<<(std::ostream &output, const bag<V, K> &o)
+  V read() // get global counter value
   {
-    output << "Bag:" << o.dk;
-    return output;
+    V res = c.read();
+    return res;
   }
 
-  typename std::map<std::pair<K, int>, V>::iterator begin()
+  V local() // get local counter available value
   {
-    return dk.ds.begin();
+    V res = c.local();
+    // Sum incoming flows
+    for (const auto &kv : m.m)
+      if (kv.first.second == id)
+        res += kv.second;
+    // Subtract outgoing flows
+    for (const auto &kv : m.m)
+      if (kv.first.first == id)
+        res -= kv.second;
+    return res;
   }
 
-  typename std::map<std::pair<K, int>, V>::iterator end()
+  void join(const bcounter &o)
   {
-    return dk.ds.end();
+    c.join(o.c);
+    m.join(o.m);
   }
 
-  std::pair<K, int> mydot()
+  void encode(std::string &b) const
   {
-    auto me = dk.ds.end();
-    for (auto it = dk.ds.begin(); it != dk.ds.end(); ++it)
+    c.encode(b);
+    m.encode(b);
+  }
+
+  bool decode(const char *&p, const char *e)
+  {
+    return c.decode(p, e) && m.decode(p, e);
+  }
+
+  friend std::ostream &operator<<(std::ostream &output, const bcounter<V, K, G> &o)
+  {
+    output << "BCounter:C:" << o.c << "BCounter:M:" << o.m;
+    return output;
+  }
+};
+
+// Order statistic tree, a treap ordered by position alone, where every node
+// counts its subtree. Access, insertion and removal by index take O(log n)
+// expected time. Iterators are indexes into the tree, so they keep their
+// index, not their element, across insertions and removals.
+template <typename E>
+class ostree
+{
+  struct node
+  {
+    E e;
+    node *l, *r;
+    uint32_t pri;
+    size_t n; // nodes in this subtree
+
+    node(const E &x, uint32_t p) : e(x), l(nullptr), r(nullptr), pri(p), n(1) {}
+  };
+
+  node *root;
+  uint32_t seed;
+
+  static size_t count(const node *t) { return t ? t->n : 0; }
+  static void fix(node *t) { t->n = 1 + count(t->l) + count(t->r); }
+
+  uint32_t priority() // xorshift
+  {
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+  }
+
+  // Splits t in its first k elements and the rest
+  static void split(node *t, size_t k, node *&a, node *&b)
+  {
+    if (!t)
     {
-      if (it->first.first == id) // a candidate
-      {
-        if (me == dk.ds.end()) // pick at least one valid
-          me = it;
-        else // need to switch if more recent
-        {
-          if (it->first.second > me->first.second)
-            me = it;
-        }
-      }
+      a = b = nullptr;
+      return;
+    }
+    if (count(t->l) < k)
+    {
+      split(t->r, k - count(t->l) - 1, t->r, b);
+      a = t;
     }
-    if (me != dk.ds.end())
-      return me->first;
     else
     {
-      fresh();
-      return mydot(); // After a fresh it must be found
+      split(t->l, k, a, t->l);
+      b = t;
     }
+    fix(t);
   }
 
-  V &mydata()
+  static node *merge(node *a, node *b)
   {
-    auto me = dk.ds.end();
-    for (auto it = dk.ds.begin(); it != dk.ds.end(); ++it)
+    if (!a)
+      return b;
+    if (!b)
+      return a;
+    if (a->pri > b->pri)
     {
-      if (it->first.first == id) // a candidate
-      {
-        if (me == dk.ds.end()) // pick at least one valid
-          me = it;
-        else // need to switch if more recent
-        {
-          if (it->first.second > me->first.second)
-            me = it;
-        }
-      }
+      a->r = merge(a->r, b);
+      fix(a);
+      return a;
     }
-    if (me != dk.ds.end())
-      return me->second;
+    b->l = merge(a, b->l);
+    fix(b);
+    return b;
+  }
+
+  static node *remove(node *t, size_t k)
+  {
+    size_t nl = count(t->l);
+    if (k < nl)
+      t->l = remove(t->l, k);
+    else if (k > nl)
+      t->r = remove(t->r, k - nl - 1);
     else
     {
-      fresh();
-      return mydata(); // After a fresh it must be found
+      node *m = merge(t->l, t->r);
+      delete t;
+      return m;
     }
+    fix(t);
+    return t;
   }
 
-  // To protect from concurrent removes, create fresh dot for self
-  void fresh()
+  static node *find(node *t, size_t k)
   {
-    dk.add(id, V());
+    while (true)
+    {
+      size_t nl = count(t->l);
+      if (k == nl)
+        return t;
+      if (k < nl)
+        t = t->l;
+      else
+      {
+        k -= nl + 1;
+        t = t->r;
+      }
+    }
   }
 
-  bag<V, K> reset()
+  static node *clone(const node *t)
   {
-    bag<V, K> r;
-    r.dk = dk.rmv();
-    return r;
+    if (!t)
+      return nullptr;
+    node *c = new node(t->e, t->pri);
+    c->n = t->n;
+    c->l = clone(t->l);
+    c->r = clone(t->r);
+    return c;
   }
 
-  // Using the deep join will try to join different payloads under same dot
-  void join(const bag<V, K> &o)
+  static void destroy(node *t)
   {
-    dk.deepjoin(o.dk);
+    if (!t)
+      return;
+    destroy(t->l);
+    destroy(t->r);
+    delete t;
   }
-};
-
-// Inspired by designs from Carl Lerche and Paulo S. Almeida
-template <typename V, typename K = std::string>
-class rwcounter //  Reset Wins Counter
-{
-private:
-  bag<std::pair<V, V>, K> b; // Bag of pairs
-  K id;
 
 public:
-  rwcounter() {}                  // Only for deltas and those should not be mutated
-  rwcounter(K k) : id(k), b(k) {} // Mutable replicas need a unique id
-  rwcounter(K k, dotcontext<K> &jointc) : id(k), b(k, jointc) {}
-
-  rwcounter<V, K> &operator=(const rwcounter<V, K> &o)
+  template <typename Q, typename Tree>
+  class basic_iterator
+  {
+    Tree *t;
+    size_t i;
+
+  public:
+    typedef std::random_access_iterator_tag iterator_category;
+    typedef E value_type;
+    typedef ptrdiff_t difference_type;
+    typedef Q *pointer;
+    typedef Q &reference;
+
+    basic_iterator() : t(nullptr), i(0) {}
+    basic_iterator(Tree *tr, size_t k) : t(tr), i(k) {}
+    operator basic_iterator<const Q, const Tree>() const { return basic_iterator<const Q, const Tree>(t, i); }
+
+    size_t index() const { return i; }
+    Q &operator*() const { return t->at(i); }
+    Q *operator->() const { return &t->at(i); }
+    Q &operator[](difference_type d) const { return t->at(i + d); }
+    basic_iterator &operator++() { ++i; return *this; }
+    basic_iterator &operator--() { --i; return *this; }
+    basic_iterator operator++(int) { return basic_iterator(t, i++); }
+    basic_iterator operator--(int) { return basic_iterator(t, i--); }
+    basic_iterator &operator+=(difference_type d) { i += d; return *this; }
+    basic_iterator &operator-=(difference_type d) { i -= d; return *this; }
+    basic_iterator operator+(difference_type d) const { return basic_iterator(t, i + d); }
+    basic_iterator operator-(difference_type d) const { return basic_iterator(t, i - d); }
+    difference_type operator-(const basic_iterator &o) const { return difference_type(i) - difference_type(o.i); }
+    bool operator==(const basic_iterator &o) const { return i == o.i; }
+    bool operator!=(const basic_iterator &o) const { return i != o.i; }
+    bool operator<(const basic_iterator &o) const { return i < o.i; }
+  };
+
+  typedef E value_type;
+  typedef basic_iterator<E, ostree<E>> iterator;
+  typedef basic_iterator<const E, const ostree<E>> const_iterator;
+
+  ostree() : root(nullptr), seed(0x9e3779b9) {}
+  ostree(const ostree<E> &o) : root(clone(o.root)), seed(o.seed) {}
+  ~ostree() { destroy(root); }
+
+  ostree<E> &operator=(const ostree<E> &o)
   {
     if (&o == this)
       return *this;
-    if (&b != &o.b)
-      b = o.b;
-    id = o.id;
+    destroy(root);
+    root = clone(o.root);
+    seed = o.seed;
     return *this;
   }
 
-  dotcontext<K> &context()
-  {
-    return b.context();
-  }
+  size_t size() const { return count(root); }
+  bool empty() const { return root == nullptr; }
 
-  friend std::ostream &operator<<(std::ostream &output, const rwcounter<V, K> &o)
+  void clear()
   {
-    output << "ResetWinsCounter:" << o.b;
-    return output;
+    destroy(root);
+    root = nullptr;
   }
 
-  rwcounter<V, K> inc(const V &val = 1)
+  E &at(size_t k)
   {
-    rwcounter<V, K> r;
-    b.mydata().first += val;
-    r.b.insert(std::pair<std::pair<K, int>, std::pair<V, V>>(b.mydot(), b.mydata()));
-    return r;
+    assert(k < size());
+    return find(root, k)->e;
   }
 
-  rwcounter<V, K> dec(const V &val = 1)
+  const E &at(size_t k) const
   {
-    rwcounter<V, K> r;
-    b.mydata().second += val;
-    r.b.insert(std::pair<std::pair<K, int>, std::pair<V, V>>(b.mydot(), b.mydata()));
-    return r;
+    assert(k < size());
+    return find(root, k)->e;
   }
 
-  rwcounter<V, K> reset()
-  {
-    rwcounter<V, K> r;
-    r.b = b.reset();
-    return r;
-  }
+  E &front() { return at(0); }
+  E &back() { return at(size() - 1); }
+  const E &front() const { return at(0); }
+  const E &back() const { return at(size() - 1); }
 
-  void fresh()
+  iterator begin() { return iterator(this, 0); }
+  iterator end() { return iterator(this, size()); }
+  const_iterator begin() const { return const_iterator(this, 0); }
+  const_iterator end() const { return const_iterator(this, size()); }
+
+  // Inserts before it, and returns the inserted element
+  iterator insert(iterator it, const E &e)
   {
-    b.fresh();
+    node *a, *b;
+    split(root, it.index(), a, b);
+    root = merge(merge(a, new node(e, priority())), b);
+    return it;
   }
 
-  V read()
+  // Returns the element that followed the erased one
+  iterator erase(iterator it)
   {
-    std::pair<V, V> ac;
-    for (const auto &dv : b)
-    {
-      ac.first += dv.second.first;
-      ac.second += dv.second.second;
-    }
-    return ac.first - ac.second;
+    assert(it.index() < size());
+    root = remove(root, it.index());
+    return it;
   }
 
-  void join(const rwcounter<V, K> &o)
+  void push_back(const E &e) { insert(end(), e); }
+  void push_front(const E &e) { insert(begin(), e); }
+
+  bool operator==(const ostree<E> &o) const
   {
-    b.join(o.b);
+    return size() == o.size() && std::equal(begin(), end(), o.begin());
   }
 };
 
-template <typename N, typename V>
-class gmap
+// Position of the j-th element of a run that starts at base. Runs extend
+// base with j in an order preserving prefix code, j-1 in unary by bit
+// length, then the bits of j after the leading one, then a final 1.
+inline posid runpos(const posid &base, size_t j)
 {
+  posid p = base;
+  if (j == 0)
+    return p;
+  int len = 64 - clz64(j);
+  for (int i = 1; i < len; i++)
+    p.push_back(true);
+  p.push_back(false);
+  for (int i = len - 2; i >= 0; i--)
+    p.push_back(((j >> i) & 1) != 0);
+  p.push_back(true);
+  return p;
+}
 
-public:
-  // later make m private by adding a begin() for iterators
-  std::map<N, V> m;
-
-  friend std::ostream &operator<<(std::ostream &output, const gmap<N, V> &o)
+// Finds a run with p at index j > 0 and next at index j+1
+inline bool runof(const posid &p, const posid &next, posid &base, size_t &j)
+{
+  for (size_t len = 1; 2 * len <= p.size() && len < 64; len++)
   {
-    output << "GMap:" << std::endl;
-    for (const auto &kv : o.m)
-      std::cout << kv.first << "->" << kv.second << std::endl;
-    return output;
+    size_t s = p.size() - 2 * len;
+    bool code = p.back() && !p[s + len - 1];
+    j = 1;
+    for (size_t i = 0; code && i + 1 < len; i++)
+    {
+      code = p[s + i];
+      j = (j << 1) | p[s + len + i];
+    }
+    if (!code)
+      continue;
+    base = p;
+    base.resize(s);
+    if (runpos(base, j + 1) == next)
+      return true;
   }
+  return false;
+}
 
-  // Need to find a better way to collect deltas for this interface
-  V &operator[](const N &n)
+// Sequence of (position,dot,payload) elements that stores runs of
+// consecutive dots from a replica, at consecutive run positions, as one
+// block with an array of payloads. Inserts extend the block before them
+// when they continue its run, and inserts or erases inside a block split
+// it. Iterators are (block,index) pairs and return elements by value.
+template <typename E>
+class blocklist
+{
+  typedef typename std::tuple_element<1, E>::type D;
+  typedef typename std::tuple_element<2, E>::type T;
+
+  struct block
   {
-    auto i = m.find(n);
-    if (i == m.end()) // 1st key access
+    posid base; // Element i is at runpos(base, off + i)
+    size_t off;
+    D dot; // Of element 0, the others follow it
+    std::vector<T> vals;
+
+    bool operator==(const block &o) const
     {
-      auto ins = m.insert(i, std::pair<N, V>(n, V()));
-      return ins->second;
+      return off == o.off && dot == o.dot && base == o.base && vals == o.vals;
     }
-    else
+  };
+
+  std::list<block> bl;
+  size_t n;
+
+public:
+  template <typename B>
+  class basic_iterator
+  {
+    friend class blocklist<E>;
+    B b;
+    size_t i;
+
+  public:
+    typedef std::bidirectional_iterator_tag iterator_category;
+    typedef E value_type;
+    typedef ptrdiff_t difference_type;
+    typedef const E *pointer;
+    typedef E reference;
+
+    basic_iterator() : i(0) {}
+    basic_iterator(B bk, size_t k) : b(bk), i(k) {}
+    operator basic_iterator<typename std::list<block>::const_iterator>() const
     {
-      return i->second;
+      return basic_iterator<typename std::list<block>::const_iterator>(b, i);
     }
-  }
 
-  void join(const gmap<N, V> &o)
-  {
-    // join all keys
-    auto mit = m.begin();
-    auto mito = o.m.begin();
-    do
+    E operator*() const
     {
-      if (mit != m.end() && (mito == o.m.end() || mit->first < mito->first))
-      {
-        //std::cout << "entry left\n";
-        // entry only at here
-
-        ++mit;
-      }
-      else if (mito != o.m.end() && (mit == m.end() || mito->first < mit->first))
-      {
-        // std::cout << "entry right\n";
-        // entry only at other
+      return E(runpos(b->base, b->off + i), D(b->dot.first, b->dot.second + int(i)), b->vals[i]);
+    }
+    const T &value() const { return b->vals[i]; }
 
-        (*this)[mito->first] = mito->second;
+    basic_iterator &operator++()
+    {
+      if (++i == b->vals.size())
+        ++b, i = 0;
+      return *this;
+    }
+    basic_iterator &operator--()
+    {
+      if (i == 0)
+        --b, i = b->vals.size();
+      --i;
+      return *this;
+    }
+    basic_iterator operator++(int)
+    {
+      basic_iterator r = *this;
+      ++*this;
+      return r;
+    }
+    basic_iterator operator--(int)
+    {
+      basic_iterator r = *this;
+      --*this;
+      return r;
+    }
+    bool operator==(const basic_iterator &o) const { return b == o.b && i == o.i; }
+    bool operator!=(const basic_iterator &o) const { return !(*this == o); }
+  };
 
-        ++mito;
-      }
-      else if (mit != m.end() && mito != o.m.end())
-      {
-        // std::cout << "entry both\n";
-        // in both
-        (*this)[mito->first] = ::dtcrdt::join((*this)[mito->first], mito->second);
+  typedef E value_type;
+  typedef basic_iterator<typename std::list<block>::iterator> iterator;
+  typedef basic_iterator<typename std::list<block>::const_iterator> const_iterator;
 
-        ++mit;
-        ++mito;
-      }
-    } while (mit != m.end() || mito != o.m.end());
+private:
+  // Moves the elements from it on to a new block, returns its start
+  iterator split(iterator it)
+  {
+    block &k = *it.b;
+    block t;
+    t.base = k.base;
+    t.off = k.off + it.i;
+    t.dot = D(k.dot.first, k.dot.second + int(it.i));
+    t.vals.assign(k.vals.begin() + it.i, k.vals.end());
+    k.vals.resize(it.i);
+    return iterator(bl.insert(std::next(it.b), std::move(t)), 0);
   }
-};
 
-template <typename V = int, typename K = std::string>
-class bcounter
-{
-private:
-  pncounter<V, K> c;
-  gmap<std::pair<K, K>, int> m;
-  K id;
+  bool extends(block &k, const E &e)
+  {
+    const D &d = std::get<1>(e);
+    if (d.first != k.dot.first || d.second != k.dot.second + int(k.vals.size()))
+      return false;
+    if (std::get<0>(e) == runpos(k.base, k.off + k.vals.size()))
+      return true;
+    // A lone element may be in the middle of a run that was split apart
+    posid b;
+    size_t j;
+    if (k.vals.size() == 1 && k.off == 0 && runof(k.base, std::get<0>(e), b, j))
+    {
+      k.base = b;
+      k.off = j;
+      return true;
+    }
+    return false;
+  }
 
 public:
-  bcounter() {}                  // Only for deltas and those should not be mutated
-  bcounter(K a) : id(a), c(a) {} // Mutable replicas need a unique id
+  blocklist() : n(0) {}
 
-  bcounter inc(V tosum = {1}) // Argument is optional
-  {
-    bcounter<V, K> res;
-    res.c = c.inc(tosum);
-    return res;
-  }
+  size_t size() const { return n; }
+  bool empty() const { return n == 0; }
+  size_t blocks() const { return bl.size(); }
 
-  bcounter dec(V todec = {1}) // Argument is optional
+  void clear()
   {
-    bcounter<V, K> res;
-    if (todec <= local()) // Check local capacity
-      res.c = c.dec(todec);
-    return res;
+    bl.clear();
+    n = 0;
   }
 
-  bcounter mv(V q, K to) // Quantity V to node id K
+  iterator begin() { return iterator(bl.begin(), 0); }
+  iterator end() { return iterator(bl.end(), 0); }
+  const_iterator begin() const { return const_iterator(bl.begin(), 0); }
+  const_iterator end() const { return const_iterator(bl.end(), 0); }
+
+  E front() const { return *begin(); }
+  E back() const { return *std::prev(end()); }
+
+  // Inserts before it, and returns the inserted element
+  iterator insert(iterator it, const E &e)
   {
-    bcounter<V, K> res;
-    if (q <= local()) // Check local capacity
+    n++;
+    if (it.i > 0)
+      it = split(it);
+    if (it.b != bl.begin())
     {
-      m[std::pair<K, K>(id, to)] += q;
-      res.m[std::pair<K, K>(id, to)] = m[std::pair<K, K>(id, to)];
+      auto p = std::prev(it.b);
+      if (extends(*p, e))
+      {
+        p->vals.push_back(std::get<2>(e));
+        return iterator(p, p->vals.size() - 1);
+      }
     }
-    return res;
+    block k;
+    k.base = std::get<0>(e);
+    k.off = 0;
+    k.dot = std::get<1>(e);
+    k.vals.push_back(std::get<2>(e));
+    return iterator(bl.insert(it.b, std::move(k)), 0);
+  }
+
+  // Returns the element that followed the erased one
+  iterator erase(iterator it)
+  {
+    n--;
+    block &k = *it.b;
+    if (k.vals.size() == 1)
+      return iterator(bl.erase(it.b), 0);
+    if (it.i + 1 == k.vals.size())
+    {
+      k.vals.pop_back();
+      return iterator(std::next(it.b), 0);
+    }
+    if (it.i > 0)
+      it = split(it);
+    block &t = *it.b;
+    t.vals.erase(t.vals.begin());
+    t.off++;
+    t.dot.second++;
+    return it;
   }
 
-  V read() // get global counter value
+  void push_back(const E &e) { insert(end(), e); }
+  void push_front(const E &e) { insert(begin(), e); }
+
+  // Position for dot d right after it, if that continues its run
+  bool follow(const_iterator it, const D &d, posid &pos) const
   {
-    V res = c.read();
-    return res;
+    const block &k = *it.b;
+    if (it.i + 1 != k.vals.size() || d.first != k.dot.first ||
+        d.second != k.dot.second + int(k.vals.size()))
+      return false;
+    pos = runpos(k.base, k.off + k.vals.size());
+    return true;
   }
 
-  V local() // get local counter available value
+  // If a and b hold elements of the same run, d is how far a is after b
+  static bool samerun(const_iterator a, const_iterator b, long &d)
   {
-    V res = c.local();
-    // Sum incoming flows
-    for (const auto &kv : m.m)
-      if (kv.first.second == id)
-        res += kv.second;
-    // Subtract outgoing flows
-    for (const auto &kv : m.m)
-      if (kv.first.first == id)
-        res -= kv.second;
-    return res;
+    const block &k = *a.b, &o = *b.b;
+    if (k.dot.first != o.dot.first || long(k.off) - k.dot.second != long(o.off) - o.dot.second ||
+        k.base != o.base)
+      return false;
+    d = long(k.off + a.i) - long(o.off + b.i);
+    return true;
   }
 
-  void join(const bcounter &o)
+  // Steps past the elements at it and ito, which are the same, and past
+  // the rest of their shared run
+  static void skip(iterator &it, const_iterator &ito)
   {
-    c.join(o.c);
-    m.join(o.m);
+    long d;
+    size_t m = 1;
+    if (samerun(it, ito, d))
+      m = std::min(it.b->vals.size() - it.i, ito.b->vals.size() - ito.i);
+    it.i += m - 1;
+    ito.i += m - 1;
+    ++it;
+    ++ito;
   }
 
-  friend std::ostream &operator<<(std::ostream &output, const bcounter<V, K> &o)
+  bool operator==(const blocklist<E> &o) const
   {
-    output << "BCounter:C:" << o.c << "BCounter:M:" << o.m;
-    return output;
+    return n == o.n && std::equal(begin(), end(), o.begin());
   }
 };
 
-template <typename T = char, typename I = std::string>
+template <typename C>
+struct runlength : std::false_type
+{
+};
+
+template <typename E>
+struct runlength<blocklist<E>> : std::true_type
+{
+};
+
+// Storage policies for the elements of sequences
+
+struct listseq // Linked list, the default, positional access walks it
+{
+  template <typename E>
+  using seq = std::list<E>;
+};
+
+struct treeseq // Order statistic tree, for large sequences
+{
+  template <typename E>
+  using seq = ostree<E>;
+};
+
+struct blockseq // Runs of inserts as blocks, for text typed in order
+{
+  template <typename E>
+  using seq = blocklist<E>;
+};
+
+template <typename T = char, typename I = std::string, typename S = listseq>
 class orseq
 {
-private:
+public:
   // List elements are: (position,dot,payload)
-  std::list<std::tuple<std::vector<bool>, std::pair<I, int>, T>> l;
+  typedef std::tuple<posid, std::pair<I, int>, T> element;
+  typedef typename S::template seq<element> store;
+  typedef typename store::iterator iterator;
+  typedef typename store::const_iterator const_iterator;
+
+private:
+  store l;
   I id;
+  alloc al;      // How new positions are picked
+  uint32_t seed; // For lseq
 
   dotcontext<I> cbase;
   dotcontext<I> &c;
 
+  // LSEQ offsets are drawn from a seed of the replica id, so replicas
+  // inserting into the same gap at once seldom pick the same position
+  static uint32_t seedof(const I &i)
+  {
+    uint64_t h = std::hash<std::string>()(::dtcrdt::encode(i)) * 0x9e3779b97f4a7c15ull;
+    uint32_t s = uint32_t(h ^ (h >> 32));
+    return s ? s : 1; // xorshift stays at zero
+  }
+
+  posid place(const posid &bl, const posid &br)
+  {
+    if (al == alloc::lseq)
+      return lseqamong(bl, br, seed);
+    return among(bl, br);
+  }
+
+  // Elements order by position, then by replica id
+  static int order(const element &a, const element &b)
+  {
+    int k = std::get<0>(a).compare(std::get<0>(b));
+    if (k != 0)
+      return k;
+    return std::get<1>(a).first < std::get<1>(b).first ? -1 : std::get<1>(b).first < std::get<1>(a).first;
+  }
+
+  typedef runlength<store> runs;
+
+  static const T &value(const_iterator i, std::false_type) { return std::get<2>(*i); }
+  static const T &value(const_iterator i, std::true_type) { return i.value(); }
+
+  // Position for dot d after i, when it continues a run stored as a block
+  bool follow(const_iterator i, const std::pair<I, int> &d, posid &pos, std::true_type) const
+  {
+    return l.follow(i, d, pos);
+  }
+  bool follow(const_iterator, const std::pair<I, int> &, posid &, std::false_type) const
+  {
+    return false;
+  }
+
+  // Elements of a run order by their index in it
+  static int order(const_iterator it, const_iterator ito, std::true_type)
+  {
+    long d;
+    if (store::samerun(it, ito, d))
+      return d < 0 ? -1 : d > 0;
+    return order(*it, *ito);
+  }
+  static int order(const_iterator it, const_iterator ito, std::false_type)
+  {
+    return order(*it, *ito);
+  }
+
+  static void skip(iterator &it, const_iterator &ito, std::true_type)
+  {
+    store::skip(it, ito);
+  }
+  static void skip(iterator &it, const_iterator &ito, std::false_type)
+  {
+    ++it;
+    ++ito;
+  }
+
 public:
   // if no causal context supplied, used base one
-  orseq() : c(cbase) {} // Only for deltas and those should not be mutated
-  orseq(I i) : id(i), c(cbase) {}
+  orseq() : al(alloc::bisect), seed(1), c(cbase) {} // Only for deltas and those should not be mutated
+  orseq(I i) : id(i), al(alloc::bisect), seed(seedof(i)), c(cbase) {}
   // if supplied, use a shared causal context
-  orseq(I i, dotcontext<I> &jointc) : id(i), c(jointc) {}
+  orseq(I i, dotcontext<I> &jointc) : id(i), al(alloc::bisect), seed(seedof(i)), c(jointc) {}
+  // copies of a standalone sequence take their own context
+  orseq(const orseq<T, I, S> &o)
+      : l(o.l), id(o.id), al(o.al), seed(o.seed),
+        cbase(&o.c == &o.cbase ? o.cbase : dotcontext<I>()),
+        c(&o.c == &o.cbase ? cbase : o.c) {}
 
-  orseq<T, I> &operator=(const orseq<T, I> &aos)
+  // Selects the position allocation for inserts at this replica, replicas
+  // with different strategies can edit the same sequence
+  void allocation(alloc a)
+  {
+    al = a;
+  }
+
+  orseq<T, I, S> &operator=(const orseq<T, I, S> &aos)
   {
     if (&aos == this)
       return *this;
@@ -1874,10 +6300,12 @@ public:
       c = aos.c;
     l = aos.l;
     id = aos.id;
+    al = aos.al;
+    seed = aos.seed;
     return *this;
   }
 
-  friend std::ostream &operator<<(std::ostream &output, const orseq<T, I> &o)
+  friend std::ostream &operator<<(std::ostream &output, const orseq<T, I, S> &o)
   {
     output << "ORSeq: " << o.c;
     output << " List:";
@@ -1887,19 +6315,53 @@ public:
     return output;
   }
 
-  typename std::list<std::tuple<std::vector<bool>, std::pair<I, int>, T>>::iterator begin()
+  iterator begin()
+  {
+    return l.begin();
+  }
+
+  iterator end()
+  {
+    return l.end();
+  }
+
+  const_iterator begin() const
   {
     return l.begin();
   }
 
-  typename std::list<std::tuple<std::vector<bool>, std::pair<I, int>, T>>::iterator end()
+  const_iterator end() const
   {
     return l.end();
   }
 
-  orseq<T, I> erase(typename std::list<std::tuple<std::vector<bool>, std::pair<I, int>, T>>::iterator i)
+  size_t size() const
+  {
+    return l.size();
+  }
+
+  // Positional access, O(log n) with treeseq and O(n) with listseq
+  const T &at(size_t k) const
+  {
+    assert(k < l.size());
+    return value(std::next(l.begin(), k), runs());
+  }
+
+  orseq<T, I, S> insert_at(size_t k, const T &val)
+  {
+    assert(k <= l.size());
+    return insert(std::next(l.begin(), k), val);
+  }
+
+  orseq<T, I, S> erase_at(size_t k)
   {
-    orseq<T, I> res;
+    assert(k < l.size());
+    return erase(std::next(l.begin(), k));
+  }
+
+  orseq<T, I, S> erase(iterator i)
+  {
+    orseq<T, I, S> res;
     if (i != l.end())
     {
       res.c.insertdot(std::get<1>(*i));
@@ -1913,32 +6375,41 @@ public:
     return c;
   }
 
-  orseq<T, I> reset()
+  orseq<T, I, S> reset()
   {
-    orseq<T, I> res;
+    orseq<T, I, S> res;
     for (auto const &t : l)
       res.c.insertdot(std::get<1>(t));
     l.clear();
     return res;
   }
 
-  orseq<T, I> insert(typename std::list<std::tuple<std::vector<bool>, std::pair<I, int>, T>>::iterator i, const T &val)
+  orseq<T, I, S> insert(iterator i, const T &val)
   {
-    orseq<T, I> res;
+    orseq<T, I, S> res;
     if (i == l.end())
       res = push_back(val);
     else if (i == l.begin())
       res = push_front(val);
     else
     {
-      typename std::list<std::tuple<std::vector<bool>, std::pair<I, int>, T>>::iterator j = i;
+      iterator j = i;
       j--;
-      std::vector<bool> bl, br, pos;
+      posid bl, br, pos;
       bl = std::get<0>(*j);
       br = std::get<0>(*i);
-      pos = among(bl, br);
+      // Replicas that inserted here at once may have drawn one position,
+      // and nothing orders between them, so go after the last of them
+      if (!(bl < br))
+      {
+        while (i != l.end() && !(bl < std::get<0>(*i)))
+          ++i;
+        return insert(i, val);
+      }
       // get new dot
       auto dot = c.makedot(id);
+      if (!follow(j, dot, pos, runs()) || pos >= br)
+        pos = place(bl, br);
       auto tuple = make_tuple(pos, dot, val);
       l.insert(i, tuple);
       // delta
@@ -1949,15 +6420,15 @@ public:
   }
 
   // add 1st element
-  orseq<T, I> makefirst(const T &val)
+  orseq<T, I, S> makefirst(const T &val)
   {
     assert(l.empty());
 
-    orseq<T, I> res;
-    std::vector<bool> bl, br, pos;
+    orseq<T, I, S> res;
+    posid bl, br, pos;
     bl.push_back(false);
     br.push_back(true);
-    pos = among(bl, br);
+    pos = place(bl, br);
     // get new dot
     std::pair<I, int> dot = c.makedot(id);
     l.push_back(make_tuple(pos, dot, val));
@@ -1967,19 +6438,20 @@ public:
     return res;
   }
 
-  orseq<T, I> push_back(const T &val)
+  orseq<T, I, S> push_back(const T &val)
   {
-    orseq<T, I> res;
+    orseq<T, I, S> res;
     if (l.empty())
       res = makefirst(val);
     else
     {
-      std::vector<bool> bl, br, pos;
+      posid bl, br, pos;
       bl = std::get<0>(l.back());
       br.push_back(true);
-      pos = among(bl, br);
       // get new dot
       auto dot = c.makedot(id);
+      if (!follow(std::prev(l.end()), dot, pos, runs()) || pos >= br)
+        pos = place(bl, br);
       auto tuple = make_tuple(pos, dot, val);
       l.push_back(tuple);
       // delta
@@ -1989,17 +6461,17 @@ public:
     return res;
   }
 
-  orseq<T, I> push_front(const T &val)
+  orseq<T, I, S> push_front(const T &val)
   {
-    orseq<T, I> res;
+    orseq<T, I, S> res;
     if (l.empty())
       res = makefirst(val);
     else
     {
-      std::vector<bool> bl, br, pos;
+      posid bl, br, pos;
       br = std::get<0>(l.front());
       bl.push_back(false);
-      pos = among(bl, br);
+      pos = place(bl, br);
       // get new dot
       auto dot = c.makedot(id);
       auto tuple = make_tuple(pos, dot, val);
@@ -2011,54 +6483,422 @@ public:
     return res;
   }
 
-  void join(const orseq<T, I> &o)
+  void join(const orseq<T, I, S> &o)
   {
     if (this == &o)
       return; // Join is idempotent, but just don't do it.
+    joinstore(o);
+    // CC
+    c.join(o.c);
+  }
+
+  // Joins many sequences. Copies of them are joined pairwise in rounds,
+  // so the sequence here is walked once, by the last join.
+  template <typename It>
+  void join_many(It first, It last)
+  {
+    std::vector<orseq<T, I, S>> v;
+    v.reserve(std::distance(first, last));
+    for (; first != last; ++first)
+      if (&*first != this)
+        v.push_back(*first);
+    joinrounds(v);
+    if (!v.empty())
+      join(v.front());
+  }
+
+  // Payload only join, for entries of a map
+  void joinstore(const orseq<T, I, S> &o)
+  {
     auto it = l.begin();
     auto ito = o.l.begin();
-    std::pair<std::vector<bool>, I> e, eo;
-    do
+    while (it != l.end() || ito != o.l.end())
     {
-      if (it != l.end())
-      {
-        e.first = std::get<0>(*it);
-        e.second = std::get<1>(*it).first;
-      }
-      if (ito != o.l.end())
-      {
-        eo.first = std::get<0>(*ito);
-        eo.second = std::get<1>(*ito).first;
-      }
-      if (it != l.end() && (ito == o.l.end() || e < eo))
+      // Only this, only other or both
+      int k = it == l.end() ? 1 : ito == o.l.end() ? -1 : order(it, ito, runs());
+      if (k < 0)
       {
         // std::cout << "ds one\n";
         // entry only at this
         if (o.c.dotin(std::get<1>(*it))) // other knows dot, must delete here
-          l.erase(it++);
+          it = l.erase(it);
         else // keep it
           ++it;
       }
-      else if (ito != o.l.end() && (it == l.end() || eo < e))
+      else if (k > 0)
       {
         //std::cout << "ds two\n";
         // entry only at other
         if (!c.dotin(std::get<1>(*ito))) // If I dont know, import
         {
-          l.insert(it, *ito); // it keeps pointing to next
+          it = l.insert(it, *ito);
+          ++it; // back to the next element here
         }
         ++ito;
       }
-      else if (it != l.end() && ito != o.l.end())
+      else
       {
         // std::cout << "ds three\n";
         // in both
+        skip(it, ito, runs());
+      }
+    }
+  }
+
+  // What a replica whose context is peer has not seen: the elements with
+  // dots it does not know, under this context less the dots of elements
+  // it already has, so that it also drops what was erased here
+  orseq<T, I, S> delta_since(const dotcontext<I> &peer) const
+  {
+    orseq<T, I, S> r;
+    dotcontext<I> held;
+    storesince(peer, r, held);
+    r.c = c.minus(held);
+    return r;
+  }
+
+  // Store part of delta_since, for entries of a map
+  bool storesince(const dotcontext<I> &peer, orseq<T, I, S> &r, dotcontext<I> &held) const
+  {
+    bool any = false;
+    for (const auto &t : l)
+      if (peer.dotin(std::get<1>(t)))
+        held.insertdot(std::get<1>(t), false);
+      else
+      {
+        r.l.push_back(t);
+        any = true;
+      }
+    return any;
+  }
+
+  void encode(std::string &b, bool ctx = true) const
+  {
+    if (ctx)
+      c.encode(b);
+    putvarint(b, l.size());
+    for (const auto &t : l)
+    {
+      ::dtcrdt::encode(b, std::get<0>(t));
+      ::dtcrdt::encode(b, std::get<1>(t));
+      ::dtcrdt::encode(b, std::get<2>(t));
+    }
+  }
+
+  bool decode(const char *&p, const char *e, bool ctx = true)
+  {
+    uint64_t n;
+    if (ctx && !c.decode(p, e))
+      return false;
+    l.clear();
+    if (!getcount(p, e, n))
+      return false;
+    for (uint64_t i = 0; i < n; i++)
+    {
+      element t;
+      if (!decodeelement(p, e, t))
+        return false;
+      l.push_back(t);
+    }
+    return true;
+  }
+
+  // Joins straight from an encoded sequence, false if it is malformed.
+  // Elements are decoded one at a time and merged in a walk of the
+  // sequence here, as joinstore does.
+  bool join(wireview v)
+  {
+    dotcontext<I> oc;
+    if (!oc.decode(v.p, v.e))
+      return false;
+    // Check the elements before touching this sequence
+    const char *p = v.p;
+    uint64_t n;
+    bool sorted = true;
+    element t, prev;
+    if (!getcount(p, v.e, n))
+      return false;
+    for (uint64_t i = 0; i < n; i++)
+    {
+      if (!decodeelement(p, v.e, t))
+        return false;
+      if (i > 0 && order(prev, t) >= 0)
+        sorted = false;
+      prev = t;
+    }
+    p = v.p;
+    getcount(p, v.e, n);
+    if (!sorted) // the sender orders replicas differently, e.g. interned ids
+    {
+      orseq<T, I, S> o;
+      o.decode(p, v.e, false);
+      o.c = oc;
+      join(o);
+      return true;
+    }
+    auto it = l.begin();
+    for (uint64_t i = 0; i <= n; i++)
+    {
+      if (i < n)
+        decodeelement(p, v.e, t);
+      int k = -1;
+      while (it != l.end() && (i == n || (k = order(*it, t)) < 0))
+      {
+        // element only at this
+        if (oc.dotin(std::get<1>(*it))) // other knows dot, must delete here
+          it = l.erase(it);
+        else // keep it
+          ++it;
+      }
+      if (i == n)
+        break;
+      if (it == l.end() || k > 0)
+      {
+        // element only at other, import it if I dont know it
+        if (!c.dotin(std::get<1>(t)))
+        {
+          it = l.insert(it, t);
+          ++it; // back to the next element here
+        }
+      }
+      else // in both
         ++it;
-        ++ito;
+    }
+    c.join(oc);
+    return true;
+  }
+
+  // Skips an encoded sequence, checking it as decode does
+  static bool skip(const char *&p, const char *e, bool ctx = true)
+  {
+    dotcontext<I> oc;
+    uint64_t n;
+    if ((ctx && !oc.decode(p, e)) || !getcount(p, e, n))
+      return false;
+    for (uint64_t i = 0; i < n; i++)
+      if (!::dtcrdt::skip(p, e, (const posid *)nullptr) ||
+          !::dtcrdt::skip(p, e, (const std::pair<I, int> *)nullptr) ||
+          !::dtcrdt::skip(p, e, (const T *)nullptr))
+        return false;
+    return true;
+  }
+
+private:
+  static bool decodeelement(const char *&p, const char *e, element &t)
+  {
+    return ::dtcrdt::decode(p, e, std::get<0>(t)) &&
+           ::dtcrdt::decode(p, e, std::get<1>(t)) &&
+           ::dtcrdt::decode(p, e, std::get<2>(t));
+  }
+};
+
+// Multi producer, single consumer queue of deltas for a replica.
+// Producers push onto a list with a CAS, and the consumer takes the whole
+// list at once, joins its deltas together and applies them to the replica
+// with one join. start() runs the consumer on its own thread until stop(),
+// and the replica must then be left to it. That thread sleeps while the
+// list is empty, and the push that fills it wakes it up. That push briefly
+// takes a mutex, so that the wake up cannot fall between the consumer's
+// check and its wait, while pushes onto a non empty list stay lock-free.
+template <typename C>
+class deltaqueue
+{
+  struct node
+  {
+    C d;
+    node *next;
+
+    node(const C &x) : d(x), next(nullptr) {}
+    node(C &&x) : d(std::move(x)), next(nullptr) {}
+  };
+
+  std::atomic<node *> head;
+  C &x;
+  std::atomic<bool> running;
+  std::thread applier;
+  std::mutex m; // Only to wait on ready without missing a wake up
+  std::condition_variable ready;
+
+  deltaqueue(const deltaqueue<C> &) = delete;
+  deltaqueue<C> &operator=(const deltaqueue<C> &) = delete;
+
+  void push(node *n)
+  {
+    node *old = head.load(std::memory_order_relaxed);
+    do
+      n->next = old;
+    while (!head.compare_exchange_weak(old, n, std::memory_order_release, std::memory_order_relaxed));
+    if (!old) // Was empty, so the consumer may be asleep. n may be gone.
+      wake();
+  }
+
+  void wake()
+  {
+    {
+      std::lock_guard<std::mutex> l(m); // Not between its check and its wait
+    }
+    ready.notify_one();
+  }
+
+public:
+  deltaqueue(C &replica) : head(nullptr), x(replica), running(false) {}
+
+  ~deltaqueue()
+  {
+    stop();
+    apply();
+  }
+
+  void push(const C &d) { push(new node(d)); }
+  void push(C &&d) { push(new node(std::move(d))); }
+
+  // Consumer side, applies all pending deltas and returns how many. They
+  // are joined pairwise in rounds, so each round walks every delta once.
+  size_t apply()
+  {
+    node *n = head.exchange(nullptr, std::memory_order_acquire);
+    if (!n)
+      return 0;
+    std::vector<C> v;
+    while (n)
+    {
+      v.push_back(std::move(n->d));
+      node *next = n->next;
+      delete n;
+      n = next;
+    }
+    joinrounds(v);
+    x.join(std::move(v[0]));
+    return v.size();
+  }
+
+  void start()
+  {
+    if (running.exchange(true))
+      return;
+    applier = std::thread([this]() {
+      while (running.load(std::memory_order_relaxed))
+      {
+        apply();
+        std::unique_lock<std::mutex> l(m);
+        ready.wait(l, [this]() { return head.load(std::memory_order_relaxed) || !running.load(std::memory_order_relaxed); });
       }
-    } while (it != l.end() || ito != o.l.end());
-    // CC
-    c.join(o.c);
+      apply();
+    });
+  }
+
+  void stop()
+  {
+    if (running.exchange(false))
+    {
+      wake();
+      applier.join();
+    }
+  }
+};
+
+// Delta-interval anti-entropy, after Almeida, Shoker and Baquero.
+// Deltas from local mutations are numbered and buffered. Each neighbour
+// is sent the join of the deltas it did not acknowledge yet, a
+// delta-interval, and the full state once some of those were collected.
+// Intervals always start at the last ack, so delivery is causal even with
+// loss, duplication and reordering, as long as sending is retried.
+// Received deltas are not relayed, every mutating node should be a
+// neighbour of every other node.
+template <typename C, typename P = std::string>
+class delta_buffer
+{
+public:
+  struct message
+  {
+    bool full;   // payload is the full state, not a delta-interval
+    uint64_t to; // covers all deltas numbered below this
+    C payload;
+  };
+
+private:
+  C &x;                         // Replica state
+  std::map<uint64_t, C> deltas; // Numbered deltas not yet collected
+  uint64_t seq;                 // Number for the next delta
+  std::map<P, uint64_t> acks;   // Per neighbour, deltas acknowledged
+  size_t maxdeltas;             // Oldest deltas are collected above this
+
+public:
+  delta_buffer(C &replica, size_t max = 1000) : x(replica), seq(0), maxdeltas(max) {}
+
+  // Record a delta returned by a local mutation on the replica
+  void add(const C &d)
+  {
+    add(C(d));
+  }
+
+  void add(C &&d)
+  {
+    deltas.insert(deltas.end(), std::pair<uint64_t, C>(seq++, std::move(d)));
+    if (deltas.size() > maxdeltas)
+      deltas.erase(deltas.begin()); // laggards will get the full state
+  }
+
+  void neighbour(const P &j)
+  {
+    acks.insert(std::pair<P, uint64_t>(j, 0));
+  }
+
+  // Build the message for neighbour j, false if it is up to date
+  bool send(const P &j, message &m)
+  {
+    neighbour(j);
+    uint64_t from = acks.at(j);
+    if (from >= seq)
+      return false;
+    m.to = seq;
+    if (deltas.empty() || from < deltas.begin()->first)
+    {
+      m.full = true;
+      m.payload = x;
+      return true;
+    }
+    m.full = false;
+    m.payload = C();
+    for (auto it = deltas.lower_bound(from); it != deltas.end(); ++it)
+      m.payload.join(it->second);
+    return true;
+  }
+
+  // Join a message from a neighbour, returns the ack to send back to it
+  uint64_t receive(const message &m)
+  {
+    x.join(m.payload);
+    return m.to;
+  }
+
+  uint64_t receive(message &&m)
+  {
+    x.join(std::move(m.payload));
+    return m.to;
+  }
+
+  // Acks can arrive late or repeated, only the highest one counts
+  void ack(const P &j, uint64_t n)
+  {
+    neighbour(j);
+    uint64_t &a = acks.at(j);
+    a = std::max(a, std::min(n, seq));
+    gc();
+  }
+
+  // Collect deltas acknowledged by all known neighbours
+  void gc()
+  {
+    uint64_t low = seq;
+    for (const auto &ja : acks)
+      low = std::min(low, ja.second);
+    deltas.erase(deltas.begin(), deltas.lower_bound(low));
+  }
+
+  size_t size() const
+  {
+    return deltas.size();
   }
 };
 
@@ -33,7 +33,10 @@
 #include <string>
 #include <vector>
 #include <iostream>
-#include <chrono>
+#include <random>
+#include <algorithm>
+#include <thread>
+#include <atomic>
 //#define NDEBUG  // Uncoment do stop testing asserts
 #include <assert.h>
 #include "delta-crdts.cc"
@@ -433,6 +436,1591 @@ void test_dwflag()
   std::cout << o4.read() << std::endl;
 }
 
+void test_dotcontext()
+{
+  std::cout << "--- Testing: dotcontext --\n";
+  dtcrdt::dotcontext<char> c1, c2;
+
+  // Out of order arrival leaves holes that are kept as ranges
+  for (int i = 10; i > 1; i -= 2)
+    c1.insertdot(std::pair<char, int>('a', i));
+  c1.insertdot(std::pair<char, int>('b', 2));
+  std::cout << c1 << std::endl;
+  assert(c1.dotin(std::pair<char, int>('a', 4)));
+  assert(!c1.dotin(std::pair<char, int>('a', 5)));
+  assert(c1.cc.empty());
+
+  // Filling the holes compacts incrementally
+  for (int i = 9; i > 0; i -= 2)
+    c1.insertdot(std::pair<char, int>('a', i));
+  assert(c1.cc.at('a') == 10 && c1.dc.count('a') == 0);
+
+  c2.insertdot(std::pair<char, int>('b', 1));
+  c2.insertdot(std::pair<char, int>('b', 4));
+  c2.join(c1);
+  std::cout << c2 << std::endl;
+  assert(c2.cc.at('b') == 2 && c2.dotin(std::pair<char, int>('b', 4)));
+  assert(!c2.dotin(std::pair<char, int>('b', 3)));
+}
+
+void test_flatstore()
+{
+  std::cout << "--- Testing: flatstore kernels --\n";
+  dtcrdt::aworset<int> m1("x"), m2("y");
+  dtcrdt::aworset<int, std::string, dtcrdt::flatstore> f1("x"), f2("y"), df;
+
+  for (int i = 0; i < 50; i++)
+  {
+    m1.add(i % 7);
+    df.join(f1.add(i % 7));
+    m2.add(i % 5);
+    f2.add(i % 5);
+    if (i % 3 == 0)
+    {
+      m1.rmv(i % 5);
+      df.join(f1.rmv(i % 5));
+    }
+    if (i % 11 == 0)
+    {
+      m2.join(m1);
+      f2.join(f1);
+    }
+  }
+  m1.join(m2);
+  f1.join(f2);
+  assert(m1.read() == f1.read());
+  f2.join(df);
+  assert(f2.read() == f1.read());
+  std::cout << f1.read() << std::endl;
+
+  dtcrdt::mvreg<int, std::string, dtcrdt::flatstore> r1("x"), r2("y");
+  r1.write(3);
+  r2.write(5);
+  r1.join(r2);
+  r1.resolve();
+  std::cout << r1.read() << std::endl;
+
+  dtcrdt::ewflag<std::string, dtcrdt::flatstore> e1("x"), e2("y");
+  e1.enable();
+  e2.join(e1);
+  e2.disable();
+  e1.enable();
+  e1.join(e2);
+  assert(e1.read() == true);
+
+  dtcrdt::rwcounter<int, std::string, dtcrdt::flatstore> c1("x"), c2("y");
+  c1.inc(3);
+  c2.inc(2);
+  c1.join(c2);
+  c1.inc();
+  c2.join(c1);
+  assert(c1.read() == 6 && c2.read() == 6);
+}
+
+template <typename T>
+void roundtrip(const T &o)
+{
+  // Decoding into a fresh object and encoding again must give same bytes
+  std::string b = dtcrdt::encode(o), b2;
+  T r;
+  assert(dtcrdt::decode(b, r));
+  b2 = dtcrdt::encode(r);
+  assert(b == b2);
+  // Skipping checks and consumes the same bytes as decoding
+  const char *p = b.data();
+  assert(dtcrdt::skip(p, b.data() + b.size(), &o) && p == b.data() + b.size());
+  // Truncated buffers are rejected
+  if (b.size() > 1)
+  {
+    assert(!dtcrdt::decode(b.substr(0, b.size() - 1), r));
+    p = b.data();
+    assert(!dtcrdt::skip(p, b.data() + b.size() - 1, &o) || p != b.data() + b.size() - 1);
+  }
+}
+
+// Joining from the wire must give the same as decoding and then joining,
+// and a truncated buffer must leave x as it was
+template <typename T>
+void wirejoin(T &x, const T &o)
+{
+  std::string b = dtcrdt::encode(o);
+  T y = x, d;
+  assert(dtcrdt::decode(b, d));
+  y.join(d);
+  assert(!x.join(dtcrdt::wireview(b.substr(0, b.size() - 1))));
+  assert(x.join(dtcrdt::wireview(b)));
+  assert(dtcrdt::encode(x) == dtcrdt::encode(y));
+}
+
+template <typename S>
+void seqwire()
+{
+  dtcrdt::orseq<char, char, S> a('a'), b('b');
+  for (int i = 0; i < 20; i++)
+    a.push_back(char('a' + i));
+  b.join(a);
+  for (int i = 0; i < 5; i++)
+  {
+    a.erase_at(i * 3), a.insert_at(i * 2, 'x');
+    b.erase_at(i), b.push_back('y');
+  }
+  dtcrdt::orseq<char, char, S> c = b;
+  wirejoin(b, a);
+  wirejoin(a, c);
+}
+
+void test_wire()
+{
+  std::cout << "--- Testing: wire format --\n";
+  dtcrdt::gset<std::string> gs;
+  gs.add("hello");
+  gs.add("world");
+  roundtrip(gs);
+
+  dtcrdt::gcounter<> gc("x"), gc2("y");
+  gc.inc(300);
+  gc2.inc(-1 * -2);
+  gc2.join(gc);
+  roundtrip(gc2);
+  dtcrdt::pncounter<float, int> pn(2);
+  pn.inc(3.5);
+  pn.dec();
+  roundtrip(pn);
+  // Floats are little endian IEEE 754, long doubles go without padding
+  std::string fb;
+  dtcrdt::encode(fb, 1.0);
+  assert(fb == std::string("\0\0\0\0\0\0\xf0\x3f", 8));
+  long double ld = 1 + std::ldexp(1.0L, -60), ld2;
+  fb.clear();
+  dtcrdt::encode(fb, ld);
+  const char *fp = fb.data();
+  assert(fb.size() == 16 && dtcrdt::decode(fp, fb.data() + fb.size(), ld2) && ld2 == ld);
+  dtcrdt::lexcounter<int, char> lc('a');
+  lc.dec(4);
+  roundtrip(lc);
+  dtcrdt::twopset<int> tp;
+  tp.add(-7);
+  tp.add(1);
+  tp.rmv(1);
+  roundtrip(tp);
+  dtcrdt::rwlwwset<int, std::string> rw;
+  rw.add(1, "a");
+  rw.rmv(2, "b");
+  roundtrip(rw);
+  dtcrdt::lwwreg<int, std::string> lw;
+  lw.write(3, "three");
+  roundtrip(lw);
+  dtcrdt::bcounter<int, char> bc('a');
+  bc.inc(10);
+  bc.mv(2, 'b');
+  roundtrip(bc);
+
+  dtcrdt::aworset<std::string> a1("x"), a2("y"), da;
+  a1.add("apple");
+  a2.add("juice");
+  da.join(a2.add("pear"));
+  da.join(a2.rmv("juice"));
+  a1.join(a2);
+  a1.rmv("pear");
+  roundtrip(a1);
+  roundtrip(da);
+
+  // Joining from the wire gives the same as decoding and then joining
+  dtcrdt::aworset<std::string> a3("z"), a4("z");
+  a3.add("juice");
+  a4 = a3;
+  std::string bd = dtcrdt::encode(da);
+  assert(a3.join(dtcrdt::wireview(bd)));
+  dtcrdt::aworset<std::string> dd;
+  dtcrdt::decode(bd, dd);
+  a4.join(dd);
+  assert(a3.read() == a4.read() && dtcrdt::encode(a3) == dtcrdt::encode(a4));
+  std::cout << a3.read() << std::endl;
+  assert(!a3.join(dtcrdt::wireview(bd.substr(0, bd.size() - 1))));
+  assert(a3.read() == a4.read());
+
+  dtcrdt::aworset<int, char, dtcrdt::flatstore> f1('a'), f2('b');
+  f1.add(1);
+  f2.add(2);
+  f2.rmv(2);
+  f2.add(3);
+  assert(f1.join(dtcrdt::wireview(dtcrdt::encode(f2))));
+  std::cout << f1.read() << std::endl;
+
+  dtcrdt::rworset<char> r1("x");
+  r1.add('a');
+  r1.rmv('b');
+  roundtrip(r1);
+  dtcrdt::mvreg<std::pair<int, int>> mv("x");
+  mv.write(std::pair<int, int>(1, 2));
+  roundtrip(mv);
+  dtcrdt::ewflag<> ew("x");
+  ew.enable();
+  roundtrip(ew);
+  dtcrdt::dwflag<> dw("x");
+  dw.disable();
+  roundtrip(dw);
+  dtcrdt::ccounter<int> cc("x");
+  cc.inc(5);
+  cc.dec(7);
+  roundtrip(cc);
+  dtcrdt::rwcounter<int> rc1("x"), rc2("y");
+  rc1.inc(4);
+  rc2.inc();
+  assert(rc2.join(dtcrdt::wireview(dtcrdt::encode(rc1))));
+  assert(rc2.read() == 5);
+  roundtrip(rc2);
+
+  dtcrdt::ormap<int, dtcrdt::ormap<std::string, dtcrdt::aworset<std::string>>> m1("x"), m2;
+  m1[2]["color"].add("red");
+  m1[3]["sound"].add("loud");
+  m1.erase(3);
+  roundtrip(m1);
+  assert(dtcrdt::decode(dtcrdt::encode(m1), m2));
+  std::cout << m2[2]["color"].read() << std::endl;
+
+  dtcrdt::gmap<char, int> gm;
+  gm['a'] = 4;
+  roundtrip(gm);
+
+  dtcrdt::orseq<> sq("x");
+  sq.push_back('a');
+  sq.push_back('b');
+  sq.push_front('c');
+  roundtrip(sq);
+
+  dtcrdt::ormap<int, dtcrdt::aworset<int, char>, char> ma('a'), mb('b');
+  for (int i = 0; i < 30; i++)
+    (i % 3 ? ma : mb)[i % 7].add(i);
+  mb.join(ma);
+  ma.erase(2), mb.erase(3), ma[4].rmv(4), mb[9].add(9), ma[1].add(100);
+  dtcrdt::ormap<int, dtcrdt::aworset<int, char>, char> mc = mb;
+  wirejoin(mb, ma);
+  wirejoin(ma, mc);
+  dtcrdt::ormap<int, dtcrdt::ormap<std::string, dtcrdt::aworset<std::string>>> m3("y");
+  m3[2]["color"].add("blue");
+  wirejoin(m3, m1);
+
+  seqwire<dtcrdt::listseq>();
+  seqwire<dtcrdt::treeseq>();
+  seqwire<dtcrdt::blockseq>();
+}
+
+// In process network that loses, duplicates and reorders messages
+template <typename C>
+struct lossynet
+{
+  struct packet
+  {
+    int from, to;
+    bool isack;
+    uint64_t ack;
+    typename dtcrdt::delta_buffer<C, int>::message m;
+  };
+  std::vector<packet> inflight;
+  std::minstd_rand rnd;
+
+  lossynet() : rnd(42) {}
+
+  void put(const packet &pk)
+  {
+    if (rnd() % 5 == 0) // loss
+      return;
+    inflight.push_back(pk);
+    if (rnd() % 10 == 0) // duplication
+      inflight.push_back(pk);
+  }
+
+  void deliver(std::vector<dtcrdt::delta_buffer<C, int>> &bufs)
+  {
+    std::vector<packet> now;
+    now.swap(inflight);
+    std::shuffle(now.begin(), now.end(), rnd); // reordering
+    for (const auto &pk : now)
+    {
+      if (rnd() % 4 == 0) // late, keep it for a later round
+      {
+        inflight.push_back(pk);
+        continue;
+      }
+      if (pk.isack)
+        bufs[pk.to].ack(pk.from, pk.ack);
+      else
+      {
+        packet a;
+        a.from = pk.to;
+        a.to = pk.from;
+        a.isack = true;
+        a.ack = bufs[pk.to].receive(pk.m);
+        put(a);
+      }
+    }
+  }
+
+  void round(std::vector<dtcrdt::delta_buffer<C, int>> &bufs)
+  {
+    for (int i = 0; i < int(bufs.size()); i++)
+      for (int j = 0; j < int(bufs.size()); j++)
+      {
+        packet pk;
+        pk.from = i;
+        pk.to = j;
+        pk.isack = false;
+        if (i != j && bufs[i].send(j, pk.m))
+          put(pk);
+      }
+    deliver(bufs);
+  }
+};
+
+void test_delta_buffer()
+{
+  std::cout << "--- Testing: delta_buffer --\n";
+  const int n = 4;
+  std::vector<dtcrdt::aworset<int, int>> sets;
+  std::vector<dtcrdt::gcounter<int, int>> cnts;
+  for (int i = 0; i < n; i++)
+  {
+    sets.push_back(dtcrdt::aworset<int, int>(i));
+    cnts.push_back(dtcrdt::gcounter<int, int>(i));
+  }
+  std::vector<dtcrdt::delta_buffer<dtcrdt::aworset<int, int>, int>> sbufs;
+  std::vector<dtcrdt::delta_buffer<dtcrdt::gcounter<int, int>, int>> cbufs;
+  for (int i = 0; i < n; i++)
+  {
+    sbufs.push_back(dtcrdt::delta_buffer<dtcrdt::aworset<int, int>, int>(sets[i], 20));
+    cbufs.push_back(dtcrdt::delta_buffer<dtcrdt::gcounter<int, int>, int>(cnts[i], 20));
+  }
+
+  lossynet<dtcrdt::aworset<int, int>> snet;
+  lossynet<dtcrdt::gcounter<int, int>> cnet;
+  std::minstd_rand rnd(7);
+  int total = 0;
+  for (int r = 0; r < 60; r++)
+  {
+    for (int i = 0; i < n; i++)
+    {
+      int v = rnd() % 30;
+      if (rnd() % 3 == 0)
+        sbufs[i].add(sets[i].rmv(v));
+      else
+        sbufs[i].add(sets[i].add(v));
+      cbufs[i].add(cnts[i].inc(v));
+      total += v;
+    }
+    // the network is down for a while, buffers overflow and full states
+    // are needed afterwards
+    if (r < 20 || r > 45)
+    {
+      snet.round(sbufs);
+      cnet.round(cbufs);
+    }
+  }
+  for (int r = 0; r < 100; r++)
+  {
+    snet.round(sbufs);
+    cnet.round(cbufs);
+  }
+  for (int i = 1; i < n; i++)
+  {
+    assert(sets[i].read() == sets[0].read());
+    assert(cnts[i].read() == cnts[0].read());
+  }
+  assert(cnts[0].read() == total);
+  for (int i = 0; i < n; i++)
+    assert(sbufs[i].size() == 0 && cbufs[i].size() == 0); // all acked
+  std::cout << sets[0].read() << std::endl;
+}
+
+void test_ormap_apply()
+{
+  std::cout << "--- Testing: ormap apply --\n";
+  typedef dtcrdt::aworset<int, int> set;
+  typedef dtcrdt::ormap<int, set, int> map;
+  map a(1), b(2), full(3);
+  for (int k = 0; k < 100; k++)
+    b.join(a.apply(k, [&](set &v) { return v.add(k); }));
+  full.join(a);
+
+  // A delta holds only the touched key
+  map d = a.apply(7, [](set &v) { return v.rmv(7); });
+  assert(dtcrdt::encode(d).size() * 20 < dtcrdt::encode(a).size());
+  b.join(d);
+  d = a.apply(8, [](set &v) { return v.add(80); });
+  b.join(d);
+  full.join(a);
+  for (int k = 0; k < 100; k++)
+  {
+    assert(b[k].read() == a[k].read());
+    assert(full[k].read() == a[k].read());
+  }
+  assert(b[7].read().empty() && b[8].read().size() == 2);
+
+  // Nested maps lift the inner delta through each level
+  typedef dtcrdt::ormap<std::string, map, int> outer;
+  outer x(1), y(2);
+  y.join(x.apply("a", [](map &v) { return v.apply(1, [](set &s) { return s.add(10); }); }));
+  y.join(x.apply("a", [](map &v) { return v.apply(2, [](set &s) { return s.add(20); }); }));
+  y.join(x.apply("b", [](map &v) { return v.apply(1, [](set &s) { return s.add(30); }); }));
+  outer dx = x.apply("a", [](map &v) { return v.apply(1, [](set &s) { return s.rmv(10); }); });
+  y.join(dx);
+  assert(y["a"][1].read().empty());
+  assert(y["a"][2].read() == x["a"][2].read() && y["b"][1].read() == x["b"][1].read());
+  std::cout << y << std::endl;
+}
+
+void test_ormap_join()
+{
+  std::cout << "--- Testing: ormap join --\n";
+  typedef dtcrdt::aworset<int, int> set;
+  typedef dtcrdt::ormap<int, set, int> map;
+  map a(1), b(2);
+  for (int k = 0; k < 10; k++)
+    a[k].add(k);
+  b.join(a);
+  // Each entry must see the context from before the join, otherwise
+  // dots that b imports for early keys would obsolete later keys
+  a[3].add(30);
+  a[9].add(90);
+  b.erase(5);
+  b[7].add(70);
+  map c(a);
+  c.join(b);
+  b.join(a);
+  for (int k = 0; k < 10; k++)
+    assert(b[k].read() == c[k].read());
+  assert(b[9].read().size() == 2 && b[5].read().empty());
+  // Copies own their context
+  map d = c;
+  d[0].add(1);
+  assert(c[0].read().size() == 1 && d[0].read().size() == 2);
+  std::cout << b[7].read() << std::endl;
+}
+
+void test_replicaid()
+{
+  std::cout << "--- Testing: replicaid --\n";
+  dtcrdt::replicaid rb("rb"), ra("ra"), rb2(std::string("rb"));
+  assert(rb == rb2 && rb != ra && rb < ra); // interning order, not names
+  assert(ra.name() == "ra" && dtcrdt::replicaid().name().empty());
+
+  dtcrdt::aworset<int, dtcrdt::replicaid> x("x"), y("y");
+  x.add(1);
+  y.add(2);
+  x.join(y.rmv(2));
+  y.join(x);
+  assert(y.read() == std::set<int>({1}));
+  std::cout << y << std::endl;
+
+  // Same bytes as string ids, even if the sender orders replicas by name
+  dtcrdt::aworset<int> s1("ra"), s2("rb");
+  s1.add(1);
+  s2.add(2);
+  s1.join(s2);
+  std::string b = dtcrdt::encode(s1);
+  dtcrdt::aworset<int, dtcrdt::replicaid> t("rc"), u;
+  t.add(3);
+  assert(t.join(dtcrdt::wireview(b)));
+  assert(t.read() == std::set<int>({1, 2, 3}));
+  assert(dtcrdt::decode(b, u) && dtcrdt::decode(dtcrdt::encode(u), s2));
+  assert(s2.read() == s1.read() && s2.context().dotin(std::make_pair(std::string("rb"), 1)));
+}
+
+// Membership through the value index must agree with read
+template <typename Set>
+void checkin(Set &x, int range)
+{
+  std::set<int> r = x.read();
+  for (int v = 0; v < range; v++)
+    assert(x.in(v) == (r.count(v) == 1));
+}
+
+template <typename S>
+void test_valindex_store()
+{
+  std::minstd_rand rnd(11);
+  dtcrdt::aworset<int, int, S> a(1), b(2), d;
+  dtcrdt::rworset<int, int, S> ra(1), rb(2);
+  for (int r = 0; r < 300; r++)
+  {
+    int v = rnd() % 20;
+    switch (rnd() % 6)
+    {
+    case 0:
+      d.join(a.rmv(v));
+      ra.rmv(v);
+      break;
+    case 1:
+      b.add(v);
+      rb.add(v);
+      break;
+    case 2:
+      b.rmv(v);
+      rb.rmv(v);
+      break;
+    case 3:
+      a.join(b);
+      ra.join(rb);
+      break;
+    case 4:
+      assert(b.join(dtcrdt::wireview(dtcrdt::encode(d))));
+      break;
+    default:
+      d.join(a.add(v));
+      ra.add(v);
+    }
+    checkin(a, 20);
+    checkin(b, 20);
+    checkin(ra, 20);
+    checkin(rb, 20);
+  }
+  dtcrdt::aworset<int, int, S> c;
+  assert(dtcrdt::decode(dtcrdt::encode(a), c));
+  checkin(c, 20);
+  c.reset();
+  checkin(c, 20);
+}
+
+void test_valindex()
+{
+  std::cout << "--- Testing: value index --\n";
+  test_valindex_store<dtcrdt::mapstore>();
+  test_valindex_store<dtcrdt::flatstore>();
+}
+
+void test_cached()
+{
+  std::cout << "--- Testing: cached reads --\n";
+  std::minstd_rand rnd(5);
+  dtcrdt::aworset<int, int> a(1), b(2);
+  dtcrdt::aworset<int, int, dtcrdt::mapstore, dtcrdt::cached> ca(1), cb(2);
+  dtcrdt::rworset<int, int> r(1), q(2);
+  dtcrdt::rworset<int, int, dtcrdt::flatstore, dtcrdt::cached> cr(1), cq(2);
+  dtcrdt::gcounter<int, int> g(1), h(2);
+  dtcrdt::gcounter<int, int, dtcrdt::cached> cg(1), ch(2);
+  dtcrdt::ccounter<int, int> k(1), l(2);
+  dtcrdt::ccounter<int, int, dtcrdt::mapstore, dtcrdt::cached> ck(1), cl(2);
+  dtcrdt::rwcounter<int, char> w('a'), x('b');
+  dtcrdt::rwcounter<int, char, dtcrdt::mapstore, dtcrdt::cached> cw('a'), cx('b');
+  for (int i = 0; i < 300; i++)
+  {
+    int v = rnd() % 10;
+    switch (rnd() % 5)
+    {
+    case 0:
+      a.rmv(v), ca.rmv(v), r.rmv(v), cr.rmv(v);
+      k.dec(v), ck.dec(v), w.dec(v), cw.dec(v);
+      break;
+    case 1:
+      b.add(v), cb.add(v), q.add(v), cq.add(v), h.inc(v), ch.inc(v);
+      l.inc(v), cl.inc(v), x.inc(v), cx.inc(v);
+      break;
+    case 2:
+      a.join(b), ca.join(cb), r.join(q), cr.join(cq), g.join(h), cg.join(ch);
+      k.join(l), ck.join(cl), w.join(x), cw.join(cx);
+      break;
+    case 3:
+      b.join(a), cb.join(ca), q.join(r), cq.join(cr), h.join(g);
+      assert(ch.join(dtcrdt::wireview(dtcrdt::encode(cg))));
+      l.join(k), cl.join(ck), x.join(w);
+      assert(cx.join(dtcrdt::wireview(dtcrdt::encode(cw))));
+      if (v == 0)
+        b.reset(), cb.reset(), l.reset(), cl.reset(), x.reset(), cx.reset();
+      break;
+    default:
+      a.add(v), ca.add(v), r.add(v), cr.add(v), g.inc(v), cg.inc(v);
+      k.inc(v), ck.inc(v), w.inc(v), cw.inc(v);
+    }
+    assert(ca.view() == a.read() && cb.read() == b.read());
+    assert(cr.view() == r.read() && cq.read() == q.read());
+    assert(cg.read() == g.read() && ch.read() == h.read());
+    assert(ck.read() == k.read() && cl.read() == l.read());
+    assert(cw.read() == w.read() && cx.read() == x.read());
+  }
+  dtcrdt::gcounter<int, int, dtcrdt::cached> dg;
+  dtcrdt::rwcounter<int, char, dtcrdt::mapstore, dtcrdt::cached> dw;
+  assert(dtcrdt::decode(dtcrdt::encode(cg), dg) && dg.read() == g.read());
+  assert(dtcrdt::decode(dtcrdt::encode(cw), dw) && dw.read() == w.read());
+
+  // Removals by value keep a running sum in step
+  dtcrdt::dotkernel<int, char, dtcrdt::mapstore, dtcrdt::sumindex> sk;
+  sk.add('a', 4), sk.add('a', 6), sk.add('b', 4);
+  sk.rmv(4);
+  assert(sk.idx.sum() == 6);
+
+  // Entries of a map keep their views through map joins
+  typedef dtcrdt::aworset<int, int, dtcrdt::mapstore, dtcrdt::cached> cset;
+  dtcrdt::ormap<int, cset, int> m1(1), m2(2);
+  m1[1].add(1);
+  m2[1].add(2);
+  m2.join(m1.apply(2, [](cset &s) { return s.add(3); }));
+  m1.join(m2);
+  m1[1].rmv(2);
+  m2.join(m1);
+  assert(m2[1].view() == std::set<int>({1}) && m2[2].view() == std::set<int>({3}));
+  std::cout << ca.view() << " " << cw.read() << std::endl;
+}
+
+void test_shardmap()
+{
+  std::cout << "--- Testing: shardmap --\n";
+  typedef dtcrdt::aworset<int> set;
+  typedef dtcrdt::ormap<int, set> map;
+  dtcrdt::shardmap<int, set> sm({"s0", "s1", "s2", "s3"});
+  map peer("p"), mirror("m");
+
+  // Threads on their own keys, shipping their deltas to a plain map peer
+  std::vector<map> deltas[4];
+  std::vector<std::thread> ts;
+  for (int t = 0; t < 4; t++)
+    ts.emplace_back([&sm, &deltas, t]() {
+      for (int i = 0; i < 200; i++)
+      {
+        int k = t * 1000 + i % 50;
+        deltas[t].push_back(sm.apply(k, [&](set &s) { return s.add(i); }));
+        if (i % 7 == 0)
+          deltas[t].push_back(sm.apply(k, [&](set &s) { return s.rmv(i - 7); }));
+        if (i % 45 == 44)
+          deltas[t].push_back(sm.erase(k));
+      }
+    });
+  for (auto &t : ts)
+    t.join();
+  for (auto &ds : deltas)
+    for (auto &d : ds)
+      peer.join(d);
+  map st = sm.state();
+  for (int t = 0; t < 4; t++)
+    for (int i = 0; i < 50; i++)
+    {
+      int k = t * 1000 + i;
+      std::set<int> v; // Absent and erased entries read empty
+      sm.find(k, [&](set &s) { v = s.read(); });
+      assert(v == peer[k].read());
+      assert(st[k].read() == peer[k].read());
+    }
+
+  // Remote deltas, including erases of keys the delta does not name
+  mirror.join(st);
+  for (int i = 0; i < 300; i++)
+  {
+    int k = i % 60;
+    map d = i % 11 == 10 ? peer.erase(k) : peer.apply(k, [&](set &s) { return s.add(i); });
+    sm.join(d);
+    mirror.join(d);
+  }
+  st = sm.state();
+  for (int k = 0; k < 60; k++)
+  {
+    std::set<int> v;
+    sm.find(k, [&](set &s) { v = s.read(); });
+    assert(v == mirror[k].read());
+    assert(st[k].read() == mirror[k].read());
+  }
+
+  // Snapshots taken while remote deltas land must not hold their dots
+  // without their entries, or the sender would drop its own writes
+  std::vector<map> ds, snaps;
+  for (int i = 0; i < 4000; i++)
+    ds.push_back(peer.apply(i % 80, [&](set &s) { return s.add(1000 + i); }));
+  std::atomic<bool> joined(false);
+  std::thread tj([&]() {
+    for (auto &d : ds)
+      sm.join(d);
+    joined = true;
+  });
+  while (!joined)
+  {
+    snaps.push_back(sm.state());
+    std::this_thread::yield();
+  }
+  tj.join();
+  for (auto &snap : snaps)
+  {
+    map x = peer;
+    x.join(snap);
+    for (int k = 0; k < 80; k++)
+      assert(x[k].read() == peer[k].read());
+  }
+}
+
+void test_parallel_join()
+{
+  std::cout << "--- Testing: parallel join --\n";
+  typedef dtcrdt::ormap<int, dtcrdt::aworset<int, char>, char> map;
+  std::minstd_rand rnd(9);
+  map a('a'), b('b');
+  for (int i = 0; i < 3000; i++)
+  {
+    int k = rnd() % 2000, v = rnd() % 5;
+    map &x = rnd() % 2 ? a : b;
+    if (rnd() % 10 == 0)
+      x.erase(k);
+    else
+      x.apply(k, [&](dtcrdt::aworset<int, char> &s) { return rnd() % 4 ? s.add(v) : s.rmv(v); });
+    if (i == 1500)
+      b.join(a); // later joins have removals to apply
+  }
+  for (unsigned threads : {1, 3, 8})
+  {
+    map x = a, y = a;
+    x.join(b);
+    y.join(b, threads);
+    assert(dtcrdt::encode(x) == dtcrdt::encode(y));
+    map z = b, w = b; // and with the bigger state on the left
+    z.join(a);
+    w.join(a, threads);
+    assert(dtcrdt::encode(z) == dtcrdt::encode(w));
+  }
+
+  dtcrdt::gmap<int, dtcrdt::gcounter<int, char>> g, h;
+  for (int i = 0; i < 2000; i++)
+  {
+    dtcrdt::gcounter<int, char> c(i % 2 ? 'a' : 'b');
+    c.inc(rnd() % 10 + 1);
+    (i % 3 ? g : h)[int(rnd() % 1500)].join(c);
+  }
+  for (unsigned threads : {2, 8})
+  {
+    auto x = g, y = g;
+    x.join(h);
+    y.join(h, threads);
+    assert(dtcrdt::encode(x) == dtcrdt::encode(y));
+  }
+}
+
+void test_deltaqueue()
+{
+  std::cout << "--- Testing: delta queue --\n";
+  typedef dtcrdt::aworset<int, char> set;
+  set x('x'), y('y');
+  std::vector<set> ds[4];
+  for (int t = 0; t < 4; t++)
+  {
+    set r(char('a' + t));
+    for (int i = 0; i < 300; i++)
+      ds[t].push_back(i % 5 == 4 ? r.rmv(t * 1000 + i - 2) : r.add(t * 1000 + i));
+  }
+  {
+    dtcrdt::deltaqueue<set> q(x);
+    q.start();
+    std::vector<std::thread> ts;
+    for (int t = 0; t < 4; t++)
+      ts.emplace_back([&q, &ds, t]() {
+        for (auto &d : ds[t])
+          q.push(d);
+      });
+    for (auto &t : ts)
+      t.join();
+    q.stop();
+    q.push(ds[0][0]); // left over deltas are applied on destruction
+  }
+  for (auto &v : ds)
+    for (auto &d : v)
+      y.join(d);
+  assert(x.read() == y.read());
+  assert(x.read().size() == 4 * 180);
+  std::string a, b;
+  x.encode(a);
+  y.encode(b);
+  assert(a.size() == b.size());
+}
+
+void test_alloc()
+{
+  std::cout << "--- Testing: allocators --\n";
+  dtcrdt::arena ar(64);
+  void *p = ar.allocate(24, 8);
+  assert(ar.allocate(100, 16) != p && ar.allocate(1000, 8) != nullptr);
+  ar.release();
+  assert(ar.allocate(24, 8) == p);
+  ar.release();
+
+  std::minstd_rand rnd(5);
+  dtcrdt::aworset<int, char> ma('a'), mb('b');
+  dtcrdt::aworset<int, char, dtcrdt::poolstore> pa('a'), pb('b');
+  dtcrdt::aworset<int, char, dtcrdt::arenastore> aa('a'), ab('b');
+  dtcrdt::ccounter<int, char, dtcrdt::arenastore> ca('a'), cb('b');
+  int count = 0;
+  for (int i = 0; i < 20; i++)
+  {
+    std::vector<dtcrdt::aworset<int, char, dtcrdt::arenastore>> batch;
+    std::vector<dtcrdt::ccounter<int, char, dtcrdt::arenastore>> cbatch;
+    {
+      dtcrdt::arenascope sc(ar); // Deltas only, joined after the scope
+      for (int j = 0; j < 10; j++)
+      {
+        int v = rnd() % 30;
+        bool add = rnd() % 3;
+        mb.join(add ? ma.add(v) : ma.rmv(v));
+        pb.join(add ? pa.add(v) : pa.rmv(v));
+        batch.push_back(add ? aa.add(v) : aa.rmv(v));
+        cbatch.push_back(ca.inc(v));
+        count += v;
+      }
+    }
+    for (auto &d : batch)
+      ab.join(d);
+    for (auto &d : cbatch)
+      cb.join(std::move(d));
+    batch.clear();
+    cbatch.clear();
+    ar.release();
+    assert(ma.read() == mb.read() && pb.read() == mb.read() && ab.read() == mb.read());
+    assert(cb.read() == count);
+  }
+  // State made outside the scope survives the release
+  ab.add(100);
+  assert(ab.in(100) && ab.read().size() == mb.read().size() + 1);
+
+  // Entries a map makes inside a scope follow the map, so the arena can
+  // be released and reused while the map lives on
+  typedef dtcrdt::aworset<int, std::string, dtcrdt::arenastore> aset;
+  dtcrdt::ormap<int, aset> om("m"), on("n");
+  for (int i = 0; i < 20; i++)
+  {
+    std::vector<dtcrdt::ormap<int, aset>> batch;
+    {
+      dtcrdt::arenascope sc(ar);
+      for (int j = 0; j < 10; j++)
+      {
+        int k = rnd() % 8, v = rnd() % 30;
+        batch.push_back(om.apply(k, [&](aset &s) { return s.add(v); }));
+      }
+    }
+    for (auto &d : batch)
+      on.join(d);
+    batch.clear();
+    ar.release();
+    for (int j = 0; j < 64; j++)
+      memset(ar.allocate(256, 8), 0xff, 256);
+    ar.release();
+  }
+  for (int k = 0; k < 8; k++)
+    assert(om[k].read() == on[k].read());
+}
+
+// Joins from moved states match joins from copies and leave the source usable
+void test_move_join()
+{
+  std::cout << "--- Testing: move join --\n";
+  dtcrdt::aworset<int, char> a('a'), b('b');
+  for (int i = 0; i < 20; i++)
+    (i % 3 ? a : b).add(i);
+  b.rmv(3);
+  a.rmv(6);
+
+  // Into an empty replica and into a populated one
+  for (int fresh = 0; fresh < 2; fresh++)
+  {
+    dtcrdt::aworset<int, char> x('x'), y('y');
+    if (!fresh)
+    {
+      x.join(a);
+      y.join(a);
+    }
+    dtcrdt::aworset<int, char> m = b;
+    x.join(b);
+    y.join(std::move(m));
+    assert(x.read() == y.read());
+    assert(y.read() == dtcrdt::join(a, b).read() || fresh);
+    // The moved state is left behind with its own context
+    y.add(100);
+    x.join(y);
+    assert(x.in(100));
+  }
+
+  // Moving a map entry must keep the map's shared context
+  dtcrdt::ormap<int, dtcrdt::aworset<int, char>, char> om('m');
+  om[1].add(1);
+  dtcrdt::aworset<int, char> e = std::move(om[1]);
+  om[2].add(2);
+  e.add(5);
+  assert(om[2].in(2) && e.in(1) && e.in(5));
+
+  std::pair<int, dtcrdt::gset<int>> p(1, dtcrdt::gset<int>()), q(3, dtcrdt::gset<int>());
+  p.second.add(1);
+  q.second.add(2);
+  dtcrdt::join_into(p, q);
+  assert(p.first == 3 && p.second.in(1) && p.second.in(2));
+  int i = 4;
+  dtcrdt::join_into(i, 2);
+  assert(i == 4);
+  assert(dtcrdt::join(dtcrdt::gset<int>(q.second), p.second).read() == p.second.read());
+}
+
+void test_join_many()
+{
+  std::cout << "--- Testing: join many --\n";
+  std::minstd_rand rnd(11);
+
+  // Deltas with removals of elements seen by some deltas only
+  typedef dtcrdt::aworset<int, char> set;
+  set a('a'), b('b'), x('x');
+  std::vector<set> ds;
+  for (int i = 0; i < 400; i++)
+  {
+    set &r = rnd() % 2 ? a : b;
+    int v = rnd() % 50;
+    ds.push_back(rnd() % 3 ? r.add(v) : r.rmv(v));
+    if (i % 100 == 99)
+      b.join(a);
+  }
+  for (int i = 0; i < 40; i++)
+    x.add(i);
+  set y = x;
+  ds.push_back(x); // joining itself is skipped
+  x.join_many(ds.begin(), ds.end());
+  for (auto &d : ds)
+    y.join(d);
+  assert(x.read() == y.read());
+  assert(dtcrdt::encode(x) == dtcrdt::encode(y));
+
+  dtcrdt::dotcontext<char> c, e;
+  std::vector<dtcrdt::dotcontext<char>> cs(4);
+  for (int i = 0; i < 200; i++)
+    cs[rnd() % 4].insertdot(std::make_pair(char('a' + rnd() % 3), int(rnd() % 60 + 1)));
+  c.join_many(cs.begin(), cs.end());
+  for (auto &o : cs)
+    e.join(o);
+  assert(c.cc == e.cc && c.dc == e.dc);
+
+  dtcrdt::gset<int> s, t;
+  std::vector<dtcrdt::gset<int>> ss(5);
+  dtcrdt::gcounter<int, char, dtcrdt::cached> g, h;
+  std::vector<dtcrdt::gcounter<int, char, dtcrdt::cached>> gs;
+  dtcrdt::gmap<int, dtcrdt::gcounter<int, char>> m, n;
+  std::vector<dtcrdt::gmap<int, dtcrdt::gcounter<int, char>>> ms(5);
+  for (int i = 0; i < 300; i++)
+  {
+    ss[rnd() % 5].add(rnd() % 100);
+    dtcrdt::gcounter<int, char, dtcrdt::cached> r(char('a' + rnd() % 4));
+    gs.push_back(r.inc(rnd() % 20 + 1));
+    dtcrdt::gcounter<int, char> q(char('a' + rnd() % 3));
+    q.inc(rnd() % 9 + 1);
+    ms[rnd() % 5][int(rnd() % 40)].join(q);
+  }
+  s.join_many(ss.begin(), ss.end());
+  g.join_many(gs.begin(), gs.end());
+  m.join_many(ms.begin(), ms.end());
+  for (int i = 0; i < 5; i++)
+    t.join(ss[i]), n.join(ms[i]);
+  for (auto &o : gs)
+    h.join(o);
+  assert(s.read() == t.read());
+  assert(g.read() == h.read() && g == h);
+  assert(dtcrdt::encode(m) == dtcrdt::encode(n));
+
+  typedef dtcrdt::ormap<int, set, char> map;
+  map p('p'), o('o'), u, w;
+  std::vector<map> mds;
+  for (int i = 0; i < 300; i++)
+  {
+    map &r = i % 2 ? p : o;
+    int k = rnd() % 30;
+    mds.push_back(rnd() % 8 ? r.apply(k, [&](set &q) { return q.add(i); }) : r.erase(k));
+  }
+  u.join_many(mds.begin(), mds.end());
+  for (auto &d : mds)
+    w.join(d);
+  for (int k = 0; k < 30; k++)
+    assert(u[k].read() == w[k].read());
+
+  typedef dtcrdt::orseq<char, char> seq;
+  seq q('q'), z, zz;
+  std::vector<seq> qs;
+  for (int i = 0; i < 100; i++)
+    qs.push_back(q.size() && rnd() % 4 == 0 ? q.erase_at(rnd() % q.size()) : q.push_back(char('a' + i % 26)));
+  z.join_many(qs.begin(), qs.end());
+  for (auto &d : qs)
+    zz.join(d);
+  assert(dtcrdt::encode(z) == dtcrdt::encode(zz) && dtcrdt::encode(z) == dtcrdt::encode(q));
+}
+
+void test_densecounter()
+{
+  std::cout << "--- Testing: dense counters --\n";
+  std::minstd_rand rnd(13);
+  typedef dtcrdt::replicaid rid;
+  const char *names[] = {"d0", "d1", "d2", "d3", "d4", "d5", "d6", "d7", "d8", "d9"};
+  std::vector<dtcrdt::densecounter<int, rid>> ds;
+  std::vector<dtcrdt::gcounter<int, rid>> gs;
+  for (auto n : names)
+    ds.push_back(dtcrdt::densecounter<int, rid>(n)), gs.push_back(dtcrdt::gcounter<int, rid>(n));
+  for (int i = 0; i < 500; i++)
+  {
+    int r = rnd() % 10, v = rnd() % 100;
+    if (rnd() % 3)
+    {
+      ds[r].join(ds[(r + 1) % 10].inc(v));
+      gs[r].join(gs[(r + 1) % 10].inc(v));
+    }
+    else
+    {
+      int o = rnd() % 10;
+      ds[r].join(ds[o]);
+      gs[r].join(gs[o]);
+    }
+  }
+  for (int r = 0; r < 10; r++)
+  {
+    assert(ds[r].read() == gs[r].read() && ds[r].local() == gs[r].local());
+    // Same wire format both ways
+    dtcrdt::densecounter<int, rid> d;
+    dtcrdt::gcounter<int, rid> g;
+    assert(dtcrdt::decode(dtcrdt::encode(gs[r]), d) && d == ds[r]);
+    assert(dtcrdt::decode(dtcrdt::encode(ds[r]), g) && g == gs[r]);
+    assert(d.join(dtcrdt::wireview(dtcrdt::encode(gs[(r + 1) % 10]))));
+    g.join(gs[(r + 1) % 10]);
+    assert(d.read() == g.read());
+  }
+
+  // Fixed slots, with int64_t counts over more slots than a lane holds
+  dtcrdt::densecounter<long, int, 16> f[16], all;
+  long total = 0;
+  for (int i = 0; i < 16; i++)
+    f[i] = dtcrdt::densecounter<long, int, 16>(i);
+  for (int i = 0; i < 1000; i++)
+  {
+    int r = rnd() % 16;
+    long v = rnd() % 1000000 * 1000000L;
+    total += v;
+    f[r].join(f[(r + 3) % 16].inc(v));
+    all.join(f[r]);
+  }
+  assert(all.read() == total);
+  dtcrdt::densecounter<long, int, 4> small;
+  assert(!small.join(dtcrdt::wireview(dtcrdt::encode(all))));
+
+  dtcrdt::pncounter<int, char, dtcrdt::densecounter<int, char>> x('x'), y('y');
+  dtcrdt::pncounter<int, char> px('x'), py('y');
+  x.join(y.inc(5)), px.join(py.inc(5));
+  y.join(x.dec(8)), py.join(px.dec(8));
+  x.join(y), px.join(py);
+  assert(x.read() == -3 && px.read() == -3 && dtcrdt::encode(x) == dtcrdt::encode(px));
+
+  dtcrdt::bcounter<int, char, dtcrdt::densecounter<int, char>> b1('a'), b2('b');
+  b1.join(b1.inc(10));
+  b2.join(b1.mv(4, 'b'));
+  b2.join(b2.dec(3));
+  b1.join(b2);
+  assert(b1.read() == 7 && b1.local() == 6 && b2.local() == 1);
+  assert(dtcrdt::decode(dtcrdt::encode(b1), b2) && b2.read() == 7);
+}
+
+void test_linear_join()
+{
+  std::cout << "--- Testing: linear joins --\n";
+  std::minstd_rand rnd(17);
+  // A big state joined with a dense and with a sparse one, so that merges
+  // both step and search
+  for (int spread : {1, 50})
+  {
+    dtcrdt::gset<int> ga, gb;
+    dtcrdt::twopset<int> ta, tb;
+    dtcrdt::gcounter<int, int, dtcrdt::cached> ca, cb;
+    dtcrdt::lexcounter<int, int> la, lb;
+    dtcrdt::rwlwwset<int, int> wa, wb;
+    dtcrdt::gmap<int, int> ma, mb;
+    std::set<int> gs, ts, tt;
+    std::map<int, int> cs, ms;
+    std::map<int, std::pair<int, bool>> ws;
+    for (int i = 0; i < 2000; i++)
+    {
+      bool big = i % (spread + 1) != 0;
+      int k = big ? i : i + int(rnd() % 3);
+      int v = rnd() % 100;
+      (big ? ga : gb).add(k), gs.insert(k);
+      if (rnd() % 4)
+        (big ? ta : tb).add(k), ts.insert(k);
+      else
+        (big ? ta : tb).rmv(k), tt.insert(k);
+      dtcrdt::gcounter<int, int, dtcrdt::cached> c(k);
+      c.inc(v);
+      (big ? ca : cb).join(c), cs[k] = std::max(cs[k], v);
+      (big ? wa : wb).add(v, k);
+      std::pair<int, bool> w(v, false);
+      ws[k] = ws.count(k) ? dtcrdt::lexjoin(ws[k], w) : w;
+      int &mv = (big ? ma : mb)[k];
+      mv = std::max(mv, v), ms[k] = std::max(ms[k], v);
+    }
+    dtcrdt::lexcounter<int, int> l1(1), l2(2);
+    for (int i = 0; i < 50; i++)
+    {
+      la.join(l1.inc(i));
+      lb.join(i % 3 ? l2.inc(i) : l1.dec(1));
+    }
+    ga.join(gb), ta.join(tb), ca.join(cb), la.join(lb), wa.join(wb), ma.join(mb);
+    assert(ga.read() == gs);
+    for (int k : tt)
+      ts.erase(k);
+    assert(ta.read() == ts);
+    int sum = 0;
+    for (const auto &kv : cs)
+      sum += kv.second;
+    assert(ca.read() == sum);
+    dtcrdt::gcounter<int, int> cu;
+    assert(dtcrdt::decode(dtcrdt::encode(ca), cu) && cu.read() == sum);
+    dtcrdt::lexcounter<int, int> lr(1);
+    lr.join(l1), lr.join(l2);
+    assert(la.read() == lr.read());
+    for (const auto &kv : ws)
+      assert(wa.in(kv.first));
+    assert(ma.m == ms);
+  }
+}
+
+// Joining what b has not seen of a must leave b as joining all of a.
+// Returns the encoded size of the delta.
+template <typename T>
+size_t catchup(T &a, const T &b)
+{
+  T x = b, y = b;
+  T d = a.delta_since(y.context());
+  x.join(d);
+  y.join(a);
+  assert(dtcrdt::encode(x) == dtcrdt::encode(y));
+  return dtcrdt::encode(d).size();
+}
+
+void test_delta_since()
+{
+  std::cout << "--- Testing: delta since --\n";
+  std::minstd_rand rnd(19);
+  typedef dtcrdt::aworset<int, char> set;
+  set a('a'), b('b');
+  for (int i = 0; i < 2000; i++)
+    a.add(i);
+  b.join(a);
+  assert(catchup(a, b) < 10); // nothing to send
+  for (int i = 0; i < 20; i++)
+  {
+    a.add(3000 + i);
+    a.rmv(int(rnd() % 2000));
+    b.add(4000 + i);
+    b.rmv(int(rnd() % 2000));
+  }
+  size_t n = catchup(a, b);
+  assert(n < dtcrdt::encode(a).size() / 20);
+  catchup(b, a);
+  set e('e'); // a peer that saw nothing
+  catchup(a, e);
+
+  dtcrdt::rworset<int, char> ra('a'), rb('b');
+  dtcrdt::mvreg<int, char> ma('a'), mb('b');
+  dtcrdt::ewflag<char> ea('a'), eb('b');
+  dtcrdt::dwflag<char> fa('a'), fb('b');
+  dtcrdt::ccounter<int, char> ca('a'), cb('b');
+  dtcrdt::rwcounter<int, char> wa('a'), wb('b');
+  for (int r = 0; r < 2; r++)
+  {
+    for (int i = 0; i < 30; i++)
+    {
+      bool x = rnd() % 2;
+      (x ? ra : rb).add(i % 7), (x ? rb : ra).rmv(i % 5);
+      (x ? ma : mb).write(i);
+      x ? ea.enable() : eb.disable();
+      x ? fa.disable() : fb.enable();
+      (x ? ca : cb).inc(i), (x ? cb : ca).dec(1);
+      (x ? wa : wb).inc(i);
+      if (i == 20)
+        wb.reset();
+    }
+    catchup(ra, rb), catchup(ma, mb), catchup(ea, eb), catchup(fa, fb);
+    catchup(ca, cb), catchup(wa, wb);
+    rb.join(ra), mb.join(ma), eb.join(ea), fb.join(fa), cb.join(ca), wb.join(wa);
+  }
+
+  // Counter payloads are rewritten under a dot the peer already knows
+  dtcrdt::rwcounter<int, char> ua('a'), ub('b');
+  ua.inc(5);
+  ub.join(ua);
+  ua.inc(7);
+  ub.join(ua.delta_since(ub.context()));
+  assert(ub.read() == 12 && ua.read() == 12);
+  dtcrdt::ormap<int, dtcrdt::rwcounter<int, char>, char> wm('a'), wn('b');
+  wm.apply(1, [](dtcrdt::rwcounter<int, char> &w) { return w.inc(5); });
+  wn.join(wm);
+  wm.apply(1, [](dtcrdt::rwcounter<int, char> &w) { return w.inc(7); });
+  wn.join(wm.delta_since(wn.context()));
+  assert(wn[1].read() == 12);
+
+  typedef dtcrdt::ormap<int, set, char> map;
+  map p('p'), q('q');
+  for (int i = 0; i < 500; i++)
+    p.apply(i % 100, [&](set &s) { return s.add(i); });
+  q.join(p);
+  for (int i = 0; i < 40; i++)
+  {
+    int k = rnd() % 120;
+    if (rnd() % 4 == 0)
+      (i % 2 ? p : q).erase(k);
+    else
+      (i % 2 ? p : q).apply(k, [&](set &s) { return rnd() % 3 ? s.add(i) : s.rmv(k); });
+  }
+  map d = p.delta_since(q.context());
+  assert(dtcrdt::encode(d).size() < dtcrdt::encode(p).size() / 10);
+  map x = q, y = q;
+  x.join(d);
+  y.join(p);
+  for (int k = 0; k < 120; k++)
+    assert(x[k].read() == y[k].read());
+  assert(x.context().cc == y.context().cc && x.context().dc == y.context().dc);
+
+  dtcrdt::ormap<int, dtcrdt::ormap<int, set, char>, char> nn('n'), no('o');
+  for (int i = 0; i < 50; i++)
+    (i % 2 ? nn : no).apply(i % 5, [&](map &m) { return m.apply(i % 3, [&](set &s) { return s.add(i); }); });
+  no.join(nn.delta_since(no.context()));
+  nn.join(no);
+  for (int k = 0; k < 5; k++)
+    for (int j = 0; j < 3; j++)
+      assert(no[k][j].read() == nn[k][j].read());
+
+  dtcrdt::orseq<char, char> sa('a'), sb('b');
+  for (int i = 0; i < 100; i++)
+    sa.push_back(char('a' + i % 26));
+  sb.join(sa);
+  for (int i = 0; i < 10; i++)
+  {
+    sa.erase_at(rnd() % sa.size());
+    sa.insert_at(rnd() % sa.size(), 'x');
+    sb.push_back('y');
+  }
+  assert(catchup(sa, sb) < dtcrdt::encode(sa).size() / 2);
+}
+
+// Counters in a map keep counting right across joins, resets and deltas
+// while their own dot is cached
+void test_own_dot()
+{
+  std::cout << "--- Testing: own dot --\n";
+  std::minstd_rand rnd(17);
+  typedef dtcrdt::ormap<int, dtcrdt::ccounter<int>> cmap;
+  typedef dtcrdt::ormap<int, dtcrdt::rwcounter<int, char>, char> rmap;
+  cmap ca("a"), cb("b");
+  rmap ra('a'), rb('b');
+  std::map<int, int> expect;
+  for (int i = 0; i < 600; i++)
+  {
+    int k = rnd() % 4, v = rnd() % 5;
+    bool a = rnd() % 2, up = rnd() % 3;
+    cmap &c = a ? ca : cb;
+    rmap &r = a ? ra : rb;
+    (a ? cb : ca).join(c.apply(k, [&](dtcrdt::ccounter<int> &x) { return up ? x.inc(v) : x.dec(v); }));
+    (a ? rb : ra).join(r.apply(k, [&](dtcrdt::rwcounter<int, char> &x) { return up ? x.inc(v) : x.dec(v); }));
+    expect[k] += up ? v : -v;
+    if (rnd() % 50 == 0) // Concurrent with nothing, so the reset is total
+    {
+      (a ? cb : ca).join(c.erase(k));
+      (a ? rb : ra).join(r.apply(k, [](dtcrdt::rwcounter<int, char> &x) { return x.reset(); }));
+      expect[k] = 0;
+    }
+    if (rnd() % 10 == 0)
+    {
+      ca.join(cb);
+      cb.join(ca);
+    }
+    for (int j = 0; j < 4; j++)
+    {
+      assert(ca[j].read() == expect[j] && cb[j].read() == expect[j]);
+      assert(ra[j].read() == expect[j] && rb[j].read() == expect[j]);
+    }
+  }
+  dtcrdt::ccounter<int> c("c");
+  c.dec();
+  c.dec();
+  assert(c.read() == -2);
+  dtcrdt::bag<int> b("b"), o("o");
+  b.mydata() = 3;
+  o.mydata() = 4;
+  b.join(o);
+  b.fresh();
+  assert(b.mydot() == std::make_pair(std::string("b"), 2) && b.mydata() == 0);
+  std::cout << ca << std::endl;
+}
+
+// Resolve keeps the maximal values, and its delta removes the rest elsewhere
+template <typename S>
+void test_mvreg_resolve_store()
+{
+  std::minstd_rand rnd(13);
+  dtcrdt::mvreg<std::pair<int, int>, std::string, S> a("a"), b("b");
+  dtcrdt::mvreg<int, std::string, S> x("x"), y("y");
+  for (int i = 0; i < 40; i++)
+  {
+    std::string id = "w" + std::to_string(i);
+    dtcrdt::mvreg<std::pair<int, int>, std::string, S> w(id);
+    dtcrdt::mvreg<int, std::string, S> v(id);
+    w.write(std::pair<int, int>(rnd() % 8, rnd() % 8));
+    v.write(int(rnd() % 100));
+    a.join(w);
+    x.join(v);
+  }
+  b.join(a);
+  y.join(x);
+  std::set<std::pair<int, int>> all = a.read(), top;
+  for (const auto &p : all)
+  {
+    bool below = false;
+    for (const auto &q : all)
+      below = below || (p != q && p.first <= q.first && p.second <= q.second);
+    if (!below)
+      top.insert(p);
+  }
+  b.join(a.resolve());
+  assert(a.read() == top && b.read() == top);
+  std::set<int> xs = x.read();
+  y.join(x.resolve());
+  assert(x.read() == std::set<int>{*xs.rbegin()} && y.read() == x.read());
+  assert(x.resolve().context().cc.empty());
+}
+
+void test_mvreg_resolve()
+{
+  std::cout << "--- Testing: mvreg resolve --\n";
+  test_mvreg_resolve_store<dtcrdt::mapstore>();
+  test_mvreg_resolve_store<dtcrdt::flatstore>();
+  assert(dtcrdt::leq(std::pair<int, int>(1, 2), std::pair<int, int>(1, 3)));
+  assert(!dtcrdt::leq(std::pair<int, int>(2, 2), std::pair<int, int>(1, 3)));
+}
+
+// The same edits on list and tree backed sequences give the same state
+void test_orseq_tree()
+{
+  std::cout << "--- Testing: orseq tree --\n";
+  typedef dtcrdt::orseq<char, std::string> lseq;
+  typedef dtcrdt::orseq<char, std::string, dtcrdt::treeseq> tseq;
+  std::minstd_rand rnd(3);
+  lseq la("a"), lb("b");
+  tseq ta("a"), tb("b");
+  for (int i = 0; i < 400; i++)
+  {
+    char ch = char('a' + rnd() % 26);
+    size_t k = rnd() % (la.size() + 1);
+    switch (rnd() % 4)
+    {
+    case 0:
+      if (la.size() > 0)
+      {
+        k = k % la.size();
+        assert(ta.at(k) == la.at(k));
+        lb.join(la.erase_at(k));
+        tb.join(ta.erase_at(k));
+      }
+      break;
+    case 1: // concurrent with the edits at a
+      lb.insert_at(lb.size() / 2, ch);
+      tb.insert_at(tb.size() / 2, ch);
+      la.join(lb);
+      ta.join(tb);
+      break;
+    default:
+      lb.join(la.insert_at(k, ch));
+      tb.join(ta.insert_at(k, ch));
+    }
+    assert(ta.size() == la.size() && dtcrdt::encode(ta) == dtcrdt::encode(la));
+    assert(dtcrdt::encode(tb) == dtcrdt::encode(lb));
+  }
+  ta.join(tb);
+  tb.join(ta);
+  assert(dtcrdt::encode(ta) == dtcrdt::encode(tb));
+  std::string read;
+  for (const auto &t : ta)
+    read.push_back(std::get<2>(t));
+  for (size_t k = 0; k < ta.size(); k++)
+    assert(ta.at(k) == read[k]);
+  tseq tc;
+  assert(dtcrdt::decode(dtcrdt::encode(ta), tc) && tc.size() == ta.size());
+  std::cout << read << std::endl;
+}
+
+// Block sequences hold the same elements as list ones, with runs merged
+void test_orseq_block()
+{
+  std::cout << "--- Testing: orseq block --\n";
+  typedef dtcrdt::orseq<char, std::string, dtcrdt::blockseq> bseq;
+  typedef dtcrdt::orseq<char, std::string> lseq;
+  auto mirror = [](const bseq &d) {
+    lseq r;
+    assert(dtcrdt::decode(dtcrdt::encode(d), r));
+    return r;
+  };
+  std::minstd_rand rnd(11);
+  bseq a("a"), b("b");
+  lseq la, lb;
+  for (int i = 0; i < 200; i++)
+  {
+    size_t k = rnd() % (a.size() + 1), m = 1 + rnd() % 20;
+    switch (rnd() % 4)
+    {
+    case 0: // erase a range
+      for (size_t j = 0; j < m && k < a.size(); j++)
+      {
+        auto d = a.erase_at(k);
+        la.join(mirror(d));
+        b.join(d);
+        lb.join(mirror(d));
+      }
+      break;
+    case 1: // concurrent typing at b
+      k = rnd() % (b.size() + 1);
+      for (size_t j = 0; j < m; j++)
+        lb.join(mirror(b.insert_at(k + j, char('A' + rnd() % 26))));
+      a.join(b);
+      la.join(lb);
+      break;
+    default: // typing at a
+      for (size_t j = 0; j < m; j++)
+      {
+        auto d = a.insert_at(k + j, char('a' + rnd() % 26));
+        la.join(mirror(d));
+        b.join(d);
+        lb.join(mirror(d));
+      }
+    }
+    assert(dtcrdt::encode(a) == dtcrdt::encode(la));
+    assert(dtcrdt::encode(b) == dtcrdt::encode(lb));
+  }
+  b.join(a);
+  assert(dtcrdt::encode(a) == dtcrdt::encode(b));
+  std::string read;
+  for (const auto &t : a)
+    read.push_back(std::get<2>(t));
+  for (size_t k = 0; k < a.size(); k++)
+    assert(a.at(k) == read[k]);
+  // Runs are found again when elements arrive one by one
+  dtcrdt::blocklist<bseq::element> bl;
+  for (const auto &t : la)
+    bl.push_back(t);
+  assert(bl.size() == a.size() && bl.blocks() * 3 < bl.size());
+  bseq c;
+  assert(dtcrdt::decode(dtcrdt::encode(la), c) && dtcrdt::encode(c) == dtcrdt::encode(a));
+  std::cout << a.size() << " " << bl.blocks() << std::endl;
+}
+
+// Packed ids order, compare and encode like bit vectors, inline or spilled
+void test_posid()
+{
+  std::cout << "--- Testing: posid --\n";
+  std::minstd_rand rnd(7);
+  std::vector<std::vector<bool>> vs;
+  std::vector<dtcrdt::posid> ps;
+  for (int i = 0; i < 200; i++)
+  {
+    std::vector<bool> v;
+    dtcrdt::posid p;
+    size_t n = rnd() % 300;
+    for (size_t j = 0; j < n; j++)
+    {
+      // Runs of shared prefixes make the compares interesting
+      bool b = i > 0 && j < vs.back().size() && rnd() % 8 ? vs.back()[j] : rnd() % 2;
+      v.push_back(b);
+      p.push_back(b);
+    }
+    assert(p.size() == v.size());
+    assert(dtcrdt::encode(p) == dtcrdt::encode(v));
+    vs.push_back(v);
+    ps.push_back(p);
+  }
+  for (size_t i = 0; i < vs.size(); i++)
+    for (size_t j = 0; j < vs.size(); j++)
+    {
+      assert((ps[i] < ps[j]) == (vs[i] < vs[j]));
+      assert((ps[i] == ps[j]) == (vs[i] == vs[j]));
+    }
+  // A moved from id reads as zeros when grown again
+  dtcrdt::posid a, b;
+  for (int i = 0; i < 200; i++)
+    a.push_back(true);
+  b = std::move(a);
+  a.resize(3);
+  assert(dtcrdt::encode(a) == dtcrdt::encode(std::vector<bool>(3, false)));
+  dtcrdt::posid p = ps[0], q;
+  p.resize(p.size() / 2);
+  std::vector<bool> v = vs[0];
+  v.resize(v.size() / 2);
+  p.resize(p.size() + 70);
+  v.resize(v.size() + 70);
+  assert(dtcrdt::encode(p) == dtcrdt::encode(v));
+  assert(dtcrdt::decode(dtcrdt::encode(p), q) && q == p);
+  q = std::move(p);
+  assert(dtcrdt::encode(q) == dtcrdt::encode(v) && p.empty());
+  for (int i = 0; i < 20; i++)
+  {
+    size_t a = rnd() % vs.size(), b = rnd() % vs.size();
+    if (vs[a] == vs[b])
+      continue;
+    if (vs[b] < vs[a])
+      std::swap(a, b);
+    dtcrdt::posid m = dtcrdt::among(ps[a], ps[b]);
+    assert(dtcrdt::encode(m) == dtcrdt::encode(dtcrdt::among(vs[a], vs[b])));
+  }
+  std::cout << ps[1] << std::endl;
+}
+
+// LSEQ ids keep order, mix with bisect ids and stay short on appends
+void test_orseq_lseq()
+{
+  std::cout << "--- Testing: orseq lseq --\n";
+  typedef dtcrdt::orseq<char, std::string, dtcrdt::treeseq> seq;
+  std::minstd_rand rnd(5);
+  seq a("a"), b("b");
+  a.allocation(dtcrdt::alloc::lseq);
+  for (int i = 0; i < 300; i++)
+  {
+    char ch = char('a' + rnd() % 26);
+    if (i % 3 == 0)
+      a.join(b.insert_at(rnd() % (b.size() + 1), ch));
+    else
+      b.join(a.insert_at(rnd() % (a.size() + 1), ch));
+  }
+  assert(dtcrdt::encode(a) == dtcrdt::encode(b));
+  dtcrdt::posid prev;
+  for (const auto &t : a)
+  {
+    assert(prev < std::get<0>(t) && std::get<0>(t).back());
+    prev = std::get<0>(t);
+  }
+  seq c("c"), d("d");
+  c.allocation(dtcrdt::alloc::lseq);
+  for (int i = 0; i < 1000; i++)
+  {
+    c.push_back('x');
+    d.push_back('x');
+  }
+  size_t cl = 0, dl = 0;
+  for (const auto &t : c)
+    cl = std::max(cl, std::get<0>(t).size());
+  for (const auto &t : d)
+    dl = std::max(dl, std::get<0>(t).size());
+  assert(cl < 128 && dl >= 1000);
+  std::cout << a.size() << " " << cl << " " << dl << std::endl;
+
+  // Replicas inserting into one gap at once draw apart, as their seeds
+  // differ, and inserts between those that still got the same position
+  // go through. Both replicas draw equally often, so equal seeds would
+  // always collide.
+  seq e("e"), f("f");
+  e.allocation(dtcrdt::alloc::lseq);
+  f.allocation(dtcrdt::alloc::lseq);
+  e.push_back('<');
+  f.join(e);
+  f.push_back('>');
+  e.join(f);
+  int same = 0;
+  for (int i = 0; i < 40; i++)
+  {
+    size_t k = 1 + rnd() % (e.size() - 1);
+    seq de = e.insert_at(k, 'e'), df = f.insert_at(k, 'f');
+    same += std::get<0>(*de.begin()) == std::get<0>(*df.begin());
+    e.join(df), f.join(de);
+    f.join(e.insert_at(k + 1, 'x'));
+    e.join(f.insert_at(k + 1, 'y'));
+  }
+  assert(same < 10);
+  assert(dtcrdt::encode(e) == dtcrdt::encode(f) && e.size() == 2 + 4 * 40);
+}
+
 void test_ormap()
 {
   dtcrdt::ormap<std::string, dtcrdt::twopset<std::string>> m1, m2;
@@ -523,47 +2111,6 @@ void test_ormap()
   std::cout << m7 << std::endl;
 }
 
-void benchmark1()
-{
-  dtcrdt::aworset<int, char> g('i');
-  //  dtcrdt::twopset<int> g;
-
-  using namespace std::chrono;
-
-  steady_clock::time_point t1 = steady_clock::now();
-
-  //const long double TimeBefore = time(0);
-
-  for (int i = 1; i < 1000; i++) // 1k
-  {
-    g.add(i);
-  }
-  for (int i = 1; i < 1000; i += 2) // 1k
-  {
-    g.rmv(i);
-  }
-  for (int i = 999; i > 0; i--) // 1k
-  {
-    g.add(i);
-  }
-
-  steady_clock::time_point t2 = steady_clock::now();
-
-  duration<double> time_span = duration_cast<duration<double>>(t2 - t1);
-
-  std::cout << "It took me " << time_span.count() << " seconds.";
-  std::cout << std::endl;
-
-  std::cout << g.in(0) << std::endl;
-  std::cout << g.in(10) << std::endl;
-
-  /*
-  const long double TimeAfter = time(0);
-
-  std::cout << "Elapsed System Time in Seconds is " << TimeAfter-TimeBefore << "." << std::endl;
-  */
-}
-
 void example_gset()
 {
   dtcrdt::gset<std::string> a, b;
@@ -1041,6 +2588,30 @@ int main(int argc, char *argv[])
   test_rwlwwset();
   test_ewflag();
   test_dwflag();
+  test_dotcontext();
+  test_flatstore();
+  test_wire();
+  test_delta_buffer();
+  test_ormap_apply();
+  test_ormap_join();
+  test_replicaid();
+  test_valindex();
+  test_cached();
+  test_move_join();
+  test_alloc();
+  test_shardmap();
+  test_parallel_join();
+  test_deltaqueue();
+  test_join_many();
+  test_densecounter();
+  test_linear_join();
+  test_delta_since();
+  test_own_dot();
+  test_mvreg_resolve();
+  test_orseq_tree();
+  test_posid();
+  test_orseq_lseq();
+  test_orseq_block();
   test_ormap();
   test_rwlwwset();
   test_bag();